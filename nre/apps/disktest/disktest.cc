@@ -17,6 +17,7 @@
 #include <services/Console.h>
 #include <services/Storage.h>
 #include <stream/VGAStream.h>
+#include <stream/IStringStream.h>
 #include <util/Bytes.h>
 #include <Test.h>
 
@@ -29,6 +30,8 @@ static const Storage::sector_type cdsec     = 80;
 static const size_t offset                  = 0x200;
 static Storage::tag_type tag                = 0;
 static Storage::dma_type dma;
+static Storage::Priority prio               = Storage::PRIO_NORMAL;
+static uint weight                          = 1;
 
 static void wait_for(StorageSession &sess, Storage::tag_type tag) {
     Storage::Packet *pk;
@@ -90,6 +93,25 @@ static void read_write_ata(StorageSession &disk, Storage::Parameter &params, Dat
     }
 }
 
+static void read_batched(StorageSession &disk, Storage::Parameter &params, DataSpace &buffer) {
+    size_t count = Math::min<size_t>(buffer.size() / params.sector_size, params.sectors);
+    clear_buffer(buffer);
+    WVPRINT("Reading sectors 0.." << (count - 1) << " with one submit");
+    Storage::tag_type first = tag;
+    for(size_t s = 0; s < count; ++s)
+        WVPASS(disk.queue_read(tag++, s, 1, s * params.sector_size));
+    disk.submit();
+
+    for(size_t s = 0; s < count; ++s) {
+        Storage::Packet *pk = disk.consumer().get();
+        WVPASS(pk->tag >= first && pk->tag < tag);
+        WVPASSEQ(pk->status, 0U);
+        disk.consumer().next();
+    }
+    for(size_t s = 0; s < count; ++s)
+        check_buffer(buffer, s * params.sector_size, params.sector_size);
+}
+
 static void read_invalid_sector(StorageSession &disk, Storage::Parameter &params, DataSpace &buffer) {
     clear_buffer(buffer);
     WVPRINT("Reading invalid sector");
@@ -107,7 +129,7 @@ static void read_invalid_sector(StorageSession &disk, Storage::Parameter &params
 
 static void runtest(DataSpace &buffer, size_t d) {
     try {
-        StorageSession disk("storage", buffer, d);
+        StorageSession disk("storage", buffer, d, prio, weight);
         Storage::Parameter params = disk.get_params();
         Serial::get() << "Connected to disk '" << params.name << "' (";
         Serial::get() << Bytes(params.sectors * params.sector_size) << " in ";
@@ -123,8 +145,10 @@ static void runtest(DataSpace &buffer, size_t d) {
             }
             read_atapi(disk, params, buffer);
         }
-        else
+        else {
             read_write_ata(disk, params, buffer);
+            read_batched(disk, params, buffer);
+        }
 
         WVPRINT("Testing flush cache");
         disk.flush(tag);
@@ -137,7 +161,21 @@ static void runtest(DataSpace &buffer, size_t d) {
 }
 
 int main(int argc, char **argv) {
-    if(argc < 2 || strcmp(argv[1], "no-check") != 0) {
+    bool check = true;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "no-check") == 0)
+            check = false;
+        else if(strcmp(argv[i], "prio=realtime") == 0)
+            prio = Storage::PRIO_REALTIME;
+        else if(strcmp(argv[i], "prio=normal") == 0)
+            prio = Storage::PRIO_NORMAL;
+        else if(strcmp(argv[i], "prio=idle") == 0)
+            prio = Storage::PRIO_IDLE;
+        else if(strncmp(argv[i], "weight=", 7) == 0)
+            weight = IStringStream::read_from<uint>(String(argv[i] + 7));
+    }
+
+    if(check) {
         ConsoleSession cons("console", 1, "DiskTest");
         VGAStream s(cons, 0);
         s.clear(0);
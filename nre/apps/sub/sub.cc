@@ -23,15 +23,18 @@ using namespace nre;
 int main() {
     // don't put it on the stack since its too large :)
     ChildManager *cm = new ChildManager();
+    // the module has to stay mapped as long as the child is running
+    DataSpace *ds = nullptr;
     for(auto mem = Hip::get().mem_begin(); mem != Hip::get().mem_end(); ++mem) {
         if(strstr(mem->cmdline(), "bin/apps/test") != nullptr) {
             ChildConfig cfg(0, "subtest");
-            DataSpace ds(mem->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, mem->addr);
-            cm->load(ds.virt(), mem->size, cfg);
+            ds = new DataSpace(mem->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, mem->addr);
+            cm->load(ds->virt(), mem->size, cfg);
             break;
         }
     }
     while(cm->count() > 0)
         cm->dead_sm().down();
+    delete ds;
     return 0;
 }
@@ -100,6 +100,8 @@ int main() {
     Console::Register regs = cons.get_regs();
     regs.cursor_style = 0x2000;
     cons.set_regs(regs);
+    // we only write via VGAStream, which reports all changes to the console
+    cons.track_dirty();
 
     GlobalThread::create(input_thread, CPU::current().log_id(), "sysinfo-input")->start();
     refresh_thread();
@@ -39,6 +39,10 @@
 #include "tests/Sessions.h"
 #include "tests/ProducerConsumer.h"
 #include "tests/ThreadRefs.h"
+#include "tests/TimeoutListTest.h"
+#include "tests/MallocTest.h"
+#include "tests/SlabTest.h"
+#include "tests/BatchTest.h"
 
 using namespace nre;
 using namespace nre::test;
@@ -46,6 +50,7 @@ using namespace nre::test;
 const TestCase testcases[] = {
     // memcpytest,
     // memsettest,
+    // memmovetest,
      threads,
     // ProtectionDomain, 
     // pingpongxpd,
@@ -76,6 +81,10 @@ const TestCase testcases[] = {
     // sessions,
     // prodcons,
     // threadrefs,
+    // timeoutlist,
+    // malloctest,
+    // slabtest,
+    // batchtest,
 };
 
 int main() {
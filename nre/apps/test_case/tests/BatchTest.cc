@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <ipc/Service.h>
+#include <ipc/PtClientSession.h>
+#include <ipc/Batch.h>
+#include <subsystem/ChildManager.h>
+#include <utcb/UtcbFrame.h>
+#include <util/Profiler.h>
+#include <CPU.h>
+
+#include "BatchTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+class BatchService;
+static void test_batch();
+
+const TestCase batchtest = {
+    "Batch", test_batch
+};
+
+enum Command {
+    ADD,
+    FAIL
+};
+
+static const word_t COUNT = 16;
+static const uint TRIES = 1000;
+static BatchService *srv;
+
+class BatchSession : public ServiceSession {
+public:
+    explicit BatchSession(Service *s, size_t id, portal_func func) : ServiceSession(s, id, func) {
+    }
+    virtual ~BatchSession();
+};
+
+class BatchService : public Service {
+public:
+    explicit BatchService(portal_func func)
+        : Service("batchservice", CPUSet(CPUSet::ALL), func) {
+    }
+
+    virtual ServiceSession *create_session(size_t id, const String &, portal_func func) {
+        return new BatchSession(this, id, func);
+    }
+};
+
+BatchSession::~BatchSession() {
+    srv->stop();
+}
+
+PORTAL static void portal_batch(void*) {
+    UtcbFrameRef uf;
+    try {
+        Command cmd;
+        uf >> cmd;
+        switch(cmd) {
+            case ADD: {
+                word_t a, b;
+                uf >> a >> b;
+                uf.finish_input();
+                uf << E_SUCCESS << (a + b);
+            }
+            break;
+
+            case FAIL:
+                uf.finish_input();
+                throw Exception(E_FAILURE, "Failed on purpose");
+        }
+    }
+    catch(const Exception &e) {
+        uf.clear();
+        uf << e;
+    }
+}
+
+static int batch_server(int, char *[]) {
+    srv = new BatchService(portal_batch);
+    srv->start();
+    delete srv;
+    return 0;
+}
+
+static void test_results(PtClientSession &sess) {
+    Batch b;
+    for(word_t i = 0; i < COUNT; ++i) {
+        if(i == COUNT / 2)
+            b.add() << FAIL;
+        else
+            b.add() << ADD << i << i;
+    }
+    WVPASSEQ(b.count(), static_cast<size_t>(COUNT));
+    b.call(sess.pt());
+
+    bool correct = true;
+    bool failed = false;
+    for(word_t i = 0; i < COUNT; ++i) {
+        try {
+            word_t res;
+            b.next().check_reply();
+            b >> res;
+            correct &= res == i + i;
+        }
+        catch(const Exception &e) {
+            failed = i == COUNT / 2 && e.code() == E_FAILURE;
+        }
+    }
+    WVPASS(correct);
+    WVPASS(failed);
+
+    // there are no more replies
+    bool thrown = false;
+    try {
+        b.next();
+    }
+    catch(const Exception&) {
+        thrown = true;
+    }
+    WVPASS(thrown);
+}
+
+static void test_oversized(PtClientSession &sess) {
+    {
+        Batch b;
+        b.add() << ADD << static_cast<word_t>(1) << static_cast<word_t>(2);
+        // the second command fills the UTCB of the client completely. thus, it can't fit into the
+        // frame of the service, which holds the reply of the first one as well
+        b.add() << ADD;
+        while(b.free_untyped() > 0)
+            b << static_cast<word_t>(0);
+        b.call(sess.pt());
+
+        word_t res;
+        b.next().check_reply();
+        b >> res;
+        WVPASSEQ(res, static_cast<word_t>(3));
+
+        ErrorCode code = E_SUCCESS;
+        try {
+            b.next().check_reply();
+        }
+        catch(const Exception &e) {
+            code = e.code();
+        }
+        WVPASSEQ(code, E_CAPACITY);
+    }
+
+    // the service is still alive
+    Batch b;
+    b.add() << ADD << static_cast<word_t>(4) << static_cast<word_t>(5);
+    b.call(sess.pt());
+    word_t res;
+    b.next().check_reply();
+    b >> res;
+    WVPASSEQ(res, static_cast<word_t>(9));
+}
+
+static void test_perf(PtClientSession &sess) {
+    AvgProfiler single(TRIES), batched(TRIES);
+    word_t sum = 0;
+    for(uint i = 0; i < TRIES; ++i) {
+        single.start();
+        for(word_t j = 0; j < COUNT; ++j) {
+            UtcbFrame uf;
+            uf << ADD << j << j;
+            sess.pt().call(uf);
+            uf.check_reply();
+            word_t res;
+            uf >> res;
+            sum += res;
+        }
+        single.stop();
+
+        batched.start();
+        {
+            Batch b;
+            for(word_t j = 0; j < COUNT; ++j)
+                b.add() << ADD << j << j;
+            b.call(sess.pt());
+            for(word_t j = 0; j < COUNT; ++j) {
+                word_t res;
+                b.next().check_reply();
+                b >> res;
+                sum -= res;
+            }
+        }
+        batched.stop();
+    }
+    WVPASSEQ(sum, static_cast<word_t>(0));
+
+    WVPRINT("Using " << COUNT << " single calls:");
+    WVPERF(single.avg(), "cycles");
+    WVPRINT("min: " << single.min());
+    WVPRINT("max: " << single.max());
+    WVPRINT("Using a batch of " << COUNT << " commands:");
+    WVPERF(batched.avg(), "cycles");
+    WVPRINT("min: " << batched.min());
+    WVPRINT("max: " << batched.max());
+}
+
+static int batch_client(int, char *[]) {
+    PtClientSession sess("batchservice");
+    test_results(sess);
+    test_oversized(sess);
+    test_perf(sess);
+    return 0;
+}
+
+static void test_batch() {
+    ChildManager *mng = new ChildManager();
+    Hip::mem_iterator self = Hip::get().mem_begin();
+    // map the memory of the module
+    DataSpace ds(self->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, self->addr);
+    {
+        ChildConfig cfg(0, "batch-service provides=batchservice");
+        cfg.entry(reinterpret_cast<uintptr_t>(batch_server));
+        mng->load(ds.virt(), self->size, cfg);
+    }
+    {
+        ChildConfig cfg(0, "batch-client");
+        cfg.entry(reinterpret_cast<uintptr_t>(batch_client));
+        mng->load(ds.virt(), self->size, cfg);
+    }
+    while(mng->count() > 0)
+        mng->dead_sm().down();
+    delete mng;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <kobj/GlobalThread.h>
+#include <kobj/Sm.h>
+#include <mem/ThreadCache.h>
+#include <util/Profiler.h>
+#include <CPU.h>
+#include <cstdlib>
+#include <cstring>
+
+#include "MallocTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+static void test_malloc();
+static void test_sizes();
+static void test_remote_free();
+static void test_perf();
+
+const TestCase malloctest = {
+    "Malloc", test_malloc
+};
+
+static void test_malloc() {
+    test_sizes();
+    test_remote_free();
+    test_perf();
+}
+
+static void test_sizes() {
+    // cover all size classes, the boundaries between them and sizes that are not cached
+    static const size_t MAX = ThreadCache::MAX_SIZE + ThreadCache::GRANULE * 2;
+    static char *ptrs[MAX + 1];
+    for(int round = 0; round < 2; ++round) {
+        for(size_t i = 1; i <= MAX; ++i) {
+            ptrs[i] = static_cast<char*>(malloc(i));
+            WVPASS(ptrs[i] != nullptr);
+            memset(ptrs[i], i & 0xFF, i);
+        }
+        // nobody has to overlap with anybody else
+        bool intact = true;
+        for(size_t i = 1; i <= MAX; ++i) {
+            for(size_t j = 0; j < i; ++j) {
+                if(ptrs[i][j] != static_cast<char>(i & 0xFF))
+                    intact = false;
+            }
+            free(ptrs[i]);
+        }
+        WVPASS(intact);
+    }
+}
+
+static const size_t REMOTE_OBJS = 512;
+
+struct RemoteInfo {
+    void **objs;
+    Sm *done;
+};
+
+static void remote_free(void*) {
+    RemoteInfo *info = Thread::current()->get_tls<RemoteInfo*>(Thread::TLS_PARAM);
+    for(size_t i = 0; i < REMOTE_OBJS; ++i)
+        free(info->objs[i]);
+    // allocate a few here and let the main thread free them
+    for(size_t i = 0; i < REMOTE_OBJS; ++i)
+        info->objs[i] = malloc((i % ThreadCache::MAX_SIZE) + 1);
+    info->done->up();
+}
+
+static void test_remote_free() {
+    static void *objs[REMOTE_OBJS];
+    for(size_t i = 0; i < REMOTE_OBJS; ++i)
+        objs[i] = malloc((i % ThreadCache::MAX_SIZE) + 1);
+
+    Sm done(0);
+    RemoteInfo info;
+    info.objs = objs;
+    info.done = &done;
+    Reference<GlobalThread> gt = GlobalThread::create(
+        remote_free, (CPU::current().log_id() + 1) % CPU::count(), "malloc-remote");
+    gt->set_tls<RemoteInfo*>(Thread::TLS_PARAM, &info);
+    gt->start();
+    done.down();
+
+    bool valid = true;
+    for(size_t i = 0; i < REMOTE_OBJS; ++i) {
+        if(!objs[i])
+            valid = false;
+        else
+            memset(objs[i], 0, (i % ThreadCache::MAX_SIZE) + 1);
+    }
+    WVPASS(valid);
+    for(size_t i = 0; i < REMOTE_OBJS; ++i)
+        free(objs[i]);
+}
+
+static const unsigned tries = 1000;
+
+static void test_perf() {
+    static const size_t sizes[] = {16, 64, 200, 1024};
+    for(size_t s = 0; s < ARRAY_SIZE(sizes); ++s) {
+        AvgProfiler prof(tries);
+        for(unsigned i = 0; i < tries; i++) {
+            prof.start();
+            void *p = malloc(sizes[s]);
+            free(p);
+            prof.stop();
+        }
+        WVPRINT("malloc+free of " << sizes[s] << " bytes:");
+        WVPERF(prof.avg(), "cycles");
+        WVPRINT("min: " << prof.min());
+        WVPRINT("max: " << prof.max());
+    }
+}
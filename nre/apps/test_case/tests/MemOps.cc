@@ -26,6 +26,7 @@ typedef void (*memop_func)(void *a, void *b, size_t len);
 
 static void test_memcpy();
 static void test_memset();
+static void test_memmove();
 static void do_test(const char *name, memop_func func);
 
 const TestCase memcpytest = {
@@ -34,9 +35,16 @@ const TestCase memcpytest = {
 const TestCase memsettest = {
     "Memory operations", test_memset
 };
+const TestCase memmovetest = {
+    "Memory operations", test_memmove
+};
 
-static const size_t AREA_SIZE   = 4096;
-static const uint TEST_COUNT    = 1000;
+// the sizes cover the word-wise, SSE2, rep movsb and non-temporal variants
+static const size_t SIZES[]     = {16, 64, 256, 4096, 64 * 1024, 1024 * 1024};
+// the offsets of destination and source
+static const size_t ALIGNS[][2] = {{0, 0}, {1, 1}, {0, 3}, {8, 0}};
+static const size_t AREA_SIZE   = 1024 * 1024 + 16;
+static const uint TEST_COUNT    = 100;
 
 static void memcpy_func(void *a, void *b, size_t len) {
     memcpy(a, const_cast<const void*>(b), len);
@@ -44,42 +52,81 @@ static void memcpy_func(void *a, void *b, size_t len) {
 static void memset_func(void *a, void *, size_t len) {
     memset(a, 0, len);
 }
+static void memmove_func(void *, void *b, size_t len) {
+    // the areas overlap, so that it has to copy backwards
+    memmove(static_cast<char*>(b) + 8, b, len);
+}
 
 static void test_memcpy() {
     do_test("memcpy", memcpy_func);
+
+    // check the result for all variants
+    char *src = static_cast<char*>(malloc(AREA_SIZE));
+    char *dst = static_cast<char*>(malloc(AREA_SIZE));
+    for(size_t i = 0; i < AREA_SIZE; ++i)
+        src[i] = i * 7;
+    for(size_t s = 0; s < ARRAY_SIZE(SIZES); ++s) {
+        for(size_t a = 0; a < ARRAY_SIZE(ALIGNS); ++a) {
+            size_t len = SIZES[s] - ALIGNS[a][0];
+            memset(dst, 0, AREA_SIZE);
+            memcpy(dst + ALIGNS[a][0], src + ALIGNS[a][1], len);
+            WVPASSEQ(memcmp(dst + ALIGNS[a][0], src + ALIGNS[a][1], len), 0);
+            WVPASS(dst[ALIGNS[a][0] + len] == 0);
+        }
+    }
+    free(dst);
+    free(src);
 }
 static void test_memset() {
     do_test("memset", memset_func);
 }
+static void test_memmove() {
+    do_test("memmove", memmove_func);
 
-static void do_test(const char *name, memop_func func) {
-    void *mem = malloc(AREA_SIZE);
-    void *buf = malloc(AREA_SIZE);
-
-    {
-        WVPRINT("Testing aligned " << name << " with " << AREA_SIZE << " bytes");
-        AvgProfiler prof(TEST_COUNT);
-        for(uint i = 0; i < TEST_COUNT; ++i) {
-            prof.start();
-            func(buf, mem, AREA_SIZE);
-            prof.stop();
+    char *mem = static_cast<char*>(malloc(AREA_SIZE));
+    for(size_t s = 0; s < ARRAY_SIZE(SIZES) - 1; ++s) {
+        size_t len = SIZES[s];
+        for(size_t i = 0; i < len + 8; ++i)
+            mem[i] = i;
+        // backwards with overlap (dest > src)
+        memmove(mem + 5, mem, len);
+        bool equal = true;
+        for(size_t i = 0; i < len; ++i) {
+            if(mem[i + 5] != static_cast<char>(i))
+                equal = false;
+        }
+        WVPASS(equal);
+        // and forwards (dest < src)
+        memmove(mem, mem + 5, len);
+        equal = true;
+        for(size_t i = 0; i < len; ++i) {
+            if(mem[i] != static_cast<char>(i))
+                equal = false;
         }
-        WVPERF(prof.avg(), " cycles");
-        WVPRINT("min: " << prof.min());
-        WVPRINT("max: " << prof.max());
+        WVPASS(equal);
     }
+    free(mem);
+}
+
+static void do_test(const char *name, memop_func func) {
+    char *mem = static_cast<char*>(malloc(AREA_SIZE));
+    char *buf = static_cast<char*>(malloc(AREA_SIZE));
 
-    {
-        WVPRINT("Testing unaligned " << name << " with " << AREA_SIZE << " bytes");
-        AvgProfiler prof(TEST_COUNT);
-        for(uint i = 0; i < TEST_COUNT; ++i) {
-            prof.start();
-            func(reinterpret_cast<char*>(buf) + 1, reinterpret_cast<char*>(mem) + 1, AREA_SIZE - 2);
-            prof.stop();
+    for(size_t s = 0; s < ARRAY_SIZE(SIZES); ++s) {
+        for(size_t a = 0; a < ARRAY_SIZE(ALIGNS); ++a) {
+            size_t len = SIZES[s] - ALIGNS[a][0];
+            WVPRINT("Testing " << name << " with " << len << " bytes (dst+" << ALIGNS[a][0]
+                               << ", src+" << ALIGNS[a][1] << ")");
+            AvgProfiler prof(TEST_COUNT);
+            for(uint i = 0; i < TEST_COUNT; ++i) {
+                prof.start();
+                func(buf + ALIGNS[a][0], mem + ALIGNS[a][1], len);
+                prof.stop();
+            }
+            WVPERF(prof.avg(), " cycles");
+            WVPRINT("min: " << prof.min());
+            WVPRINT("max: " << prof.max());
         }
-        WVPERF(prof.avg(), " cycles");
-        WVPRINT("min: " << prof.min());
-        WVPRINT("max: " << prof.max());
     }
 
     free(buf);
@@ -20,3 +20,4 @@
 
 extern const nre::test::TestCase memcpytest;
 extern const nre::test::TestCase memsettest;
+extern const nre::test::TestCase memmovetest;
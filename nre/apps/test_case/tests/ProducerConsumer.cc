@@ -20,6 +20,11 @@
 #include <ipc/Producer.h>
 #include <ipc/PacketConsumer.h>
 #include <ipc/PacketProducer.h>
+#include <ipc/MPConsumer.h>
+#include <ipc/MPProducer.h>
+#include <kobj/GlobalThread.h>
+#include <CPU.h>
+#include <util/Atomic.h>
 
 #include "ProducerConsumer.h"
 
@@ -37,8 +42,12 @@ struct Item {
 static void test_prodcons();
 static void test_prodcons_simple();
 static void test_prodcons_simple_specialcases();
+static void test_prodcons_threaded();
 static void test_prodcons_packet();
 static void test_prodcons_packet_specialcases();
+static void test_prodcons_mp_simple();
+static void test_prodcons_mp_batch();
+static void test_prodcons_mp_concurrent();
 
 const TestCase prodcons = {
     "Producer-Consumer", test_prodcons
@@ -47,8 +56,12 @@ const TestCase prodcons = {
 static void test_prodcons() {
     test_prodcons_simple();
     test_prodcons_simple_specialcases();
+    test_prodcons_threaded();
     test_prodcons_packet();
     test_prodcons_packet_specialcases();
+    test_prodcons_mp_simple();
+    test_prodcons_mp_batch();
+    test_prodcons_mp_concurrent();
 }
 
 static void test_prodcons_simple() {
@@ -94,6 +107,53 @@ static void test_prodcons_simple_specialcases() {
     }
 }
 
+struct ProducerInfo {
+    Producer<Item> *prod;
+    Sm *done;
+};
+
+static const int THREADED_ITEMS = 10000;
+
+static void producer(void*) {
+    ProducerInfo *info = Thread::current()->get_tls<ProducerInfo*>(Thread::TLS_PARAM);
+    for(int i = 0; i < THREADED_ITEMS; ) {
+        if(info->prod->produce(Item(i)))
+            i++;
+    }
+    info->done->up();
+}
+
+static void test_prodcons_threaded() {
+    // with polling (default) and without
+    for(int spin = 1; spin >= 0; --spin) {
+        DataSpace ds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
+        Sm sm(0);
+        Sm done(0);
+        Producer<Item> prod(ds, sm, true);
+        Consumer<Item> cons(ds, sm, false);
+        if(!spin)
+            cons.max_spin(0);
+
+        ProducerInfo info;
+        info.prod = &prod;
+        info.done = &done;
+        Reference<GlobalThread> gt = GlobalThread::create(
+            producer, (CPU::current().log_id() + 1) % CPU::count(), "producer");
+        gt->set_tls<ProducerInfo*>(Thread::TLS_PARAM, &info);
+        gt->start();
+
+        bool inorder = true;
+        for(int i = 0; i < THREADED_ITEMS; ++i) {
+            if(cons.get()->value != i)
+                inorder = false;
+            cons.next();
+        }
+        WVPASS(inorder);
+        done.down();
+        WVPASS(!cons.has_data());
+    }
+}
+
 static void test_prodcons_packet() {
     Item i(0);
     DataSpace ds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
@@ -177,3 +237,124 @@ static void test_prodcons_packet_specialcases() {
         cons.next();
     }
 }
+
+static void test_prodcons_mp_simple() {
+    int i;
+    DataSpace ds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
+    Sm sm(0);
+    MPProducer<Item> prod(ds, sm, true);
+    MPConsumer<Item> cons(ds, sm, false);
+
+    WVPASS(!cons.has_data());
+    i = 0;
+    while(prod.produce(Item(i)))
+        i++;
+    WVPASS(cons.has_data());
+    // all slots are usable
+    WVPASSEQ(i, static_cast<int>(cons.rblength()));
+
+    i = 0;
+    for(; cons.has_data(); cons.next()) {
+        Item *it = cons.get();
+        WVPASSEQ(it->value, i++);
+    }
+    WVPASS(!cons.has_data());
+
+    // wrap around a few times
+    for(i = 0; i < 32; ++i) {
+        WVPASS(prod.produce(Item(i)));
+        WVPASSEQ(cons.get()->value, i);
+        cons.next();
+    }
+    WVPASS(!cons.has_data());
+}
+
+static void test_prodcons_mp_batch() {
+    Item items[] = {Item(0), Item(1), Item(2), Item(3), Item(4), Item(5), Item(6), Item(7)};
+    const size_t count = ARRAY_SIZE(items);
+    DataSpace ds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
+    Sm sm(0);
+    MPProducer<Item> prod(ds, sm, true);
+    MPConsumer<Item> cons(ds, sm, false);
+
+    WVPASSEQ(prod.produce(items, count), count);
+    WVPASSEQ(cons.available(), count);
+    WVPASSEQ(cons.available(3), static_cast<size_t>(3));
+    for(size_t i = 0; i < count; ++i)
+        WVPASSEQ(cons.get(i)->value, static_cast<int>(i));
+    WVPASS(cons.get(count) == nullptr);
+    cons.next(count);
+    WVPASS(!cons.has_data());
+
+    // fill it up to leave less free slots than we want to produce
+    size_t total = 0;
+    while(prod.produce(items, count) == count)
+        total += count;
+    total += cons.rblength() % count;
+    WVPASSEQ(total, cons.rblength());
+    WVPASSEQ(prod.produce(items, count), static_cast<size_t>(0));
+
+    // consume it via the multi-consumer interface
+    Item it(-1);
+    for(size_t i = 0; i < total; ++i) {
+        WVPASS(cons.consume(it));
+        WVPASSEQ(it.value, static_cast<int>(i % count));
+    }
+    WVPASS(!cons.consume(it));
+}
+
+struct MPProducerInfo {
+    MPProducer<Item> *prod;
+    Sm *done;
+    int id;
+};
+
+static const int MP_PRODUCERS   = 4;
+static const int MP_ITEMS       = 10000;
+
+static void mp_producer(void*) {
+    MPProducerInfo *info = Thread::current()->get_tls<MPProducerInfo*>(Thread::TLS_PARAM);
+    for(int i = 0; i < MP_ITEMS; ) {
+        if(info->prod->produce(Item(info->id * MP_ITEMS + i)))
+            i++;
+    }
+    info->done->up();
+}
+
+static void test_prodcons_mp_concurrent() {
+    DataSpace ds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
+    Sm sm(0);
+    Sm done(0);
+    MPProducer<Item> prod(ds, sm, true);
+    MPConsumer<Item> cons(ds, sm, false);
+
+    MPProducerInfo infos[MP_PRODUCERS];
+    Reference<GlobalThread> threads[MP_PRODUCERS];
+    cpu_t cpu = CPU::current().log_id();
+    for(int i = 0; i < MP_PRODUCERS; ++i) {
+        infos[i].prod = &prod;
+        infos[i].done = &done;
+        infos[i].id = i;
+        cpu = (cpu + 1) % CPU::count();
+        threads[i] = GlobalThread::create(mp_producer, cpu, "mp-producer");
+        threads[i]->set_tls<MPProducerInfo*>(Thread::TLS_PARAM, infos + i);
+        threads[i]->start();
+    }
+
+    // the items of each producer have to arrive in order
+    int next[MP_PRODUCERS] = {0};
+    bool inorder = true;
+    for(int i = 0; i < MP_PRODUCERS * MP_ITEMS; ++i) {
+        Item *it = cons.get();
+        int id = it->value / MP_ITEMS;
+        if(id < 0 || id >= MP_PRODUCERS || it->value % MP_ITEMS != next[id]++)
+            inorder = false;
+        cons.next();
+    }
+    WVPASS(inorder);
+    for(int i = 0; i < MP_PRODUCERS; ++i) {
+        done.down();
+        WVPASSEQ(next[i], MP_ITEMS);
+    }
+    WVPASS(!cons.has_data());
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <kobj/GlobalThread.h>
+#include <kobj/Sm.h>
+#include <mem/Slab.h>
+#include <util/Profiler.h>
+#include <CPU.h>
+
+#include "SlabTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+static void test_slab();
+static void test_reuse();
+static void test_subclass();
+static void test_threaded();
+static void test_perf();
+
+const TestCase slabtest = {
+    "Slab", test_slab
+};
+
+class Obj {
+public:
+    explicit Obj(int v) : value(v) {
+    }
+    virtual ~Obj() {
+    }
+
+    static void *operator new(size_t size) {
+        return slab.alloc(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        slab.free(ptr, size);
+    }
+
+    int value;
+    static Slab<Obj> slab;
+};
+
+class BigObj : public Obj {
+public:
+    explicit BigObj(int v) : Obj(v), dummy() {
+    }
+
+    char dummy[64];
+};
+
+Slab<Obj> Obj::slab(16);
+
+static void test_slab() {
+    test_reuse();
+    test_subclass();
+    test_threaded();
+    test_perf();
+}
+
+static void test_reuse() {
+    static const int COUNT = 100;
+    Obj *objs[COUNT];
+    Slab<Obj>::Statistics before = Obj::slab.stats();
+    for(int i = 0; i < COUNT; ++i)
+        objs[i] = new Obj(i);
+    bool intact = true;
+    for(int i = 0; i < COUNT; ++i) {
+        if(objs[i]->value != i)
+            intact = false;
+    }
+    WVPASS(intact);
+    for(int i = 0; i < COUNT; ++i)
+        delete objs[i];
+
+    Slab<Obj>::Statistics after = Obj::slab.stats();
+    WVPASSEQ(after.allocs - before.allocs, static_cast<size_t>(COUNT));
+    WVPASSEQ(after.frees - before.frees, static_cast<size_t>(COUNT));
+    WVPASS(after.objects >= static_cast<size_t>(COUNT));
+
+    // now everything should come from the free objects
+    for(int i = 0; i < COUNT; ++i)
+        objs[i] = new Obj(i);
+    for(int i = 0; i < COUNT; ++i)
+        delete objs[i];
+    WVPASSEQ(Obj::slab.stats().slabs, after.slabs);
+}
+
+static void test_subclass() {
+    // objects of a different size are taken from the heap
+    Slab<Obj>::Statistics before = Obj::slab.stats();
+    Obj *o = new BigObj(42);
+    WVPASSEQ(o->value, 42);
+    delete o;
+    Slab<Obj>::Statistics after = Obj::slab.stats();
+    WVPASSEQ(after.allocs, before.allocs);
+    WVPASSEQ(after.frees, before.frees);
+}
+
+static const int THREAD_OBJS = 1000;
+
+static void slab_thread(void*) {
+    Sm *done = Thread::current()->get_tls<Sm*>(Thread::TLS_PARAM);
+    for(int i = 0; i < THREAD_OBJS; ++i) {
+        Obj *a = new Obj(i);
+        Obj *b = new Obj(i + 1);
+        delete a;
+        delete b;
+    }
+    done->up();
+}
+
+static void test_threaded() {
+    static const size_t THREADS = 4;
+    Slab<Obj>::Statistics before = Obj::slab.stats();
+    Sm done(0);
+    Reference<GlobalThread> threads[THREADS];
+    cpu_t cpu = CPU::current().log_id();
+    for(size_t i = 0; i < THREADS; ++i) {
+        cpu = (cpu + 1) % CPU::count();
+        threads[i] = GlobalThread::create(slab_thread, cpu, "slab");
+        threads[i]->set_tls<Sm*>(Thread::TLS_PARAM, &done);
+        threads[i]->start();
+    }
+    for(size_t i = 0; i < THREADS; ++i)
+        done.down();
+
+    Slab<Obj>::Statistics after = Obj::slab.stats();
+    WVPASSEQ(after.allocs - before.allocs, THREADS * THREAD_OBJS * 2);
+    WVPASSEQ(after.frees - before.frees, THREADS * THREAD_OBJS * 2);
+}
+
+static const unsigned tries = 1000;
+
+static void test_perf() {
+    AvgProfiler prof(tries);
+    for(unsigned i = 0; i < tries; i++) {
+        prof.start();
+        Obj *o = new Obj(i);
+        delete o;
+        prof.stop();
+    }
+    WVPERF(prof.avg(), "cycles");
+    WVPRINT("min: " << prof.min());
+    WVPRINT("max: " << prof.max());
+}
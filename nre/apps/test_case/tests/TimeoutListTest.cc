@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <util/TimeoutList.h>
+
+#include "TimeoutListTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+static void test_timeoutlist();
+static void test_order();
+static void test_cancel();
+static void test_grow();
+
+const TestCase timeoutlist = {
+    "Timeout list", test_timeoutlist
+};
+
+static void test_timeoutlist() {
+    test_order();
+    test_cancel();
+    test_grow();
+}
+
+static void test_order() {
+    static const timevalue_t tos[] = {50, 10, 40, 20, 30, 10};
+    static const size_t count = ARRAY_SIZE(tos);
+    TimeoutList<4, int> list;
+    int data[count];
+    size_t nrs[count];
+    WVPASSEQ(list.timeout(), static_cast<timevalue_t>(~0ULL));
+    WVPASSEQ(list.trigger(1000), static_cast<size_t>(0));
+
+    for(size_t i = 0; i < count; ++i) {
+        data[i] = i;
+        nrs[i] = list.alloc(data + i);
+        WVPASS(nrs[i] != 0);
+        list.request(nrs[i], tos[i]);
+    }
+    WVPASSEQ(list.timeout(), static_cast<timevalue_t>(10));
+    WVPASSEQ(list.trigger(9), static_cast<size_t>(0));
+
+    // they have to come out in ascending order
+    timevalue_t last = 0;
+    size_t n = 0;
+    int *d;
+    for(size_t nr; (nr = list.trigger(1000, &d)); ++n) {
+        WVPASS(tos[*d] >= last);
+        WVPASSEQ(nrs[*d], nr);
+        last = tos[*d];
+        list.cancel(nr);
+    }
+    WVPASSEQ(n, count);
+    WVPASSEQ(list.timeout(), static_cast<timevalue_t>(~0ULL));
+}
+
+static void test_cancel() {
+    TimeoutList<4, int> list;
+    size_t a = list.alloc();
+    size_t b = list.alloc();
+    size_t c = list.alloc();
+
+    WVPASS(!list.cancel(a));
+    // the first one changes the next timeout
+    WVPASS(!list.request(a, 100));
+    WVPASS(list.request(b, 200));
+    WVPASS(!list.request(c, 50));
+    WVPASSEQ(list.timeout(), static_cast<timevalue_t>(50));
+
+    // cancelling the next one reports false
+    WVPASS(list.cancel(b));
+    WVPASS(!list.cancel(c));
+    WVPASSEQ(list.timeout(), static_cast<timevalue_t>(100));
+
+    // re-requesting moves it
+    list.request(a, 300);
+    list.request(b, 250);
+    WVPASSEQ(list.trigger(260), b);
+    list.cancel(b);
+    WVPASSEQ(list.trigger(260), static_cast<size_t>(0));
+
+    // a deallocated object triggers without data until it is cancelled
+    int *d = reinterpret_cast<int*>(1);
+    WVPASS(list.dealloc(a));
+    WVPASS(!list.dealloc(a));
+    WVPASSEQ(list.trigger(300, &d), a);
+    WVPASS(d == nullptr);
+    list.cancel(a);
+    WVPASS(list.dealloc(c, true));
+    WVPASSEQ(list.timeout(), static_cast<timevalue_t>(~0ULL));
+}
+
+static void test_grow() {
+    static const size_t count = 1000;
+    TimeoutList<16, int> list;
+    size_t nrs[count];
+    for(size_t i = 0; i < count; ++i) {
+        nrs[i] = list.alloc();
+        // in reverse order to exercise the heap
+        list.request(nrs[i], count - i);
+    }
+    // cancel every second
+    for(size_t i = 0; i < count; i += 2)
+        list.cancel(nrs[i]);
+
+    bool inorder = true;
+    timevalue_t last = 0;
+    size_t n = 0;
+    for(size_t nr; (nr = list.trigger(~0ULL - 1)); ++n) {
+        timevalue_t to = list.timeout();
+        if(to < last)
+            inorder = false;
+        last = to;
+        list.cancel(nr);
+    }
+    WVPASS(inorder);
+    WVPASSEQ(n, count / 2);
+
+    // slots are reused after dealloc
+    for(size_t i = 0; i < count; ++i)
+        list.dealloc(nrs[i]);
+    for(size_t i = 0; i < count; ++i)
+        WVPASS(list.alloc() < count + 16);
+}
@@ -45,8 +45,9 @@ Child::id_type VMConfig::start(ChildManager &cm, size_t console, cpu_t cpu) {
 
     VMChildConfig cfg(_mods, args, cpu);
     Hip::mem_iterator mod = get_module(first->name());
-    DataSpace ds(mod->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, mod->addr);
-    return cm.load(ds.virt(), mod->size, cfg);
+    if(!_modds)
+        _modds = new DataSpace(mod->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, mod->addr);
+    return cm.load(_modds->virt(), mod->size, cfg);
 }
 
 Hip::mem_iterator VMConfig::get_module(const String &name) {
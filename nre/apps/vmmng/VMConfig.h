@@ -71,10 +71,11 @@ class VMConfig : public nre::SListItem {
 public:
     explicit VMConfig(uintptr_t phys, size_t size, const char *name)
         : nre::SListItem(), _ds(size, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::R, phys),
-          _name(name), _mods() {
+          _modds(), _name(name), _mods() {
         find_mods(size);
     }
     ~VMConfig() {
+        delete _modds;
         for(auto it = _mods.begin(); it != _mods.end(); ) {
             auto old = it++;
             delete &*old;
@@ -95,6 +96,8 @@ private:
     static nre::Hip::mem_iterator get_module(const nre::String &name);
 
     nre::DataSpace _ds;
+    // the first module; it has to stay mapped as long as VMs are running
+    nre::DataSpace *_modds;
     const char *_name;
     nre::SList<Module> _mods;
 };
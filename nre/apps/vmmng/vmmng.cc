@@ -168,6 +168,8 @@ int main() {
         }
     }
 
+    // we only write via VGAStream, which reports all changes to the console
+    cons.track_dirty();
     GlobalThread::create(input_thread, CPU::current().log_id(), "vmmng-input")->start();
     GlobalThread::create(refresh_thread, CPU::current().log_id(), "vmmng-refresh")->start();
     VMMngService::create("vmmanager")->start();
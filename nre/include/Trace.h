@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <arch/Types.h>
+#include <arch/ExecEnv.h>
+#include <kobj/Thread.h>
+#include <stream/OStream.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
+#include <util/Util.h>
+#include <Compiler.h>
+#include <Logging.h>
+#include <TraceFormat.h>
+
+/**
+ * Records the event <ev> with the arguments <a> and <b> into the trace buffer, if tracing is
+ * enabled for the log-level <lvl>. In contrast to LOG, nothing is formatted; a fixed-size record
+ * with the current TSC value is written into the buffer of the current CPU without taking a lock.
+ * The buffer is decoded on the host by tools/tracedump. If tracing is disabled, only a single
+ * load and compare remains.
+ *
+ * Usage example:
+ *  TRACE(TIMER, TIMER_PROGRAM, next, now);
+ */
+#define TRACE(lvl, ev, a, b)                                                        \
+    do {                                                                            \
+        if(EXPECT_FALSE(nre::Trace::levels() & (nre::Logging::lvl)))                \
+            nre::Trace::record(nre::TraceFormat::ev, (a), (b));                     \
+    }                                                                               \
+    while(0);
+
+namespace nre {
+
+/**
+ * A per-process flight recorder for hot paths. Every CPU has its own ring of records that is
+ * overwritten when it is full, so that the buffer always contains the latest events. Tracing is
+ * enabled at runtime for a set of Logging::Level bits, typically by "trace=<levels>" on the
+ * command line of a program. The buffer is written to the serial line by dump(), which happens
+ * automatically on exit and when root kills a child. Additionally, it can be found in a memory
+ * dump of the machine by its magic number.
+ */
+class Trace {
+public:
+    static const size_t DEFAULT_RECORDS     = 1024;
+
+    /**
+     * @return the log-levels for which tracing is enabled
+     */
+    static int levels() {
+        return _levels;
+    }
+
+    /**
+     * Enables tracing for the given log-levels. The buffer is allocated on the first call; later
+     * calls only change the levels.
+     *
+     * @param levels the Logging::Level bits (0 = disable tracing)
+     * @param records the number of records per CPU (rounded up to a power of 2)
+     */
+    static void enable(int levels, size_t records = DEFAULT_RECORDS);
+
+    /**
+     * Records the given event. Use the TRACE macro instead.
+     *
+     * @param ev the event
+     * @param a the first argument
+     * @param b the second argument
+     */
+    static void record(TraceFormat::Event ev, uint64_t a, uint64_t b) {
+        cpu_t cpu = ExecEnv::get_current_thread()->cpu();
+        if(EXPECT_FALSE(!_buf || cpu >= _buf->cpus))
+            return;
+        TraceFormat::CPUHeader *ch = cpu_header(cpu);
+        uint32_t pos = Atomic::add(&ch->wpos, 1);
+        TraceFormat::Record *r = records(ch) + (pos & (_buf->records - 1));
+        // invalidate it first, in case we're interrupted by somebody that overwrites it again
+        r->seq = 0;
+        Sync::memory_barrier();
+        r->tsc = Util::tsc();
+        r->event = ev;
+        r->cpu = cpu;
+        r->args[0] = a;
+        r->args[1] = b;
+        Sync::memory_barrier();
+        r->seq = pos + 1;
+    }
+
+    /**
+     * Writes the buffer hex-encoded to <os>, if tracing has been enabled. The output can be
+     * decoded by tools/tracedump.
+     *
+     * @param os the stream to write to
+     * @param max if non-zero, only the latest <max> records (rounded up to a power of 2) of
+     *  every CPU are written
+     */
+    static void dump(OStream &os, size_t max = 0);
+
+private:
+    static TraceFormat::CPUHeader *cpu_header(cpu_t cpu) {
+        uintptr_t base = reinterpret_cast<uintptr_t>(_buf + 1);
+        return reinterpret_cast<TraceFormat::CPUHeader*>(base + cpu * cpu_size(_buf->records));
+    }
+    static TraceFormat::Record *records(TraceFormat::CPUHeader *ch) {
+        return reinterpret_cast<TraceFormat::Record*>(ch + 1);
+    }
+    static size_t cpu_size(size_t records) {
+        return sizeof(TraceFormat::CPUHeader) + records * sizeof(TraceFormat::Record);
+    }
+
+    Trace();
+
+    static volatile int _levels;
+    static TraceFormat::Header *_buf;
+};
+
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+/**
+ * The layout of the trace buffer. This file is shared with tools/tracedump, which runs on the
+ * host. Thus, it must not depend on anything else of NRE (the includer has to provide the
+ * fixed-width integer types) and has to stay valid C++98.
+ *
+ * The buffer consists of a Header, followed by one CPUHeader and Header::records Records for
+ * every CPU. Each CPU writes its records in a ring; the sequence number of a record tells the
+ * decoder whether it has been written completely.
+ */
+
+/**
+ * The events that can be traced. Every entry is E(id, phase, name, arg0, arg1), whereas phase is
+ * 'B' for the begin of a duration, 'E' for the end of it and 'i' for an instant event (as in the
+ * Chrome trace format). The ids are stored in the buffer, so that new events have to be appended.
+ */
+#define TRACE_EVENTS(E)                                                                 \
+    E(PF_BEGIN,             'B',    "pagefault",        "addr",     "eip")              \
+    E(PF_END,               'E',    "pagefault",        "pages",    "killed")           \
+    E(STORAGE_IRQ_BEGIN,    'B',    "storage-irq",      "gsi",      "ctrl")             \
+    E(STORAGE_IRQ_END,      'E',    "storage-irq",      "gsi",      "ctrl")             \
+    E(STORAGE_DISPATCH,     'i',    "storage-dispatch", "sector",   "bytes")            \
+    E(STORAGE_COMPLETE,     'i',    "storage-complete", "tag",      "status")           \
+    E(TIMER_PROGRAM,        'i',    "timer-program",    "timeout",  "now")              \
+    E(TIMER_IRQ,            'i',    "timer-irq",        "gsi",      "now")
+
+namespace nre {
+
+struct TraceFormat {
+#define TRACE_EVENT_ID(id, phase, name, arg0, arg1) id,
+    enum Event {
+        TRACE_EVENTS(TRACE_EVENT_ID)
+        EVENT_COUNT
+    };
+#undef TRACE_EVENT_ID
+
+    enum {
+        MAGIC       = 0x4254524E,   // "NRTB"
+        VERSION     = 1,
+        NAME_LEN    = 32,
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t record_size;
+        // the number of CPUs and the number of records per CPU (a power of 2)
+        uint32_t cpus;
+        uint32_t records;
+        // in Hz
+        uint64_t tsc_freq;
+        char name[NAME_LEN];
+        uint8_t pad[8];
+    };
+
+    struct CPUHeader {
+        // the number of records that have been written so far
+        uint32_t wpos;
+        uint32_t pad[15];
+    };
+
+    struct Record {
+        uint64_t tsc;
+        // wpos + 1 of this record, if it has been written completely
+        uint32_t seq;
+        uint16_t event;
+        uint16_t cpu;
+        uint64_t args[2];
+    };
+};
+
+}
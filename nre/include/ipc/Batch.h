@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <kobj/Pt.h>
+#include <utcb/UtcbFrame.h>
+#include <Exception.h>
+
+namespace nre {
+
+/**
+ * Sends multiple commands to a session with a single portal call. Every session portal supports
+ * that: ServiceSession recognizes a batch and calls the portal function of the service for each
+ * command, as if it had been sent separately. That is, the commands are executed in order and the
+ * reply of each command is exactly what the service would have replied to a single call.
+ *
+ * Each command is started with add(), which gives you the frame to put the command in. After
+ * call(), the replies are received by next(), one for each command:
+ *  Batch b;
+ *  b.add() << Timer::PROG_TIMER << next_irq;
+ *  b.add() << Storage::READ << ...;
+ *  b.call(sess.pt());
+ *  b.next().check_reply();
+ *  b.next().check_reply();
+ *
+ * Note that neither the commands nor the replies can transfer capabilities, i.e. only untyped
+ * items can be used. Furthermore, all commands have to fit into the UTCB. If a reply doesn't fit
+ * anymore, the service stops after that command, so that next() throws for it and all following
+ * ones.
+ */
+class Batch : public UtcbFrame {
+public:
+    /**
+     * The first word of a batch. It is not a valid command of any service.
+     */
+    static const word_t MAGIC   = 0xBA7C0DE5;
+
+    /**
+     * Creates an empty batch
+     */
+    explicit Batch() : UtcbFrame(), _count(), _start(), _next() {
+        *this << static_cast<word_t>(MAGIC);
+    }
+
+    /**
+     * @return the number of commands in this batch
+     */
+    size_t count() const {
+        return _count;
+    }
+
+    /**
+     * Starts the next command
+     *
+     * @return the frame to put the command in
+     * @throws UtcbException if there is not enough space
+     */
+    UtcbFrameRef &add() {
+        finish_command();
+        _start = untyped();
+        *this << static_cast<word_t>(0);
+        _count++;
+        return *this;
+    }
+
+    /**
+     * Sends all commands to the service via <pt>
+     *
+     * @param pt the portal of the session
+     */
+    void call(Pt &pt) {
+        finish_command();
+        _start = 0;
+        _next = 0;
+        pt.call(*this);
+    }
+
+    /**
+     * Moves to the reply of the next command. It is read as usual, i.e. starting with the
+     * ErrorCode. Items of the previous reply that haven't been read are skipped.
+     *
+     * @return the frame to read the reply from
+     * @throws Exception if there is no reply for this command
+     */
+    UtcbFrameRef &next() {
+        if(_next >= untyped())
+            throw Exception(E_CAPACITY, "The service sent no reply for the command");
+        _upos = _next;
+        word_t words;
+        *this >> words;
+        _next = _upos + words;
+        return *this;
+    }
+
+private:
+    void finish_command() {
+        // the first command starts behind the magic
+        if(_start > 0)
+            untyped_word(_start) = untyped() - _start - 1;
+    }
+
+    size_t _count;
+    size_t _start;
+    size_t _next;
+};
+
+}
@@ -20,6 +20,7 @@
 #include <mem/DataSpace.h>
 #include <util/Sync.h>
 #include <util/Math.h>
+#include <util/Util.h>
 
 namespace nre {
 
@@ -29,6 +30,12 @@ class Producer;
 /**
  * Consumer-part for the producer-consumer-communication over a dataspace.
  *
+ * If the ring is empty, the consumer polls it for a while before it blocks on the semaphore. The
+ * time to poll adapts itself: it is increased whenever polling was successful and decreased
+ * whenever the consumer had to block nevertheless. The producer does only up the semaphore if the
+ * consumer has announced that it blocks. Thus, as long as items arrive frequently enough, no
+ * system calls are necessary on both sides.
+ *
  * Usage-example:
  * Consumer<char> cons(&ds, &sm);
  * for(char *c; (c = cons->get()) != nullptr; cons.next()) {
@@ -43,11 +50,18 @@ protected:
     struct Interface {
         volatile size_t rpos;
         volatile size_t wpos;
+        // whether the consumer blocks (or is about to block) on the semaphore
+        volatile size_t waiting;
         // has more elements, but clang does complain when using a flexible array of non-PODs
         T buffer[1];
     };
 
 public:
+    // the default maximum number of cycles to poll before blocking
+    static const timevalue_t DEFAULT_MAX_SPIN  = 20000;
+    // we never poll shorter than that, so that we can notice that polling pays off again
+    static const timevalue_t MIN_SPIN          = 500;
+
     /**
      * Creates a consumer that uses the given dataspace for communication
      *
@@ -60,10 +74,11 @@ public:
     explicit Consumer(DataSpace &ds, Sm &sm, bool init = false)
         : _ds(ds), _if(reinterpret_cast<Interface*>(ds.virt())),
           _max(Math::prev_pow2((ds.size() - sizeof(Interface)) / sizeof(T))),
-          _sm(sm), _stop(false) {
+          _sm(sm), _stop(false), _spin(MIN_SPIN), _max_spin(DEFAULT_MAX_SPIN) {
         if(init) {
             _if->rpos = 0;
             _if->wpos = 0;
+            _if->waiting = 0;
         }
     }
 
@@ -74,6 +89,16 @@ public:
         return _max;
     }
 
+    /**
+     * Sets the maximum time to poll the ring before blocking on the semaphore.
+     *
+     * @param cycles the number of cycles (0 = always block immediately)
+     */
+    void max_spin(timevalue_t cycles) {
+        _max_spin = cycles;
+        _spin = Math::min(_spin, cycles);
+    }
+
     /**
      * Stops waiting for the producer. This way, if get() is blocked on the semaphore, it will
      * be unblocked.
@@ -106,34 +131,81 @@ public:
      * @return pointer to the data
      */
     T *get() {
-        while(EXPECT_FALSE(_if->rpos == _if->wpos)) {
-            if(EXPECT_FALSE(_stop))
-                return nullptr;
+        if(EXPECT_FALSE(_if->rpos == _if->wpos) && !wait())
+            return nullptr;
+        return _if->buffer + _if->rpos;
+    }
+
+    /**
+     * Tells the producer that you're done working with the current item (i.e. the producer will
+     * never touch the item while you're working with it)
+     */
+    void next() {
+        _if->rpos = (_if->rpos + 1) & (_max - 1);
+    }
+
+protected:
+    /**
+     * Waits until there is data available or it has been stopped
+     *
+     * @return true if there is data
+     */
+    bool wait() {
+        if(poll())
+            return true;
+
+        bool res = true;
+        while(_if->rpos == _if->wpos) {
+            if(EXPECT_FALSE(_stop)) {
+                res = false;
+                break;
+            }
+            // tell the producer that we're going to block and check again afterwards. otherwise
+            // we might miss an item that has been produced before it saw our announcement
+            _if->waiting = 1;
+            Sync::memory_fence();
+            if(_if->rpos != _if->wpos)
+                break;
             // they might fail if someone revokes the Sm-caps
             try {
                 _sm.zero();
             }
             catch(...) {
-                return nullptr;
+                res = false;
+                break;
             }
         }
-        return _if->buffer + _if->rpos;
+        _if->waiting = 0;
+        return res;
     }
 
     /**
-     * Tells the producer that you're done working with the current item (i.e. the producer will
-     * never touch the item while you're working with it)
+     * Polls the ring for at most _spin cycles and adjusts _spin depending on the result
+     *
+     * @return true if there is data
      */
-    void next() {
-        _if->rpos = (_if->rpos + 1) & (_max - 1);
+    bool poll() {
+        timevalue_t start = Util::tsc();
+        for(timevalue_t now = start; now - start < _spin; now = Util::tsc()) {
+            if(_if->rpos != _if->wpos) {
+                _spin = Math::min(_spin * 2, _max_spin);
+                return true;
+            }
+            if(EXPECT_FALSE(_stop))
+                return false;
+            Util::pause();
+        }
+        _spin = Math::min(Math::max<timevalue_t>(_spin / 2, MIN_SPIN), _max_spin);
+        return false;
     }
 
-protected:
     DataSpace &_ds;
     Interface *_if;
     size_t _max;
     Sm &_sm;
     bool _stop;
+    timevalue_t _spin;
+    timevalue_t _max_spin;
 };
 
 }
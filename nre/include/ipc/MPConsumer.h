@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <arch/ExecEnv.h>
+#include <kobj/Sm.h>
+#include <mem/DataSpace.h>
+#include <ipc/Consumer.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
+#include <util/Math.h>
+#include <util/Util.h>
+
+namespace nre {
+
+template<typename T>
+class MPProducer;
+
+/**
+ * Consumer-part for the lock-free producer-consumer-communication over a dataspace with multiple
+ * producers. In contrast to Consumer, any number of MPProducers may write into the ring at the
+ * same time without holding a lock.
+ *
+ * Every slot carries a sequence number that tells whether it is free for the producer of the
+ * current round or filled for the consumer of it. The producers reserve a slot by advancing wpos
+ * with compare-and-swap and publish it by setting the sequence number afterwards. The consumer
+ * releases it by setting the sequence number to the one of the next round. rpos and wpos are on
+ * different cache-lines, so that the consumer and the producers do not steal each others lines.
+ *
+ * The semaphore is only used if the consumer is about to block, i.e. the consumer announces
+ * that it will wait and the first producer that sees it ups the semaphore. Before that, it polls
+ * the ring for a self-tuning amount of time like Consumer does. Thus, as long as the consumer is
+ * busy or items arrive frequently enough, no system calls are done.
+ *
+ * Usage-example:
+ * MPConsumer<char> cons(ds, sm);
+ * for(char *c; (c = cons.get()) != nullptr; cons.next()) {
+ *   // do something with *c
+ * }
+ */
+template<typename T>
+class MPConsumer {
+    friend class MPProducer<T>;
+
+protected:
+    struct Slot {
+        volatile size_t seq;
+        T value;
+    };
+
+    struct Interface {
+        // written by the consumer
+        volatile size_t rpos;
+        volatile size_t sleeping;
+        char pad1[ExecEnv::CACHE_LINE_SIZE - sizeof(size_t) * 2];
+        // written by the producers
+        volatile size_t wpos;
+        char pad2[ExecEnv::CACHE_LINE_SIZE - sizeof(size_t)];
+        // has more elements, but clang does complain when using a flexible array of non-PODs
+        Slot buffer[1];
+    };
+
+    static size_t slots(const DataSpace &ds) {
+        return Math::prev_pow2((ds.size() - sizeof(Interface)) / sizeof(Slot));
+    }
+    static void reset(Interface *iface, size_t max) {
+        iface->rpos = 0;
+        iface->sleeping = 0;
+        iface->wpos = 0;
+        for(size_t i = 0; i < max; ++i)
+            iface->buffer[i].seq = i;
+    }
+
+public:
+    /**
+     * Creates a consumer that uses the given dataspace for communication
+     *
+     * @param ds the dataspace
+     * @param sm the semaphore to use for signaling (has to be shared with the producers of course)
+     * @param init whether the consumer should init the state. this should only be done by one
+     *  party and preferably by the first one. That is, if the client is the consumer it should
+     *  init it (because it will create the dataspace and share it to the service).
+     */
+    explicit MPConsumer(DataSpace &ds, Sm &sm, bool init = false)
+        : _ds(ds), _if(reinterpret_cast<Interface*>(ds.virt())), _max(slots(ds)), _sm(sm),
+          _stop(false), _spin(Consumer<T>::MIN_SPIN), _max_spin(Consumer<T>::DEFAULT_MAX_SPIN) {
+        if(init)
+            reset(_if, _max);
+    }
+
+    /**
+     * @return the length of the ring-buffer
+     */
+    size_t rblength() const {
+        return _max;
+    }
+
+    /**
+     * Sets the maximum time to poll the ring before blocking on the semaphore.
+     *
+     * @param cycles the number of cycles (0 = always block immediately)
+     */
+    void max_spin(timevalue_t cycles) {
+        _max_spin = cycles;
+        _spin = Math::min(_spin, cycles);
+    }
+
+    /**
+     * Stops waiting for the producers. This way, if get() is blocked on the semaphore, it will
+     * be unblocked.
+     */
+    void stop() {
+        _stop = true;
+        Sync::memory_barrier();
+        try {
+            _sm.up();
+        }
+        catch(...) {
+            // ignore it
+        }
+    }
+
+    /**
+     * @return whether there is more data to read
+     */
+    bool has_data() const {
+        return ready(_if->rpos);
+    }
+
+    /**
+     * Determines the number of items that can be read without blocking. Note that a slot that
+     * has been reserved, but not yet written by a producer, ends the sequence.
+     *
+     * @param max the maximum number to report
+     * @return the number of items, starting at the current one, that are available
+     */
+    size_t available(size_t max = ~0UL) const {
+        size_t pos = _if->rpos;
+        size_t n = 0;
+        max = Math::min(max, _max);
+        while(n < max && ready(pos + n))
+            n++;
+        return n;
+    }
+
+    /**
+     * Retrieves the item at current position. If there is no item anymore, it blocks until a
+     * producer notifies it, that there is data available. You might interrupt that by using stop().
+     * Note that the method will only return 0 if it has been stopped *and* there is no data anymore.
+     *
+     * Important: You have to call next() to move to the next item.
+     *
+     * @return pointer to the data
+     */
+    T *get() {
+        size_t pos = _if->rpos;
+        if(EXPECT_FALSE(!ready(pos)) && poll(pos))
+            return &_if->buffer[pos & (_max - 1)].value;
+        while(EXPECT_FALSE(!ready(pos))) {
+            if(EXPECT_FALSE(_stop))
+                return nullptr;
+            // tell the producers that we're going to block and check again afterwards. otherwise
+            // we might miss an item that has been published before they saw our announcement
+            _if->sleeping = 1;
+            Sync::memory_fence();
+            if(ready(pos)) {
+                _if->sleeping = 0;
+                break;
+            }
+            // they might fail if someone revokes the Sm-caps
+            try {
+                _sm.zero();
+            }
+            catch(...) {
+                return nullptr;
+            }
+        }
+        return &_if->buffer[pos & (_max - 1)].value;
+    }
+
+    /**
+     * Retrieves the item <idx> positions after the current one, without blocking. Together with
+     * available() and next(n), this allows to process a batch of items at once.
+     *
+     * @param idx the index relative to the current position
+     * @return pointer to the data or nullptr if it is not available (yet)
+     */
+    T *get(size_t idx) {
+        size_t pos = _if->rpos + idx;
+        if(idx >= _max || !ready(pos))
+            return nullptr;
+        return &_if->buffer[pos & (_max - 1)].value;
+    }
+
+    /**
+     * Tells the producers that you're done working with the current <n> items (i.e. the producers
+     * will never touch these items while you're working with them)
+     *
+     * @param n the number of items to release (all of them have to be available)
+     */
+    void next(size_t n = 1) {
+        size_t pos = _if->rpos;
+        for(size_t i = 0; i < n; ++i)
+            _if->buffer[(pos + i) & (_max - 1)].seq = pos + i + _max;
+        Sync::memory_barrier();
+        _if->rpos = pos + n;
+    }
+
+    /**
+     * Copies the current item to <value> and releases the slot in one step. In contrast to
+     * get() and next(), this may be used by multiple consumers concurrently. But don't mix both
+     * ways of consuming on one ring. Note also that it does never block.
+     *
+     * @param value the value to write to
+     * @return true if there was an item
+     */
+    bool consume(T &value) {
+        size_t pos = _if->rpos;
+        while(1) {
+            Slot *slot = _if->buffer + (pos & (_max - 1));
+            long diff = static_cast<long>(slot->seq - (pos + 1));
+            if(diff == 0) {
+                if(Atomic::cmpnswap(&_if->rpos, pos, pos + 1)) {
+                    value = slot->value;
+                    Sync::memory_barrier();
+                    slot->seq = pos + _max;
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            pos = _if->rpos;
+        }
+    }
+
+private:
+    bool ready(size_t pos) const {
+        return _if->buffer[pos & (_max - 1)].seq == pos + 1;
+    }
+
+    bool poll(size_t pos) {
+        timevalue_t start = Util::tsc();
+        for(timevalue_t now = start; now - start < _spin; now = Util::tsc()) {
+            if(ready(pos)) {
+                _spin = Math::min(_spin * 2, _max_spin);
+                return true;
+            }
+            if(EXPECT_FALSE(_stop))
+                return false;
+            Util::pause();
+        }
+        _spin = Math::min(Math::max<timevalue_t>(_spin / 2, Consumer<T>::MIN_SPIN), _max_spin);
+        return false;
+    }
+
+protected:
+    DataSpace &_ds;
+    Interface *_if;
+    size_t _max;
+    Sm &_sm;
+    bool _stop;
+    timevalue_t _spin;
+    timevalue_t _max_spin;
+};
+
+}
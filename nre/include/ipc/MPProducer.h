@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <mem/DataSpace.h>
+#include <ipc/MPConsumer.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
+#include <util/Math.h>
+
+namespace nre {
+
+/**
+ * Producer-part for the lock-free producer-consumer-communication over a dataspace with multiple
+ * producers (see MPConsumer). All methods may be called concurrently by multiple threads, also
+ * on different MPProducer objects for the same dataspace.
+ */
+template<typename T>
+class MPProducer {
+    typedef typename MPConsumer<T>::Interface Interface;
+    typedef typename MPConsumer<T>::Slot Slot;
+
+    // the dataspace is shared with the consumer, which might not behave. thus, we don't try to
+    // reserve slots forever, but treat the ring as full after that many attempts
+    static const size_t MAX_TRIES   = 1024;
+
+public:
+    /**
+     * Creates a producer that uses the given dataspace for communication
+     *
+     * @param ds the dataspace
+     * @param sm the semaphore to use for signaling (has to be shared with the consumer of course)
+     * @param init whether the producer should init the state. this should only be done by one
+     *  party and preferably by the first one. That is, if the client is the producer it should
+     *  init it (because it will create the dataspace and share it to the service).
+     */
+    explicit MPProducer(DataSpace &ds, Sm &sm, bool init = true)
+        : _ds(ds), _if(reinterpret_cast<Interface*>(ds.virt())),
+          _max(MPConsumer<T>::slots(ds)), _sm(sm) {
+        if(init)
+            MPConsumer<T>::reset(_if, _max);
+    }
+
+    /**
+     * @return the length of the ring-buffer
+     */
+    size_t rblength() const {
+        return _max;
+    }
+
+    /**
+     * Notifies the consumer that new data is available. This does only up the semaphore if the
+     * consumer waits for it. It is only necessary if you've produced items without notifying.
+     */
+    void notify() {
+        // the publication of the items has to be visible before we look at the flag
+        Sync::memory_fence();
+        if(_if->sleeping &&
+           Atomic::cmpnswap(&_if->sleeping, static_cast<size_t>(1), static_cast<size_t>(0))) {
+            try {
+                _sm.up();
+            }
+            catch(...) {
+                // if the client closed the session, we might get here. so, just ignore it.
+            }
+        }
+    }
+
+    /**
+     * Produces the given item, if there is a free slot.
+     *
+     * @param value the value to produce
+     * @param notify whether to notify the consumer. If you produce multiple items in a row, you
+     *  can pass false and call notify() once afterwards.
+     * @return true if the item has been written successfully
+     */
+    bool produce(const T &value, bool notify = true) {
+        return produce(&value, 1, notify) == 1;
+    }
+
+    /**
+     * Produces up to <count> items from <values> at once. That is, the slots are reserved with a
+     * single atomic operation and the consumer is notified at most once.
+     *
+     * @param values the values to produce
+     * @param count the number of values
+     * @param notify whether to notify the consumer
+     * @return the number of items that have been written (less than <count> if the ring is full
+     *  or the slots could not be reserved after MAX_TRIES attempts)
+     */
+    size_t produce(const T *values, size_t count, bool notify = true) {
+        if(EXPECT_FALSE(count == 0))
+            return 0;
+
+        size_t pos, n;
+        for(size_t tries = 0; ; ++tries) {
+            if(EXPECT_FALSE(tries == MAX_TRIES))
+                return 0;
+            pos = _if->wpos;
+            long diff = static_cast<long>(seq(pos) - pos);
+            // if the slot is still used by the consumer, the ring is full
+            if(diff < 0)
+                return 0;
+            // if somebody else has reserved it in the meantime, try again
+            if(diff > 0)
+                continue;
+            // the slots can only change from used to free while we're looking at them, because
+            // nobody else can reserve them without changing wpos
+            for(n = 1; n < count && n < _max && seq(pos + n) == pos + n; ++n)
+                ;
+            if(Atomic::cmpnswap(&_if->wpos, pos, pos + n))
+                break;
+        }
+
+        for(size_t i = 0; i < n; ++i) {
+            Slot *slot = _if->buffer + ((pos + i) & (_max - 1));
+            slot->value = values[i];
+            Sync::memory_barrier();
+            slot->seq = pos + i + 1;
+        }
+        if(notify)
+            this->notify();
+        return n;
+    }
+
+private:
+    size_t seq(size_t pos) const {
+        return _if->buffer[pos & (_max - 1)].seq;
+    }
+
+protected:
+    DataSpace &_ds;
+    Interface *_if;
+    size_t _max;
+    Sm &_sm;
+};
+
+}
@@ -83,13 +83,7 @@ public:
         else
             _if->wpos = ofs + needed;
         Sync::memory_barrier();
-        // notify consumer
-        try {
-            _sm.up();
-        }
-        catch(...) {
-            // if the client closed the session, we might get here. so, just ignore it.
-        }
+        notify();
         return true;
     }
 };
@@ -45,6 +45,7 @@ public:
         if(init) {
             _if->rpos = 0;
             _if->wpos = 0;
+            _if->waiting = 0;
         }
     }
 
@@ -70,10 +71,27 @@ public:
     /**
      * Moves to the next slot. That is, the position is moved forward and the consumer is notified,
      * that new data is available
+     *
+     * @param notify whether to notify the consumer. If you produce multiple items in a row, you
+     *  can pass false and call notify() once afterwards to save semaphore-ups.
      */
-    void next() {
+    void next(bool notify = true) {
         _if->wpos = (_if->wpos + 1) & (_max - 1);
         Sync::memory_barrier();
+        if(notify)
+            this->notify();
+    }
+
+    /**
+     * Notifies the consumer that new data is available. This is only necessary if you've moved
+     * forward without notifying it. The semaphore is only used if the consumer is blocked; if it
+     * polls the ring, it will notice the new data anyway.
+     */
+    void notify() {
+        // the new wpos has to be visible before we look at the flag
+        Sync::memory_fence();
+        if(!_if->waiting)
+            return;
         try {
             _sm.up();
         }
@@ -87,13 +105,14 @@ public:
      * the given item into it and moves to the next.
      *
      * @param value the value to produce
+     * @param notify whether to notify the consumer (see next())
      * @return true if the item has been written successfully
      */
-    bool produce(const T &value) {
+    bool produce(const T &value, bool notify = true) {
         T *slot = current();
         if(slot) {
             *slot = value;
-            next();
+            next(notify);
         }
         return slot != 0;
     }
@@ -41,7 +41,7 @@ public:
      *
      * @param s the service-instance
      * @param id the id of this session
-     * @param func the portal function
+     * @param func the portal function. It is called for each command of a Batch as well
      *  Otherwise, portals are created
      */
     explicit ServiceSession(Service *s, size_t id, portal_func func);
@@ -75,6 +75,11 @@ protected:
     }
 
 private:
+    PORTAL static void portal(void *obj);
+    static void run_batch(ServiceSession *sess);
+    static size_t run_command(ServiceSession *sess, const word_t *words, size_t len,
+                              word_t *reply, size_t max);
+
     void destroy() {
         invalidate();
         for(uint i = 0; i < CPU::count(); ++i)
@@ -83,6 +88,7 @@ private:
 
     size_t _id;
     capsel_t _caps;
+    portal_func _func;
     Pt **_pts;
 };
 
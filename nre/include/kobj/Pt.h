@@ -19,6 +19,7 @@
 #include <arch/ExecEnv.h>
 #include <kobj/ObjCap.h>
 #include <kobj/LocalThread.h>
+#include <mem/Slab.h>
 #include <utcb/UtcbFrame.h>
 #include <util/ScopedCapSels.h>
 #include <Syscalls.h>
@@ -96,10 +97,19 @@ public:
         Syscalls::pt_ctrl(sel(), id);
     }
 
+    static void *operator new(size_t size) {
+        return _slab.alloc(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        _slab.free(ptr, size);
+    }
+
 private:
     void create(const Reference<LocalThread> &ec, capsel_t pt, uintptr_t func, Mtd mtd) {
         Syscalls::create_pt(pt, ec->sel(), func, mtd, Pd::current()->sel());
     }
+
+    static Slab<Pt> _slab;
 };
 
 }
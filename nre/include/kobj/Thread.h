@@ -28,6 +28,7 @@ namespace nre {
 
 class Pd;
 class Utcb;
+class ThreadCache;
 
 /**
  * Represents a thread, i.e. an Ec that has a stack and a Utcb. It is the base class for the two
@@ -40,6 +41,7 @@ class Utcb;
 class Thread : public Ec, public SListItem, public RefCounted {
     friend class RCU;
     friend class RCULock;
+    friend class ThreadCache;
 
     static const size_t TLS_SIZE    = 4;
 
@@ -154,6 +156,7 @@ private:
     uintptr_t _stack_addr;
     uint _flags;
     void *_tls[TLS_SIZE];
+    ThreadCache *_cache;
     static size_t _tls_idx;
 };
 
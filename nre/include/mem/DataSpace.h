@@ -19,6 +19,7 @@
 #include <arch/Types.h>
 #include <kobj/ObjCap.h>
 #include <mem/DataSpaceDesc.h>
+#include <mem/Slab.h>
 #include <Exception.h>
 #include <Desc.h>
 
@@ -172,6 +173,14 @@ public:
      */
     void switch_to(DataSpace &dest);
 
+    // dataspace objects are created and destroyed frequently, e.g. for every session
+    static void *operator new(size_t size) {
+        return _slab.alloc(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        _slab.free(ptr, size);
+    }
+
 private:
     void create();
     void join();
@@ -184,6 +193,7 @@ private:
     DataSpaceDesc _desc;
     capsel_t _sel;
     capsel_t _unmapsel;
+    static Slab<DataSpace> _slab;
 };
 
 OStream &operator<<(OStream &os, const DataSpace &ds);
@@ -133,9 +133,10 @@ public:
      *
      * @param desc the descriptor. Is updated from the found dataspace
      * @param sel the selector
+     * @return true if the dataspace has been destroyed
      * @throws DataSpaceException if the dataspace was not found
      */
-    void release(DataSpaceDesc &desc, capsel_t sel) {
+    bool release(DataSpaceDesc &desc, capsel_t sel) {
         ScopedLock<UserSm> guard(&_sm);
         Slot *s = find_unmap(sel);
         if(!s)
@@ -147,7 +148,9 @@ public:
             s->ds = nullptr;
             s->next = _free;
             _free = s;
+            return true;
         }
+        return false;
     }
 
 private:
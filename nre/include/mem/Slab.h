@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <arch/ExecEnv.h>
+#include <kobj/Thread.h>
+#include <kobj/UserSm.h>
+#include <util/Atomic.h>
+#include <util/Math.h>
+#include <util/ScopedLock.h>
+#include <util/Sync.h>
+#include <Compiler.h>
+#include <Exception.h>
+#include <Hip.h>
+#include <cstdlib>
+
+namespace nre {
+
+/**
+ * A typed object pool. Objects of type T are carved out of larger slabs and are never given back
+ * to the heap, but kept in a free list (the depot) for reuse. In front of the depot, every CPU
+ * has a small magazine of free objects, so that allocating and freeing usually neither takes a
+ * lock nor walks a list. The magazine is taken by a try-lock; if another thread on the same CPU
+ * holds it, the depot is used directly.
+ *
+ * A class adopts it by a static Slab member and the operators:
+ *  static void *operator new(size_t size) {
+ *      return _slab.alloc(size);
+ *  }
+ *  static void operator delete(void *ptr, size_t size) {
+ *      _slab.free(ptr, size);
+ *  }
+ * Since the size is passed on, subclasses with a different size are simply forwarded to the heap.
+ * Note that the static member should be constructed with INIT_PRIO_SLAB, if objects of T are
+ * created during the initialization of the runtime.
+ */
+template<class T, size_t MAG_SIZE = 8>
+class Slab {
+    union Object {
+        Object *next;
+        uint64_t align;
+        char data[sizeof(T)];
+    };
+
+    struct Magazine {
+        volatile int lock;
+        size_t count;
+        size_t allocs;
+        size_t frees;
+        Object *objs[MAG_SIZE];
+    } ALIGNED(64);
+
+public:
+    /**
+     * The statistics of a slab
+     */
+    struct Statistics {
+        // the number of slabs that have been allocated from the heap
+        size_t slabs;
+        // the total number of objects in these slabs
+        size_t objects;
+        // the number of allocated and freed objects
+        size_t allocs;
+        size_t frees;
+    };
+
+    /**
+     * Creates an empty slab
+     *
+     * @param objs_per_slab the number of objects that are allocated from the heap at once
+     */
+    explicit Slab(size_t objs_per_slab = Math::max<size_t>(ExecEnv::PAGE_SIZE / sizeof(Object), 8))
+        : _sm(), _free(), _allocs(), _frees(), _slabs(), _objects(),
+          _objs_per_slab(objs_per_slab), _mags() {
+    }
+
+    /**
+     * Allocates an object
+     *
+     * @param size the size of the object (objects that are not of size sizeof(T) are allocated
+     *  from the heap)
+     * @return the object
+     * @throws Exception if there is not enough memory
+     */
+    void *alloc(size_t size) {
+        if(size != sizeof(T))
+            return ::operator new(size);
+
+        Object *obj = nullptr;
+        Magazine *m = magazine();
+        if(m && Atomic::cmpnswap(&m->lock, 0, 1)) {
+            if(EXPECT_FALSE(m->count == 0))
+                refill(m);
+            if(m->count > 0) {
+                obj = m->objs[--m->count];
+                m->allocs++;
+            }
+            unlock(m);
+        }
+        else
+            obj = take();
+        if(EXPECT_FALSE(!obj))
+            throw Exception(E_CAPACITY, "Unable to allocate slab");
+        return obj;
+    }
+
+    /**
+     * Frees the given object
+     *
+     * @param ptr the object
+     * @param size the size of the object
+     */
+    void free(void *ptr, size_t size) {
+        if(!ptr)
+            return;
+        if(size != sizeof(T)) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        Object *obj = static_cast<Object*>(ptr);
+        Magazine *m = magazine();
+        if(m && Atomic::cmpnswap(&m->lock, 0, 1)) {
+            if(EXPECT_FALSE(m->count == MAG_SIZE))
+                flush(m);
+            m->objs[m->count++] = obj;
+            m->frees++;
+            unlock(m);
+        }
+        else
+            put(obj);
+    }
+
+    /**
+     * @return the current statistics (the counters of the CPUs are read without locking)
+     */
+    Statistics stats() const {
+        Statistics s;
+        s.slabs = _slabs;
+        s.objects = _objects;
+        s.allocs = _allocs;
+        s.frees = _frees;
+        for(size_t i = 0; i < Hip::MAX_CPUS; ++i) {
+            s.allocs += _mags[i].allocs;
+            s.frees += _mags[i].frees;
+        }
+        return s;
+    }
+
+private:
+    Magazine *magazine() {
+        Thread *t = ExecEnv::get_current_thread();
+        return t ? _mags + t->cpu() : nullptr;
+    }
+    static void unlock(Magazine *m) {
+        Sync::memory_barrier();
+        m->lock = 0;
+    }
+
+    void refill(Magazine *m) {
+        ScopedLock<UserSm> guard(&_sm);
+        if(!_free)
+            grow();
+        while(_free && m->count < MAG_SIZE / 2) {
+            m->objs[m->count++] = _free;
+            _free = _free->next;
+        }
+    }
+    void flush(Magazine *m) {
+        ScopedLock<UserSm> guard(&_sm);
+        while(m->count > MAG_SIZE / 2) {
+            Object *obj = m->objs[--m->count];
+            obj->next = _free;
+            _free = obj;
+        }
+    }
+    Object *take() {
+        ScopedLock<UserSm> guard(&_sm);
+        if(!_free)
+            grow();
+        Object *obj = _free;
+        if(obj) {
+            _free = obj->next;
+            _allocs++;
+        }
+        return obj;
+    }
+    void put(Object *obj) {
+        ScopedLock<UserSm> guard(&_sm);
+        obj->next = _free;
+        _free = obj;
+        _frees++;
+    }
+    void grow() {
+        size_t count = _objs_per_slab;
+        Object *objs = static_cast<Object*>(malloc(count * sizeof(Object)));
+        // early during startup, there might only be room for a single object
+        if(!objs) {
+            count = 1;
+            objs = static_cast<Object*>(malloc(sizeof(Object)));
+            if(!objs)
+                return;
+        }
+        for(size_t i = 0; i < count; ++i) {
+            objs[i].next = _free;
+            _free = objs + i;
+        }
+        _objects += count;
+        _slabs++;
+    }
+
+    Slab(const Slab&);
+    Slab& operator=(const Slab&);
+
+    UserSm _sm;
+    Object *_free;
+    size_t _allocs;
+    size_t _frees;
+    size_t _slabs;
+    size_t _objects;
+    size_t _objs_per_slab;
+    Magazine _mags[Hip::MAX_CPUS];
+};
+
+}
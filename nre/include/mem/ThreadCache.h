@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <arch/Types.h>
+
+namespace nre {
+
+class Thread;
+
+/**
+ * A per-thread cache of small objects in front of dlmalloc, which has a single lock for all
+ * threads. The cached objects are ordinary dlmalloc chunks, sorted into size classes. Thus, an
+ * object can be freed by any thread: it simply ends up in the cache of the thread that frees it,
+ * or, if that is full, goes back to dlmalloc. Empty classes are refilled and full classes are
+ * drained in batches, so that the lock is taken only once for multiple objects.
+ *
+ * The cache is used by malloc() and free() automatically. It is created on the first use in a
+ * thread and released when the Thread is destroyed.
+ */
+class ThreadCache {
+public:
+    // the size classes are multiples of GRANULE up to MAX_SIZE
+    static const size_t GRANULE     = 16;
+    static const size_t MAX_SIZE    = 256;
+    static const size_t CLASSES     = MAX_SIZE / GRANULE;
+    // the maximum number of bytes that are cached per class
+    static const size_t BIN_BYTES   = 2048;
+    static const size_t MAX_BATCH   = 32;
+
+    /**
+     * Allocates <size> bytes from the cache of the current thread
+     *
+     * @param size the number of bytes
+     * @return the object or nullptr if the size is not cached or no memory is available
+     */
+    static void *alloc(size_t size);
+
+    /**
+     * Puts <p> into the cache of the current thread
+     *
+     * @param p the object, allocated by dlmalloc
+     * @return true if it has been cached; false if it should be given back to dlmalloc
+     */
+    static bool free(void *p);
+
+    /**
+     * Gives all objects in the cache of <t> back to dlmalloc and destroys the cache
+     *
+     * @param t the thread
+     */
+    static void destroy(Thread *t);
+
+private:
+    struct Object {
+        Object *next;
+    };
+    struct Bin {
+        Object *head;
+        size_t count;
+    };
+
+    static size_t class_size(size_t cls) {
+        return (cls + 1) * GRANULE;
+    }
+    static size_t limit(size_t cls) {
+        return BIN_BYTES / class_size(cls);
+    }
+
+    static ThreadCache *get();
+    void *refill(size_t cls);
+    void drain(size_t cls, size_t count);
+
+    ThreadCache();
+
+    Bin _bins[CLASSES];
+};
+
+}
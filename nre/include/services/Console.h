@@ -21,6 +21,8 @@
 #include <ipc/Consumer.h>
 #include <mem/DataSpace.h>
 #include <util/ScopedPtr.h>
+#include <util/Atomic.h>
+#include <util/Math.h>
 
 namespace nre {
 
@@ -111,6 +113,38 @@ public:
         size_t offset;
     };
 
+    /**
+     * Tells the console which parts of the out-dataspace have been changed by the client since
+     * the last refresh. Every bit stands for CHUNK_SIZE bytes. It lives in its own dataspace,
+     * because the out-dataspace is switched to the framebuffer as soon as the session gets the
+     * screen. The console only trusts it if <tracking> is set by the client; otherwise, it
+     * refreshes the whole screen while the session is in the background.
+     */
+    struct DirtyMap {
+        static const size_t CHUNK_SHIFT     = 9;
+        static const size_t CHUNK_SIZE      = 1 << CHUNK_SHIFT;
+        static const size_t WORD_BITS       = sizeof(word_t) * 8;
+
+        /**
+         * @param size the size of the out-dataspace
+         * @return the size of the dataspace for the dirty-map
+         */
+        static size_t size_for(size_t size) {
+            size_t words = (size + CHUNK_SIZE * WORD_BITS - 1) / (CHUNK_SIZE * WORD_BITS);
+            return Math::round_up(sizeof(DirtyMap) + words * sizeof(word_t), ExecEnv::PAGE_SIZE);
+        }
+        /**
+         * @param size the size of the dataspace of the dirty-map
+         * @return the number of words in <bits>
+         */
+        static size_t words_in(size_t size) {
+            return size > sizeof(DirtyMap) ? (size - sizeof(DirtyMap)) / sizeof(word_t) : 0;
+        }
+
+        volatile word_t tracking;
+        volatile word_t bits[];
+    };
+
     /**
      * A packet that we receive from the console
      */
@@ -143,30 +177,76 @@ public:
                             size_t mode = 0, size_t size = ExecEnv::PAGE_SIZE * 32)
         : ClientSession(service, build_args(console, mode, title)),
           _in_ds(IN_DS_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW),
-          _out_ds(new DataSpace(size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW)), _sm(0),
-          _consumer(_in_ds, _sm, true) {
+          _out_ds(new DataSpace(size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW)),
+          _dirty_ds(new DataSpace(Console::DirtyMap::size_for(size), DataSpaceDesc::ANONYMOUS,
+                                  DataSpaceDesc::RW)),
+          _tracking(false), _sm(0), _consumer(_in_ds, _sm, true) {
         create();
     }
     virtual ~ConsoleSession() {
+        delete _dirty_ds;
         delete _out_ds;
     }
 
     /**
      * Sets the mode with index <mode> and allocates and delegates a new dataspace with <size>
-     * bytes to the console service.
+     * bytes (and a new dirty-map for it) to the console service.
      *
      * @param mode the mode
      * @param size the size of the dataspace to use a buffer
      */
     void set_mode(size_t mode, size_t size) {
         ScopedPtr<DataSpace> out_ds(new DataSpace(size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW));
+        ScopedPtr<DataSpace> dirty_ds(new DataSpace(Console::DirtyMap::size_for(size),
+                                                    DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW));
+        dirty_map(*dirty_ds.get())->tracking = _tracking;
         UtcbFrame uf;
         uf << Console::SET_MODE << mode;
         uf.delegate(out_ds->sel());
+        uf.delegate(dirty_ds->sel());
         Pt(caps() + CPU::current().log_id()).call(uf);
         uf.check_reply();
+        delete _dirty_ds;
         delete _out_ds;
         _out_ds = out_ds.release();
+        _dirty_ds = dirty_ds.release();
+    }
+
+    /**
+     * Enables or disables the tracking of changes. If enabled, the console copies only the parts
+     * of the screen memory to the screen that have been reported by mark_dirty() while the
+     * session is in the background, instead of copying all of it periodically. Thus, every
+     * change has to be reported afterwards. VGAStream does that automatically.
+     *
+     * @param enable whether to enable it
+     */
+    void track_dirty(bool enable = true) {
+        _tracking = enable;
+        dirty_map(*_dirty_ds)->tracking = enable;
+    }
+
+    /**
+     * Reports that the given range of the screen memory has been changed. This is only
+     * necessary if track_dirty() has been called and has to be done after the change.
+     *
+     * @param offset the offset in the screen memory
+     * @param len the number of bytes
+     */
+    void mark_dirty(size_t offset, size_t len) {
+        typedef Console::DirtyMap map_type;
+        // the console ignores the map anyway, so save the locked instructions
+        if(!_tracking || len == 0 || offset >= _out_ds->size())
+            return;
+        map_type *map = dirty_map(*_dirty_ds);
+        size_t max = map_type::words_in(_dirty_ds->size()) * map_type::WORD_BITS;
+        size_t first = offset >> map_type::CHUNK_SHIFT;
+        size_t last = Math::min((offset + len - 1) >> map_type::CHUNK_SHIFT, max - 1);
+        for(size_t i = first; i <= last; ++i) {
+            volatile word_t *word = map->bits + i / map_type::WORD_BITS;
+            // the console clears the bits concurrently. the locked instruction makes also sure
+            // that it sees the change, once it sees the bit
+            Atomic::bit_or(word, static_cast<word_t>(1) << (i % map_type::WORD_BITS));
+        }
     }
 
     /**
@@ -250,10 +330,15 @@ private:
         uf.delegate(_in_ds.sel(), 0);
         uf.delegate(_out_ds->sel(), 1);
         uf.delegate(_sm.sel(), 2);
+        uf.delegate(_dirty_ds->sel(), 3);
         Pt(caps() + CPU::current().log_id()).call(uf);
         uf.check_reply();
     }
 
+    static Console::DirtyMap *dirty_map(const DataSpace &ds) {
+        return reinterpret_cast<Console::DirtyMap*>(ds.virt());
+    }
+
     static String build_args(size_t console, size_t mode, const String &title) {
         OStringStream os;
         os << console << " " << mode << " " << title;
@@ -262,6 +347,8 @@ private:
 
     DataSpace _in_ds;
     DataSpace *_out_ds;
+    DataSpace *_dirty_ds;
+    bool _tracking;
     Sm _sm;
     Consumer<Console::ReceivePacket> _consumer;
 };
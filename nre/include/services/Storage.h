@@ -18,7 +18,8 @@
 
 #include <arch/Types.h>
 #include <ipc/PtClientSession.h>
-#include <ipc/Consumer.h>
+#include <ipc/MPConsumer.h>
+#include <ipc/Producer.h>
 #include <utcb/UtcbFrame.h>
 #include <util/DMA.h>
 #include <Exception.h>
@@ -36,6 +37,7 @@ public:
 
     static const size_t MAX_CONTROLLER      = 8;
     static const size_t MAX_DRIVES          = 32;   // per controller
+    // the maximum number of descriptors for read() and write(), which are passed via UTCB
     static const size_t MAX_DMA_DESCS       = 64;
 
     typedef DMADescList<MAX_DMA_DESCS> dma_type;
@@ -50,13 +52,25 @@ public:
         FLUSH,
     };
 
+    /**
+     * The I/O priority classes. Requests of a higher class are always preferred, unless a request
+     * of a lower class has exceeded its deadline. Sessions in the same class share the drive
+     * according to their weight.
+     */
+    enum Priority {
+        PRIO_REALTIME,
+        PRIO_NORMAL,
+        PRIO_IDLE,
+    };
+
     /**
      * Describes a drive
      */
     struct Parameter {
         enum Type {
-            FLAG_HARDDISK   = 1,
-            FLAG_ATAPI      = 2
+            FLAG_HARDDISK       = 1,
+            FLAG_ATAPI          = 2,
+            FLAG_NONROTATIONAL  = 4,
         };
         uint flags;
         sector_type sectors;
@@ -65,6 +79,23 @@ public:
         char name[64];
     };
 
+    /**
+     * A request in the submission ring. Describes a contiguous transfer between the sectors
+     * <sector>, ..., <sector> + <count> - 1 and the data dataspace at <offset> (in bytes).
+     */
+    struct Request {
+        Command cmd;
+        tag_type tag;
+        sector_type sector;
+        sector_type count;
+        size_t offset;
+
+        explicit Request(Command cmd, tag_type tag, sector_type sector = 0, sector_type count = 0,
+                         size_t offset = 0)
+            : cmd(cmd), tag(tag), sector(sector), count(count), offset(offset) {
+        }
+    };
+
     /**
      * Completion message
      */
@@ -94,18 +125,23 @@ public:
      * @param service the service name
      * @param ds the dataspace to use for data exchange
      * @param drive the drive
+     * @param prio the priority class of the requests of this session
+     * @param weight the share of the drive relative to other sessions in the same class
      */
-    explicit StorageSession(const String &service, DataSpace &ds, size_t drive)
-        : PtClientSession(service, build_args(drive)),
+    explicit StorageSession(const String &service, DataSpace &ds, size_t drive,
+                            Storage::Priority prio = Storage::PRIO_NORMAL, uint weight = 1)
+        : PtClientSession(service, build_args(drive, prio, weight)),
           _ctrlds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _sm(0),
-          _cons(_ctrlds, _sm, true) {
+          _cons(_ctrlds, _sm, true),
+          _subds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _subsm(0),
+          _prod(_subds, _subsm, true) {
         init(ds);
     }
 
     /**
      * @return the consumer to get notified about finished commands
      */
-    Consumer<Storage::Packet> &consumer() {
+    MPConsumer<Storage::Packet> &consumer() {
         return _cons;
     }
 
@@ -189,27 +225,83 @@ public:
         uf.check_reply();
     }
 
+    /**
+     * Puts a read of the sectors <sector>, ..., <sector> + <count> - 1 into the dataspace at given
+     * offset into the submission ring. The request is not seen by the service until you call
+     * submit(). Thus, you can queue multiple requests and hand them over with a single submit().
+     * Errors are reported via the status of the completion message.
+     * Since the request refers to the dataspace that has been registered during the session
+     * initialization by an offset only, it is neither limited to MAX_DMA_DESCS nor to a certain
+     * number of sectors. The driver splits it into multiple commands, if necessary.
+     *
+     * @param tag the tag to identify the command on completion
+     * @param sector the start sector
+     * @param count the number of sectors
+     * @param offset the offset in the dataspace where to put the data (in bytes)
+     * @return true if the request has been queued, false if the ring is full
+     */
+    bool queue_read(tag_type tag, sector_type sector, sector_type count = 1, size_t offset = 0) {
+        return _prod.produce(Storage::Request(Storage::READ, tag, sector, count, offset), false);
+    }
+
+    /**
+     * Puts a write of the content in the dataspace at offset <offset> to the sectors
+     * <sector>, ..., <sector> + <count> - 1 into the submission ring (see queue_read()).
+     *
+     * @param tag the tag to identify the command on completion
+     * @param sector the start sector
+     * @param count the number of sectors
+     * @param offset the offset in the dataspace from where to read the data (in bytes)
+     * @return true if the request has been queued, false if the ring is full
+     */
+    bool queue_write(tag_type tag, sector_type sector, sector_type count = 1, size_t offset = 0) {
+        return _prod.produce(Storage::Request(Storage::WRITE, tag, sector, count, offset), false);
+    }
+
+    /**
+     * Puts a flush of the disk buffer into the submission ring (see queue_read()). It is executed
+     * after all previously queued requests have been started.
+     *
+     * @param tag the tag to identify the command on completion
+     * @return true if the request has been queued, false if the ring is full
+     */
+    bool queue_flush(tag_type tag) {
+        return _prod.produce(Storage::Request(Storage::FLUSH, tag), false);
+    }
+
+    /**
+     * Hands all queued requests over to the service.
+     */
+    void submit() {
+        _prod.notify();
+    }
+
 private:
     void init(DataSpace &ds) {
         UtcbFrame uf;
         uf.delegate(_ctrlds.sel(), 0);
         uf.delegate(ds.sel(), 1);
         uf.delegate(_sm.sel(), 2);
+        uf.delegate(_subds.sel(), 3);
+        uf.delegate(_subsm.sel(), 4);
         uf << Storage::INIT;
         pt().call(uf);
         uf.check_reply();
         uf >> _params;
     }
 
-    static String build_args(size_t drive) {
+    static String build_args(size_t drive, Storage::Priority prio, uint weight) {
         OStringStream os;
-        os << drive;
+        os << drive << " " << prio << " " << weight;
         return os.str();
     }
 
     DataSpace _ctrlds;
     Sm _sm;
-    Consumer<Storage::Packet> _cons;
+    MPConsumer<Storage::Packet> _cons;
+    DataSpace _subds;
+    Sm _subsm;
+    Producer<Storage::Request> _prod;
     Storage::Parameter _params;
 };
 
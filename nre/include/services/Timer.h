@@ -18,7 +18,10 @@
 
 #include <arch/Types.h>
 #include <ipc/PtClientSession.h>
+#include <mem/DataSpace.h>
 #include <utcb/UtcbFrame.h>
+#include <util/Sync.h>
+#include <util/Util.h>
 #include <CPU.h>
 
 namespace nre {
@@ -29,6 +32,8 @@ namespace nre {
 class Timer {
 public:
     static const uint WALLCLOCK_FREQ    = 1000000;
+    // the number of attempts to read the clock page before asking the service
+    static const uint CLOCK_TRIES       = 16;
 
     /**
      * The available commands
@@ -36,9 +41,41 @@ public:
     enum Command {
         GET_SMS,
         PROG_TIMER,
-        GET_TIME
+        GET_TIME,
+        GET_CLOCK
     };
 
+    /**
+     * The page that is shared by the timer service with a session to let it determine the
+     * current time from the TSC without calling the service. Every session has its own page, so
+     * that clients can't disturb each other. The service re-anchors it to the timer counter, when
+     * the client asks for the time via GET_TIME, which it does if the anchor is older than
+     * <max_age>. The fields are protected by a sequence lock: <seq> is odd while an update is in
+     * progress.
+     */
+    struct ClockInfo {
+        volatile uint32_t seq;
+        // TSC ticks are converted to WALLCLOCK_FREQ by (ticks * mult) >> shift
+        uint32_t shift;
+        uint64_t mult;
+        // the TSC value at which the times below have been taken
+        uint64_t tsc_base;
+        uint64_t uptime_base;
+        uint64_t unix_base;
+        // the number of TSC ticks after tsc_base until which the anchor may be used
+        uint64_t max_age;
+    };
+
+    /**
+     * Converts the TSC difference <ticks> to WALLCLOCK_FREQ by means of <mult> and <shift> (<= 32).
+     * Only multiplications and shifts are used, so that it is cheap on 32-bit as well.
+     */
+    static timevalue_t scale(timevalue_t ticks, uint64_t mult, uint shift) {
+        timevalue_t hi = (ticks >> 32) * mult;
+        timevalue_t lo = ((ticks & 0xFFFFFFFF) * mult) >> shift;
+        return (hi << (32 - shift)) + lo;
+    }
+
 private:
     Timer();
 };
@@ -53,8 +90,9 @@ public:
      *
      * @param service the service name
      */
-    explicit TimerSession(const String &service) : PtClientSession(service) {
+    explicit TimerSession(const String &service) : PtClientSession(service), _clock() {
         get_sms();
+        get_clock();
     }
     /**
      * Destroys this session
@@ -63,6 +101,7 @@ public:
         for(cpu_t cpu = 0; cpu < CPU::count(); ++cpu)
             delete _sms[cpu];
         delete[] _sms;
+        delete _clock;
         CapSelSpace::get().free(_caps, 1 << CPU::order());
     }
 
@@ -109,12 +148,33 @@ public:
     }
 
     /**
-     * Determines the current time
+     * Determines the current time. This does usually not call the service, but computes it from
+     * the TSC and the clock page that is shared with the service. Only if the page is too old or
+     * can't be read consistently, the service is asked, which updates the page as well.
      *
      * @param uptime the time since systemstart in microseconds (Timer::WALLCLOCK_FREQ)
      * @param unixts the current unix timestamp in microseconds (Timer::WALLCLOCK_FREQ)
      */
     void get_time(timevalue_t &uptime, timevalue_t &unixts) {
+        const Timer::ClockInfo *ci = reinterpret_cast<const Timer::ClockInfo*>(_clock->virt());
+        for(uint i = 0; i < Timer::CLOCK_TRIES; ++i) {
+            uint32_t seq = ci->seq;
+            Sync::memory_barrier();
+            timevalue_t now = Util::tsc();
+            // the TSCs of the CPUs might differ slightly; never go back behind the anchor
+            timevalue_t delta = now > ci->tsc_base ? now - ci->tsc_base : 0;
+            bool fresh = delta <= ci->max_age;
+            delta = Timer::scale(delta, ci->mult, ci->shift);
+            uptime = ci->uptime_base + delta;
+            unixts = ci->unix_base + delta;
+            Sync::memory_barrier();
+            if(!(seq & 1) && ci->seq == seq) {
+                if(fresh)
+                    return;
+                break;
+            }
+        }
+
         UtcbFrame uf;
         uf << Timer::GET_TIME;
         pt().call(uf);
@@ -135,9 +195,19 @@ private:
         for(auto it = CPU::begin(); it != CPU::end(); ++it)
             _sms[it->log_id()] = new Sm(_caps + it->log_id(), true);
     }
+    void get_clock() {
+        UtcbFrame uf;
+        ScopedCapSels cap;
+        uf.delegation_window(Crd(cap.get(), 0, Crd::OBJ_ALL));
+        uf << Timer::GET_CLOCK;
+        pt().call(uf);
+        uf.check_reply();
+        _clock = new DataSpace(cap.release());
+    }
 
     capsel_t _caps;
     Sm **_sms;
+    DataSpace *_clock;
 };
 
 }
@@ -57,6 +57,7 @@ public:
         assert(page < TEXT_PAGES);
         uintptr_t addr = _sess.screen().virt() + TEXT_OFF + page * PAGE_SIZE;
         memset(reinterpret_cast<void*>(addr), 0, PAGE_SIZE);
+        _sess.mark_dirty(TEXT_OFF + page * PAGE_SIZE, PAGE_SIZE);
     }
 
     /**
@@ -133,6 +134,7 @@ public:
 
     /**
      * Writes the given character+colorcode to the given position and updates <pos> accordingly.
+     * The change is reported to the console via ConsoleSession::mark_dirty().
      *
      * @param value the character+color to write
      * @param base the base address of the console-page
@@ -179,6 +179,19 @@ public:
         return _hip;
     }
 
+    /**
+     * @return the number of pagefaults the child has caused so far
+     */
+    size_t faults() const {
+        return _faults;
+    }
+    /**
+     * @return the number of pages that have been mapped to the child due to pagefaults
+     */
+    size_t fault_pages() const {
+        return _fault_pages;
+    }
+
     /**
      * @return the virtual memory regions
      */
@@ -243,7 +256,7 @@ private:
         : SListTreapNode<size_t>(id), RefCounted(), _cm(cm), _id(id), _cmdline(cmdline), _started(),
           _pd(), _ec(), _pts(), _ptcount(), _regs(), _io(PortManager::USED), _scs(), _gsis(),
           _sessions(), _joins(),  _gsi_caps(CapSelSpace::get().allocate(Hip::MAX_GSIS)),
-          _gsi_next(), _entry(), _main(), _stack(), _utcb(), _hip(), _sm() {
+          _gsi_next(), _entry(), _main(), _stack(), _utcb(), _hip(), _faults(), _fault_pages(), _sm() {
     }
 public:
     virtual ~Child();
@@ -294,6 +307,8 @@ private:
     uintptr_t _stack;
     uintptr_t _utcb;
     uintptr_t _hip;
+    volatile size_t _faults;
+    volatile size_t _fault_pages;
     UserSm _sm;
 };
 
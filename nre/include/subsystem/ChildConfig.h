@@ -47,7 +47,7 @@ public:
      */
     explicit ChildConfig(size_t no, const String &cmdline, cpu_t cpu = CPU::current().log_id())
         : _no(no), _last(false), _modaccess(OWN), _cpu(cpu), _cpus(), _entry(0), _waitcount(),
-          _waits(), _cmdline() {
+          _waits(), _depsgiven(false), _depcount(), _deps(), _cmdline() {
         parse(cmdline);
     }
     virtual ~ChildConfig() {
@@ -80,6 +80,27 @@ public:
         return _waits[i];
     }
 
+    /**
+     * @return whether the dependencies have been specified via "requires=...". If not, the child
+     *  is expected to depend on all services of the childs that have been loaded before.
+     */
+    bool deps_given() const {
+        return _depsgiven;
+    }
+    /**
+     * @return the number of services this child depends on
+     */
+    size_t deps() const {
+        return _depcount;
+    }
+    /**
+     * @param i the dependency index
+     * @return the service name this child depends on
+     */
+    const String &dep(size_t i) const {
+        return _deps[i];
+    }
+
     /**
      * @return the commandline
      */
@@ -149,6 +170,12 @@ private:
                     _last = true;
                 else if(strncmp(start, "provides=", 9) == 0 && _waitcount < MAX_WAITS)
                     _waits[_waitcount++] = String(start + 9, len - 9);
+                else if(strncmp(start, "requires=", 9) == 0) {
+                    // "requires=" without name means that there are no dependencies
+                    _depsgiven = true;
+                    if(len > 9 && _depcount < MAX_WAITS)
+                        _deps[_depcount++] = String(start + 9, len - 9);
+                }
                 else {
                     if(pos + len + 1 >= sizeof(buffer))
                         len = sizeof(buffer) - (pos + 2);
@@ -170,6 +197,9 @@ private:
     uintptr_t _entry;
     size_t _waitcount;
     String _waits[MAX_WAITS];
+    bool _depsgiven;
+    size_t _depcount;
+    String _deps[MAX_WAITS];
     String _cmdline;
 };
 
@@ -17,11 +17,16 @@
 #pragma once
 
 #include <kobj/Pt.h>
+#include <kobj/Sm.h>
 #include <collection/SListTreap.h>
+#include <collection/SList.h>
+#include <collection/Treap.h>
 #include <subsystem/ServiceRegistry.h>
 #include <subsystem/Child.h>
 #include <subsystem/ChildConfig.h>
 #include <mem/DataSpaceManager.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
 #include <Exception.h>
 
 namespace nre {
@@ -124,6 +129,98 @@ class ChildManager {
         ChildManager *_cm;
     };
 
+    /**
+     * A read-only segment of an ELF file, that is shared between all childs that are loaded from
+     * the same ELF file. It exists as long as one of them uses it.
+     */
+    struct SharedSegment : public SListItem {
+        explicit SharedSegment(uintptr_t src, size_t filesz, size_t size, const DataSpace &ds)
+            : SListItem(), src(src), filesz(filesz), size(size), sel(ds.sel()),
+              unmapsel(ds.unmapsel()) {
+        }
+
+        uintptr_t src;
+        size_t filesz;
+        size_t size;
+        capsel_t sel;
+        capsel_t unmapsel;
+    };
+
+    /**
+     * A child that uses a dataspace
+     */
+    struct DSUser : public SListItem {
+        explicit DSUser(Child::id_type child) : SListItem(), child(child), count(1) {
+        }
+
+        Child::id_type child;
+        // the number of times the child has mapped the dataspace
+        size_t count;
+    };
+
+    /**
+     * The childs that use a dataspace. This is a reverse index for switch_to(), so that it
+     * doesn't need to walk over all childs to find the mappings that have to be changed.
+     */
+    struct DSUsers : public TreapNode<capsel_t> {
+        explicit DSUsers(capsel_t unmapsel) : TreapNode<capsel_t>(unmapsel), users() {
+        }
+
+        SList<DSUser> users;
+    };
+
+    /**
+     * Allows pagefaults to be handled in parallel, but excludes them during a switch of
+     * dataspaces. The pagefault handlers use enter() and leave(), which only touch a counter.
+     * switch_to() uses down() and up() (i.e. ScopedLock), which blocks until the running pagefaults
+     * are finished and lets new ones wait until the switch is done.
+     */
+    class SwitchLock {
+    public:
+        explicit SwitchLock() : _faults(), _switching(), _sm(), _drained(0) {
+        }
+
+        void enter() {
+            while(1) {
+                Atomic::add(&_faults, 1);
+                Sync::memory_fence();
+                if(EXPECT_TRUE(!_switching))
+                    return;
+                // a switch is in progress; wait until it is finished
+                leave();
+                ScopedLock<UserSm> guard(&_sm);
+            }
+        }
+        void leave() {
+            // the last pagefault wakes up the switch, if there is one
+            if(Atomic::add(&_faults, -1) == 1 && _switching)
+                _drained.up();
+        }
+
+        void down() {
+            _sm.down();
+            _switching = true;
+            Sync::memory_fence();
+            // zero() instead of down() to get rid of ups that came after we've checked _faults
+            // last time. if they are from the previous switch, we simply check again
+            while(_faults > 0)
+                _drained.zero();
+        }
+        void up() {
+            _switching = false;
+            _sm.up();
+        }
+
+    private:
+        SwitchLock(const SwitchLock&);
+        SwitchLock& operator=(const SwitchLock&);
+
+        volatile ulong _faults;
+        volatile bool _switching;
+        UserSm _sm;
+        Sm _drained;
+    };
+
     /**
      * The different exit types
      */
@@ -141,6 +238,8 @@ public:
      */
     static const size_t MAX_CMDLINE_LEN     = 256;
     static const size_t MAX_MODAUX_LEN      = ExecEnv::PAGE_SIZE;
+    // the number of trace records per CPU that are dumped if a child is killed
+    static const size_t KILL_TRACE_RECORDS  = 16;
 
     /**
      * Creates a new child manager. It will already create all Ecs that are required
@@ -154,18 +253,22 @@ public:
     /**
      * Loads a child task. That is, it treats <addr>...<addr>+<size> as an ELF file, creates a new
      * Pd, adds the correspondings segments to that Pd, creates a main thread and finally starts
-     * the main thread. Afterwards, if the command line contains "provides=..." it waits until
-     * the service with given name is registered.
+     * the main thread. Afterwards, if the command line contains "provides=..." and <wait> is true,
+     * it waits until the service with given name is registered.
+     * Note that the segments are not copied here. Read-only segments are mapped directly from the
+     * ELF file and all others are filled on demand. Thus, <addr>...<addr>+<size> has to stay
+     * accessible as long as the child exists.
      *
      * @param addr the address of the ELF file
      * @param size the size of the ELF file
      * @param config the config to use. this allows you to specify the access to the modules, the
      *  presented CPUs and other things
+     * @param wait whether to wait until the services of the child are registered
      * @return the id of the created child
      * @throws ELFException if the ELF is invalid
      * @throws Exception if something else failed
      */
-    Child::id_type load(uintptr_t addr, size_t size, const ChildConfig &config);
+    Child::id_type load(uintptr_t addr, size_t size, const ChildConfig &config, bool wait = true);
 
     /**
      * @return the number of childs
@@ -179,6 +282,12 @@ public:
     Sm &dead_sm() {
         return _diesm;
     }
+    /**
+     * @return a semaphore that is up'ed as soon as a service has been registered
+     */
+    Sm &reg_sm() {
+        return _regsm;
+    }
 
     /**
      * The up-/down-implementation to allow ScopedLock<ChildManager>. This is required if you want
@@ -233,6 +342,23 @@ public:
     const ServiceRegistry &registry() const {
         return _registry;
     }
+    /**
+     * Blocks until the service with given name is registered. In contrast to reg_sm(), only the
+     * registration of this service wakes us up.
+     *
+     * @param name the service name
+     */
+    void wait_for_service(const String &name) {
+        ServiceRegistry::Waiter waiter(name);
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            if(_registry.find(name))
+                return;
+            _registry.add_waiter(&waiter);
+        }
+        waiter.sm().down();
+    }
+
     /**
      * Registers the given service. This is used to let the task that hosts the childmanager
      * register services as well (by default, only its child tasks do so).
@@ -293,6 +419,12 @@ private:
     static void prepare_stack(Child *c, uintptr_t &sp, uintptr_t csp);
     void build_hip(Child *c, const ChildConfig &config);
 
+    const DataSpace &shared_segment(uintptr_t src, size_t filesz, size_t size);
+    void release_segment(capsel_t unmapsel);
+    void add_user(capsel_t unmapsel, Child *c);
+    void remove_user(capsel_t unmapsel, Child *c);
+    size_t get_users(capsel_t unmapsel, Child::id_type *ids, size_t max);
+
     void map(UtcbFrameRef &uf, Child *c, DataSpace::RequestType type);
     void switch_to(UtcbFrameRef &uf, Child *c);
     void unmap(UtcbFrameRef &uf, Child *c);
@@ -305,9 +437,12 @@ private:
     SListTreap<Child> _childs;
     ChildDeleter _deleter;
     DataSpaceManager<DataSpace> _dsm;
+    SList<SharedSegment> _segments;
+    Treap<DSUsers> _dsusers;
+    UserSm _dsusersm;
     ServiceRegistry _registry;
     mutable UserSm _sm;
-    UserSm _switchsm;
+    SwitchLock _switchlck;
     mutable UserSm _slotsm;
     Sm _regsm;
     Sm _diesm;
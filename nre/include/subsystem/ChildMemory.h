@@ -24,7 +24,9 @@
 #include <stream/OStringStream.h>
 #include <bits/MaskField.h>
 #include <util/Math.h>
+#include <cstring>
 #include <Exception.h>
+#include <Assert.h>
 
 namespace nre {
 
@@ -38,7 +40,9 @@ public:
 class OStream;
 
 /**
- * Manages the virtual memory of a child process
+ * Manages the virtual memory of a child process. All accesses have to be synchronized by the user.
+ * Besides the list, the dataspaces are kept in an array sorted by address, so that find_by_addr()
+ * does not need to walk the list.
  */
 class ChildMemory {
 public:
@@ -58,12 +62,21 @@ public:
      */
     class DS : public SListItem {
     public:
+        // the bounds of the number of pages that are mapped at once for a pagefault
+        static const size_t MIN_WINDOW      = 8;
+        static const size_t DEF_WINDOW      = 32;
+        static const size_t MAX_WINDOW      = 1024;
+
         /**
          * Creates the dataspace with given descriptor and cap
          */
         explicit DS(const DataSpaceDesc &desc, capsel_t cap)
             : SListItem(), _desc(desc), _cap(cap),
-              _perms(Math::blockcount<size_t>(desc.size(), ExecEnv::PAGE_SIZE) * 4) {
+              _perms(Math::blockcount<size_t>(desc.size(), ExecEnv::PAGE_SIZE) * 4),
+              _next(desc.virt()), _window(DEF_WINDOW), _src(), _srcsize(), _loaded() {
+        }
+        ~DS() {
+            delete _loaded;
         }
 
         /**
@@ -125,6 +138,72 @@ public:
             }
             return pages;
         }
+        /**
+         * Lets the content of this dataspace be loaded lazily from <src>. That is, on the first
+         * access of a page, the corresponding part of <src> is copied into it and the remainder
+         * is zeroed. <src> has to stay accessible as long as this dataspace exists.
+         *
+         * @param src the address of the content in our address space
+         * @param size the number of bytes available at <src>
+         */
+        void load_from(uintptr_t src, size_t size) {
+            size_t pages = Math::blockcount<size_t>(_desc.size(), ExecEnv::PAGE_SIZE);
+            _loaded = new MaskField<1>(pages);
+            _src = src;
+            _srcsize = size;
+        }
+        /**
+         * Loads the content of all pages in the given range, that have not been loaded yet (see
+         * load_from).
+         *
+         * @param addr the page-aligned virtual address where to start
+         * @param pages the number of pages
+         */
+        void load(uintptr_t addr, size_t pages) {
+            if(!_loaded)
+                return;
+            uintptr_t off = addr - _desc.virt();
+            for(size_t i = 0; i < pages; ++i, off += ExecEnv::PAGE_SIZE) {
+                size_t page = off / ExecEnv::PAGE_SIZE;
+                if(_loaded->get(page))
+                    continue;
+
+                size_t amount = off < _srcsize ? Math::min(_srcsize - off, ExecEnv::PAGE_SIZE) : 0;
+                char *dst = reinterpret_cast<char*>(_desc.origin() + off);
+                memcpy(dst, reinterpret_cast<void*>(_src + off), amount);
+                memset(dst + amount, 0, ExecEnv::PAGE_SIZE - amount);
+                _loaded->set(page, 1);
+            }
+        }
+
+        /**
+         * Determines the number of pages to map for a pagefault at <addr> (fault-around). If the
+         * pagefault is within the window behind the pages that have been mapped last, the access
+         * is considered sequential and the window is doubled. Otherwise, it is halved.
+         *
+         * @param addr the page-aligned virtual address (is expected to be in this dataspace)
+         * @return the number of pages to map, starting at <addr>
+         */
+        size_t fault_window(uintptr_t addr) {
+            size_t window = _window;
+            uintptr_t next = _next;
+            if(addr >= next && addr < next + window * ExecEnv::PAGE_SIZE)
+                window = Math::min(window * 2, MAX_WINDOW);
+            else
+                window = Math::max(window / 2, MIN_WINDOW);
+            _window = window;
+            return window;
+        }
+        /**
+         * Tells the fault-around policy that <pages> pages, starting at <addr>, have been mapped.
+         *
+         * @param addr the virtual address
+         * @param pages the number of pages
+         */
+        void faulted(uintptr_t addr, size_t pages) {
+            _next = addr + pages * ExecEnv::PAGE_SIZE;
+        }
+
         /**
          * Sets the permissions of all pages to <perms>
          *
@@ -159,14 +238,22 @@ public:
         DataSpaceDesc _desc;
         capsel_t _cap;
         MaskField<4> _perms;
+        // the end of the last mapped range and the current fault-around window
+        uintptr_t _next;
+        size_t _window;
+        // the content to load lazily and whether each page has been loaded already
+        uintptr_t _src;
+        size_t _srcsize;
+        MaskField<1> *_loaded;
     };
 
+
     typedef SList<DS>::const_iterator iterator;
 
     /**
      * Constructor
      */
-    explicit ChildMemory() : _list(isless) {
+    explicit ChildMemory() : _list(isless), _index(), _capacity() {
     }
     /**
      * Destructor
@@ -176,6 +263,7 @@ public:
             iterator cur = it++;
             delete &*cur;
         }
+        delete[] _index;
     }
 
     /**
@@ -217,16 +305,19 @@ public:
         return get(sel);
     }
     /**
-     * Finds the dataspace with given address
+     * Finds the dataspace with given address in O(log n)
      *
      * @param addr the virtual address
      * @return the dataspace or nullptr if not found
      */
     DS *find_by_addr(uintptr_t addr) {
-        for(auto it = _list.begin(); it != _list.end(); ++it) {
-            if(addr >= it->desc().virt() && addr < it->desc().virt() + it->desc().size())
-                return &*it;
-        }
+        // the dataspace has to be the last one that starts at or below addr
+        size_t pos = index_of(addr + 1);
+        if(pos == 0)
+            return nullptr;
+        DS *ds = _index[pos - 1];
+        if(addr < ds->desc().virt() + ds->desc().size())
+            return ds;
         return nullptr;
     }
 
@@ -261,11 +352,25 @@ public:
      * @param addr the virtual address where to map it to in the child
      * @param flags the flags to use (desc.flags() is ignored)
      * @param sel the selector for the dataspace
+     * @return the added dataspace
      */
-    void add(const DataSpaceDesc& desc, uintptr_t addr, uint flags, capsel_t sel = ObjCap::INVALID) {
+    DS *add(const DataSpaceDesc& desc, uintptr_t addr, uint flags, capsel_t sel = ObjCap::INVALID) {
         DS *ds = new DS(DataSpaceDesc(desc.size(), desc.type(), flags, desc.phys(), addr,
                                       desc.virt()), sel);
+        // make room in the index first, so that we don't have to undo anything if that fails
+        if(_list.length() == _capacity) {
+            size_t capacity = _capacity ? _capacity * 2 : INIT_CAPACITY;
+            DS **index = new DS*[capacity];
+            memcpy(index, _index, _list.length() * sizeof(DS*));
+            delete[] _index;
+            _index = index;
+            _capacity = capacity;
+        }
+        size_t pos = index_of(addr);
+        memmove(_index + pos + 1, _index + pos, (_list.length() - pos) * sizeof(DS*));
+        _index[pos] = ds;
         _list.insert(ds);
+        return ds;
     }
 
     /**
@@ -292,6 +397,9 @@ public:
     }
 
 private:
+    // the initial number of dataspaces the index has room for
+    static const size_t INIT_CAPACITY   = 16;
+
     DS *get(capsel_t sel) {
         for(auto it = _list.begin(); it != _list.end(); ++it) {
             if(it->cap() == sel)
@@ -303,6 +411,9 @@ private:
         DataSpaceDesc desc;
         if(!ds)
             throw ChildMemoryException(E_NOT_FOUND, "Dataspace not found");
+        size_t pos = index_of(ds->desc().virt());
+        assert(_index[pos] == ds);
+        memmove(_index + pos, _index + pos + 1, (_list.length() - pos - 1) * sizeof(DS*));
         _list.remove(ds);
         if(sel)
             *sel = ds->cap();
@@ -311,11 +422,28 @@ private:
         return desc;
     }
 
+    /**
+     * @return the position of the first dataspace in the index that starts at or above <addr>
+     */
+    size_t index_of(uintptr_t addr) const {
+        size_t lo = 0, hi = _list.length();
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if(_index[mid]->desc().virt() < addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
     static bool isless(const DS &a, const DS &b) {
         return a.desc().virt() < b.desc().virt();
     }
 
     SortedSList<DS> _list;
+    DS **_index;
+    size_t _capacity;
 };
 
 OStream &operator<<(OStream &os, const ChildMemory &cm);
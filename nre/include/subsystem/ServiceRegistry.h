@@ -37,9 +37,12 @@ class Child;
 
 /**
  * Keeps track of registered services, i.e. stores the child that registered it, the name, on
- * which CPUs its available and the portal capabilities.
+ * which CPUs its available and the portal capabilities. The services are found by name via a
+ * hashtable. Additionally, one can wait for the registration of a specific service.
  */
 class ServiceRegistry {
+    static const size_t BUCKETS     = 32;
+
 public:
     /**
      * A service in the registry
@@ -59,7 +62,7 @@ public:
         explicit Service(Child *child, const String &name, capsel_t pts, size_t count,
                          const BitField<Hip::MAX_CPUS> &available)
             : SListItem(), _child(child), _name(name), _pts(pts), _count(count), _sm(0),
-              _available(available) {
+              _available(available), _hnext() {
         }
         /**
          * The destructor revokes the caps and frees the selectors
@@ -111,6 +114,35 @@ public:
         size_t _count;
         Sm _sm;
         BitField<Hip::MAX_CPUS> _available;
+        // the next service in the same bucket
+        Service *_hnext;
+    };
+
+    /**
+     * Somebody that waits until a service is registered
+     */
+    class Waiter : public SListItem {
+        friend class ServiceRegistry;
+
+    public:
+        /**
+         * Creates a waiter for the service with given name
+         *
+         * @param name the service name
+         */
+        explicit Waiter(const String &name) : SListItem(), _name(name), _sm(0) {
+        }
+
+        /**
+         * @return the semaphore that is up'ed as soon as the service is registered
+         */
+        Sm &sm() {
+            return _sm;
+        }
+
+    private:
+        String _name;
+        Sm _sm;
     };
 
     typedef SList<Service>::iterator iterator;
@@ -119,7 +151,7 @@ public:
     /**
      * Creates an empty service registry
      */
-    explicit ServiceRegistry() : _srvs() {
+    explicit ServiceRegistry() : _srvs(), _buckets(), _waiters() {
     }
     /**
      * Deletes all registered services
@@ -163,6 +195,17 @@ public:
      */
     const Service* reg(Child *child, const String &name, capsel_t pts, size_t count,
                        const BitField<Hip::MAX_CPUS> &available);
+    /**
+     * Adds the given waiter, whose semaphore will be up'ed and which will be removed again, as
+     * soon as the service it waits for is registered. Note that the caller has to check before
+     * that the service is not registered yet.
+     *
+     * @param waiter the waiter
+     */
+    void add_waiter(Waiter *waiter) {
+        _waiters[hash(waiter->_name)].append(waiter);
+    }
+
     /**
      * Unregisters the service with given name from given child. Note that only the created can
      * unregister it.
@@ -188,8 +231,9 @@ public:
     void remove(Child *child) {
         for(auto it = _srvs.begin(); it != _srvs.end(); ) {
             if(it->child() == child) {
-                _srvs.remove(&*it);
-                delete &*it;
+                Service *s = &*it;
+                unlink(s);
+                delete s;
                 it = _srvs.begin();
             }
             else
@@ -198,18 +242,29 @@ public:
     }
 
 private:
+    static size_t hash(const String &name) {
+        // FNV-1a
+        uint32_t h = 2166136261U;
+        for(size_t i = 0; i < name.length(); ++i)
+            h = (h ^ static_cast<uchar>(name.str()[i])) * 16777619U;
+        return h % BUCKETS;
+    }
+
     Service *search(const String &name) {
         return const_cast<Service*>(const_cast<const ServiceRegistry*>(this)->search(name));
     }
     const Service *search(const String &name) const {
-        for(auto it = _srvs.cbegin(); it != _srvs.cend(); ++it) {
-            if(it->name() == name)
-                return &*it;
+        for(Service *s = _buckets[hash(name)]; s != nullptr; s = s->_hnext) {
+            if(s->name() == name)
+                return s;
         }
         return 0;
     }
+    void unlink(Service *s);
 
     SList<Service> _srvs;
+    Service *_buckets[BUCKETS];
+    SList<Waiter> _waiters[BUCKETS];
 };
 
 }
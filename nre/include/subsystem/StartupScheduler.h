@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <arch/Types.h>
+#include <subsystem/ChildManager.h>
+#include <subsystem/ChildConfig.h>
+#include <collection/SList.h>
+#include <util/Clock.h>
+
+namespace nre {
+
+/**
+ * Starts a set of childs as early as possible instead of one after another. That is, every child
+ * is started as soon as the services it depends on are registered. The dependencies are specified
+ * by "requires=<service>" in the command line, which may be given multiple times ("requires="
+ * alone means that there are none). Childs without it depend on the services of all childs that
+ * have been added before, so that the order of the boot configuration is kept for them. Since every
+ * child runs on the CPU given in its config, independent childs start up concurrently.
+ *
+ * Usage-example:
+ * StartupScheduler sched(mng);
+ * sched.add(addr, size, new ChildConfig(...));
+ * ...
+ * sched.run();
+ */
+class StartupScheduler {
+public:
+    /**
+     * A child that should be started
+     */
+    class Entry : public SListItem {
+        friend class StartupScheduler;
+
+    public:
+        /**
+         * Creates the entry
+         *
+         * @param addr the address of the ELF file
+         * @param size the size of the ELF file
+         * @param config the config (is owned by the entry)
+         */
+        explicit Entry(uintptr_t addr, size_t size, ChildConfig *config)
+            : SListItem(), _addr(addr), _size(size), _config(config), _started(false),
+              _ready(false), _id(), _start_time(), _ready_time() {
+        }
+        ~Entry() {
+            delete _config;
+        }
+
+        /**
+         * @return the config of the child
+         */
+        const ChildConfig &config() const {
+            return *_config;
+        }
+        /**
+         * @return whether all services of the child have been registered
+         */
+        bool ready() const {
+            return _ready;
+        }
+        /**
+         * @return the id of the child (only valid if it has been started)
+         */
+        Child::id_type id() const {
+            return _id;
+        }
+        /**
+         * @return the time in microseconds after the start of the scheduler, at which the child
+         *  has been started
+         */
+        timevalue_t start_time() const {
+            return _start_time;
+        }
+        /**
+         * @return the time in microseconds after the start of the scheduler, at which all
+         *  services of the child were registered
+         */
+        timevalue_t ready_time() const {
+            return _ready_time;
+        }
+
+    private:
+        Entry(const Entry&);
+        Entry& operator=(const Entry&);
+
+        uintptr_t _addr;
+        size_t _size;
+        ChildConfig *_config;
+        bool _started;
+        bool _ready;
+        Child::id_type _id;
+        timevalue_t _start_time;
+        timevalue_t _ready_time;
+    };
+
+    typedef SList<Entry>::const_iterator iterator;
+
+    /**
+     * Creates an empty scheduler that uses <mng> to load the childs
+     *
+     * @param mng the child manager
+     */
+    explicit StartupScheduler(ChildManager &mng) : _mng(mng), _clock(1000000), _begin(), _entries() {
+    }
+    /**
+     * Destroys the entries. The childs are not affected by that.
+     */
+    ~StartupScheduler() {
+        for(auto it = _entries.begin(); it != _entries.end(); ) {
+            auto old = it++;
+            delete &*old;
+        }
+    }
+
+    /**
+     * Adds the given child. Note that the order matters for childs without "requires=...".
+     *
+     * @param addr the address of the ELF file (has to stay accessible as long as the child exists)
+     * @param size the size of the ELF file
+     * @param config the config of the child (is deleted by the scheduler)
+     */
+    void add(uintptr_t addr, size_t size, ChildConfig *config) {
+        _entries.append(new Entry(addr, size, config));
+    }
+
+    /**
+     * Starts all childs and waits until the services of all of them are registered. If the
+     * dependencies of the remaining childs can't be satisfied anymore, they are started in the
+     * order in which they have been added.
+     *
+     * @throws Exception if a child could not be loaded
+     */
+    void run();
+
+    /**
+     * @return beginning of the entries
+     */
+    iterator begin() const {
+        return _entries.cbegin();
+    }
+    /**
+     * @return end of the entries
+     */
+    iterator end() const {
+        return _entries.cend();
+    }
+
+private:
+    StartupScheduler(const StartupScheduler&);
+    StartupScheduler& operator=(const StartupScheduler&);
+
+    bool startable(const Entry &e) const;
+    bool provided(const Entry &e) const;
+    void start(Entry &e);
+    timevalue_t elapsed() const {
+        return _clock.dest_time_of(_clock.source_time() - _begin);
+    }
+
+    ChildManager &_mng;
+    Clock _clock;
+    timevalue_t _begin;
+    SList<Entry> _entries;
+};
+
+}
@@ -485,6 +485,14 @@ private:
     UtcbFrameRef& operator=(const UtcbFrameRef&);
 
 protected:
+    /**
+     * @param idx the index of the untyped item (in words)
+     * @return a reference to the untyped item <idx> in this frame
+     */
+    word_t &untyped_word(size_t idx) {
+        return reinterpret_cast<word_t*>(_utcb->msg)[idx];
+    }
+
     Utcb *_utcb;
     word_t *_top;
     size_t _upos;
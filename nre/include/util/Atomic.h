@@ -30,12 +30,12 @@ public:
         return __sync_fetch_and_add(ptr, value);
     }
 
-    template<typename T>
-    static void bit_and(T *ptr, T value) {
+    template<typename T, typename Y>
+    static void bit_and(T volatile *ptr, Y value) {
         __sync_and_and_fetch(ptr, value);
     }
-    template<typename T>
-    static void bit_or(T *ptr, T value) {
+    template<typename T, typename Y>
+    static void bit_or(T volatile *ptr, Y value) {
         __sync_or_and_fetch(ptr, value);
     }
 
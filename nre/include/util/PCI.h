@@ -75,14 +75,21 @@ public:
     }
 
     /**
-     * Program the nr-th MSI/MSI-X vector of the given device.
+     * @return the number of MSI-X vectors the given device supports (0 if it has no MSI-X support)
      */
-    Gsi *get_gsi_msi(BDF bdf, uint nr, void *msix_table = nullptr);
+    uint msix_vectors(BDF bdf);
+
+    /**
+     * Program the nr-th MSI/MSI-X vector of the given device and route it to CPU <cpu>.
+     */
+    Gsi *get_gsi_msi(BDF bdf, uint nr, void *msix_table = nullptr,
+                     cpu_t cpu = CPU::current().log_id());
 
     /**
      * Returns the gsi and enables them.
      */
-    Gsi *get_gsi(BDF bdf, uint nr, bool /*level*/ = false, void *msix_table = nullptr);
+    Gsi *get_gsi(BDF bdf, uint nr, bool /*level*/ = false, void *msix_table = nullptr,
+                 cpu_t cpu = CPU::current().log_id());
 
 private:
     void init_msix_table(void *addr, BDF bdf, value_type msix_offset, uint nr, Gsi *gsi) {
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <arch/Types.h>
+#include <arch/SpinLock.h>
+#include <util/ScopedLock.h>
 #include <Exception.h>
 #include <Assert.h>
 
@@ -31,96 +33,115 @@ public:
 };
 
 /**
- * Keeping track of the timeouts.
+ * Keeping track of the timeouts. The programmed timeouts are kept in a 4-ary min-heap, so that the
+ * next one is available in O(1) and requesting and cancelling a timeout takes O(log n). The
+ * timeout objects are allocated in chunks of ENTRIES from a free-list, i.e. the capacity grows
+ * on demand. Note that timeout object 0 is reserved, because trigger() uses 0 as "none".
  */
 template<unsigned ENTRIES, typename DATA>
 class TimeoutList {
+    // the maximum number of chunks
+    static const size_t MAX_CHUNKS  = 256;
+    static const size_t ARITY       = 4;
+    static const size_t NOT_QUEUED  = static_cast<size_t>(-1);
+
     class TimeoutEntry {
         friend class TimeoutList<ENTRIES, DATA>;
-        TimeoutEntry *_next;
-        TimeoutEntry *_prev;
         timevalue_t _timeout;
         DATA * data;
+        size_t _nr;
+        // the position in the heap or NOT_QUEUED
+        size_t _pos;
+        // the next free object, if this one is free
+        size_t _next;
         bool _free;
     };
 
 public:
-    explicit TimeoutList() : _entries() {
-        for(size_t i = 0; i < ENTRIES; i++) {
-            _entries[i]._prev = _entries + i;
-            _entries[i]._next = _entries + i;
-            _entries[i].data = nullptr;
-            _entries[i]._free = true;
-        }
-        _entries[0]._timeout = ~0ULL;
+    explicit TimeoutList()
+        : _chunks(), _chunk_count(), _freelist(), _heap(), _heap_size(), _heap_cap(), _lock() {
+        add_chunk();
+        // object 0 is reserved
+        _freelist = entry(0)._next;
+        entry(0)._free = false;
+    }
+    ~TimeoutList() {
+        for(size_t i = 0; i < _chunk_count; ++i)
+            delete[] _chunks[i];
+        delete[] _heap;
     }
 
     /**
      * Alloc a new timeout object.
      */
     size_t alloc(DATA *data = nullptr) {
-        for(size_t i = 1; i < ENTRIES; i++) {
-            if(!_entries[i]._free)
-                continue;
-            _entries[i].data = data;
-            _entries[i]._free = false;
-            return i;
+        ScopedLock<SpinLock> guard(&_lock);
+        if(_freelist == 0) {
+            if(_chunk_count == MAX_CHUNKS)
+                throw TimeoutListException(E_CAPACITY, "No free timeout slots");
+            add_chunk();
         }
-        throw TimeoutListException(E_CAPACITY, "No free timeout slots");
+        size_t nr = _freelist;
+        TimeoutEntry &e = entry(nr);
+        _freelist = e._next;
+        e.data = data;
+        e._free = false;
+        return nr;
     }
 
     /**
      * Dealloc a timeout object.
      */
     bool dealloc(size_t nr, bool withcancel = false) {
-        assert(nr >= 1 && nr <= ENTRIES - 1);
-        if(_entries[nr]._free)
-            return false;
-
+        assert(nr >= 1 && nr < _chunk_count * ENTRIES);
         // should only be done when no no concurrent access happens ...
         if(withcancel)
             cancel(nr);
-        _entries[nr]._free = true;
-        _entries[nr].data = nullptr;
+
+        ScopedLock<SpinLock> guard(&_lock);
+        TimeoutEntry &e = entry(nr);
+        if(e._free)
+            return false;
+        // it might still be queued. in this case it triggers with data = nullptr.
+        e._free = true;
+        e.data = nullptr;
+        e._next = _freelist;
+        _freelist = nr;
         return true;
     }
 
     /**
      * Cancel a programmed timeout.
+     *
+     * @return true if it was programmed and has not been the next one
      */
     bool cancel(size_t nr) {
-        assert(nr >= 1 && nr <= ENTRIES - 1);
-        TimeoutEntry *current = _entries + nr;
-        if(current->_next == current)
+        assert(nr >= 1 && nr < _chunk_count * ENTRIES);
+        TimeoutEntry &e = entry(nr);
+        if(e._pos == NOT_QUEUED)
             return false;
-        bool res = _entries[0]._next != current;
-        current->_next->_prev = current->_prev;
-        current->_prev->_next = current->_next;
-        current->_next = current->_prev = current;
+        bool res = e._pos != 0;
+        remove(e._pos);
         return res;
     }
 
     /**
      * Request a new timeout.
+     *
+     * @return true if the next timeout did not change
      */
     bool request(size_t nr, timevalue_t to) {
-        assert(nr >= 1 && nr <= ENTRIES - 1);
+        assert(nr >= 1 && nr < _chunk_count * ENTRIES);
         timevalue_t old = timeout();
-        TimeoutEntry *current = _entries + nr;
         cancel(nr);
 
-        // keep a sorted list here
-        TimeoutEntry *t = _entries;
-        do {
-            t = t->_next;
-        }
-        while(t->_timeout < to);
-
-        current->_timeout = to;
-        current->_next = t;
-        current->_prev = t->_prev;
-        t->_prev->_next = current;
-        t->_prev = current;
+        if(_heap_size == _heap_cap)
+            grow_heap();
+        TimeoutEntry *e = &entry(nr);
+        e->_timeout = to;
+        _heap[_heap_size] = e;
+        e->_pos = _heap_size;
+        sift_up(_heap_size++);
         return timeout() == old;
     }
 
@@ -128,22 +149,110 @@ public:
      * Get the head of the queue.
      */
     size_t trigger(timevalue_t now, DATA **data = nullptr) {
-        if(now >= timeout()) {
-            size_t i = _entries[0]._next - _entries;
+        if(_heap_size && now >= _heap[0]->_timeout) {
             if(data)
-                *data = _entries[i].data;
-            return i;
+                *data = _heap[0]->data;
+            return _heap[0]->_nr;
         }
         return 0;
     }
 
     timevalue_t timeout() {
-        assert(_entries[0]._next);
-        return _entries[0]._next->_timeout;
+        return _heap_size ? _heap[0]->_timeout : ~0ULL;
     }
 
 private:
-    TimeoutEntry _entries[ENTRIES];
+    TimeoutEntry &entry(size_t nr) {
+        return _chunks[nr / ENTRIES][nr % ENTRIES];
+    }
+
+    void add_chunk() {
+        TimeoutEntry *chunk = new TimeoutEntry[ENTRIES];
+        size_t base = _chunk_count * ENTRIES;
+        // put them in ascending order in the free-list
+        for(size_t i = ENTRIES; i-- > 0; ) {
+            chunk[i]._timeout = ~0ULL;
+            chunk[i].data = nullptr;
+            chunk[i]._nr = base + i;
+            chunk[i]._pos = NOT_QUEUED;
+            chunk[i]._next = _freelist;
+            chunk[i]._free = true;
+            _freelist = base + i;
+        }
+        _chunks[_chunk_count++] = chunk;
+    }
+
+    void grow_heap() {
+        size_t ncap = _heap_cap ? _heap_cap * 2 : ENTRIES;
+        TimeoutEntry **nheap = new TimeoutEntry*[ncap];
+        for(size_t i = 0; i < _heap_size; ++i)
+            nheap[i] = _heap[i];
+        delete[] _heap;
+        _heap = nheap;
+        _heap_cap = ncap;
+    }
+
+    void remove(size_t pos) {
+        _heap[pos]->_pos = NOT_QUEUED;
+        if(pos == --_heap_size)
+            return;
+        // put the last one into the gap and restore the heap property
+        _heap[pos] = _heap[_heap_size];
+        _heap[pos]->_pos = pos;
+        if(pos > 0 && _heap[pos]->_timeout < _heap[(pos - 1) / ARITY]->_timeout)
+            sift_up(pos);
+        else
+            sift_down(pos);
+    }
+
+    void sift_up(size_t pos) {
+        TimeoutEntry *e = _heap[pos];
+        while(pos > 0) {
+            size_t parent = (pos - 1) / ARITY;
+            if(_heap[parent]->_timeout <= e->_timeout)
+                break;
+            _heap[pos] = _heap[parent];
+            _heap[pos]->_pos = pos;
+            pos = parent;
+        }
+        _heap[pos] = e;
+        e->_pos = pos;
+    }
+
+    void sift_down(size_t pos) {
+        TimeoutEntry *e = _heap[pos];
+        while(1) {
+            size_t first = pos * ARITY + 1;
+            if(first >= _heap_size)
+                break;
+            size_t min = first;
+            size_t end = first + ARITY < _heap_size ? first + ARITY : _heap_size;
+            for(size_t c = first + 1; c < end; ++c) {
+                if(_heap[c]->_timeout < _heap[min]->_timeout)
+                    min = c;
+            }
+            if(e->_timeout <= _heap[min]->_timeout)
+                break;
+            _heap[pos] = _heap[min];
+            _heap[pos]->_pos = pos;
+            pos = min;
+        }
+        _heap[pos] = e;
+        e->_pos = pos;
+    }
+
+    TimeoutList(const TimeoutList&);
+    TimeoutList& operator=(const TimeoutList&);
+
+    // the chunks are never moved, so that alloc() and dealloc() can be used concurrently to the
+    // heap operations
+    TimeoutEntry *_chunks[MAX_CHUNKS];
+    size_t _chunk_count;
+    size_t _freelist;
+    TimeoutEntry **_heap;
+    size_t _heap_size;
+    size_t _heap_cap;
+    SpinLock _lock;
 };
 
 }
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <arch/Startup.h>
+#include <util/ScopedLock.h>
+#include <util/Math.h>
+#include <Trace.h>
+#include <Hip.h>
+#include <CPU.h>
+#include <cstring>
+
+namespace nre {
+
+volatile int Trace::_levels = 0;
+TraceFormat::Header *Trace::_buf = nullptr;
+
+void Trace::enable(int levels, size_t records) {
+    if(!_buf && levels) {
+        records = Math::next_pow2(Math::max<size_t>(records, 1));
+        size_t cpus = CPU::count();
+        size_t size = sizeof(TraceFormat::Header) + cpus * cpu_size(records);
+        TraceFormat::Header *buf = reinterpret_cast<TraceFormat::Header*>(new char[size]);
+        memset(buf, 0, size);
+        buf->version = TraceFormat::VERSION;
+        buf->record_size = sizeof(TraceFormat::Record);
+        buf->cpus = cpus;
+        buf->records = records;
+        buf->tsc_freq = static_cast<uint64_t>(Hip::get().freq_tsc) * 1000;
+        const char *name = _startup_info.progname;
+        for(size_t i = 0; name && name[i] && i < TraceFormat::NAME_LEN - 1; ++i)
+            buf->name[i] = name[i];
+        // set the magic last, so that it's only found in a memory dump if it's complete
+        Sync::memory_barrier();
+        buf->magic = TraceFormat::MAGIC;
+        Sync::memory_barrier();
+        _buf = buf;
+    }
+    Sync::memory_barrier();
+    _levels = levels;
+}
+
+/**
+ * Writes <size> bytes at <data> as hex lines to <os>. Every line starts with its offset in the
+ * dump, so that the decoder notices if lines got lost (e.g. because the log ring was full).
+ *
+ * @return the offset behind the written bytes
+ */
+static size_t dump_bytes(OStream &os, size_t off, const void *data, size_t size) {
+    static const char *hex = "0123456789abcdef";
+    // one record per line to stay below the maximum line length of Serial
+    char line[sizeof(TraceFormat::Record) * 2 + 1];
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data);
+    while(size > 0) {
+        size_t amount = Math::min(size, sizeof(TraceFormat::Record));
+        for(size_t i = 0; i < amount; ++i) {
+            line[i * 2] = hex[bytes[i] >> 4];
+            line[i * 2 + 1] = hex[bytes[i] & 0xF];
+        }
+        line[amount * 2] = '\0';
+        os << "#TRACE " << fmt(off, "x") << " " << line << "\n";
+        bytes += amount;
+        size -= amount;
+        off += amount;
+    }
+    return off;
+}
+
+void Trace::dump(OStream &os, size_t max) {
+    if(!_buf)
+        return;
+
+    // don't record anything while we're reading the buffer
+    int levels = _levels;
+    _levels = 0;
+    Sync::memory_barrier();
+
+    // if we should write less, we pretend that the ring is smaller. that is, the header states
+    // <n> records per CPU and the latest ones are written at the positions of this ring
+    TraceFormat::Header hd = *_buf;
+    size_t n = hd.records;
+    if(max)
+        n = Math::min<size_t>(n, Math::next_pow2(max));
+    hd.records = n;
+
+    ScopedLock<UserSm> guard(&Logging::sm);
+    os << "#TRACE-BEGIN " << hd.name << "\n";
+    size_t off = dump_bytes(os, 0, &hd, sizeof(hd));
+    // only dump the records that have been written to keep it short. the decoder knows the
+    // number of records from the CPU header
+    for(size_t cpu = 0; cpu < hd.cpus; ++cpu) {
+        TraceFormat::CPUHeader *ch = cpu_header(cpu);
+        // take a snapshot, because writes that are still in progress might change wpos
+        TraceFormat::CPUHeader snap = *ch;
+        size_t count = Math::min<size_t>(snap.wpos, n);
+        size_t first = snap.wpos - count;
+        off = dump_bytes(os, off, &snap, sizeof(snap));
+        for(size_t i = 0; i < count; ++i) {
+            // the record that the decoder expects at position i of the smaller ring
+            size_t pos = first + ((i - first) & (n - 1));
+            off = dump_bytes(os, off, records(ch) + (pos & (_buf->records - 1)),
+                             sizeof(TraceFormat::Record));
+        }
+    }
+    os << "#TRACE-END\n";
+
+    _levels = levels;
+}
+
+}
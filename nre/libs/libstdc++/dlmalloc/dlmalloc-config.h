@@ -39,7 +39,10 @@
 #define LACKS_SCHED_H
 #define LACKS_TIME_H
 #define LACKS_STDLIB_H
-#define DEFAULT_GRANULARITY     (128 * 1024)        // 128K
+#define DEFAULT_GRANULARITY     (256 * 1024)        // 256K
+/* never use a separate mmap for large chunks. munmap can't give memory back, so that they would
+ * be lost after free. this way, they end up in a segment and can be reused. */
+#define DEFAULT_MMAP_THRESHOLD  ((size_t)~(size_t)0)
 #define MALLOC_ALIGNMENT        16                  // important for SSE
 
 /* MMAP dummy */
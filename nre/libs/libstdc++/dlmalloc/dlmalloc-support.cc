@@ -22,6 +22,7 @@
 #include <cstring>
 #include <Syscalls.h>
 #include <util/Atomic.h>
+#include <mem/ThreadCache.h>
 #include "dlmalloc-config.h"
 
 using namespace nre;
@@ -43,6 +44,8 @@ EXTERN_C void free(void*);
 
 static void* startup_malloc(size_t size);
 static void startup_free(void *ptr);
+static void* cached_malloc(size_t size);
+static void cached_free(void *ptr);
 
 static malloc_func malloc_ptr = startup_malloc;
 static realloc_func realloc_ptr = 0;
@@ -85,16 +88,18 @@ void *mmap(void *, size_t size, int prot, int, int, off_t) {
 
 int munmap(void *, size_t) {
     // TODO implement me
-    return 0;
+    // until then, report a failure, so that dlmalloc keeps unused segments and reuses them later
+    // instead of forgetting about them
+    return -1;
 }
 
 // External interface
 
 void dlmalloc_init() {
     dlmalloc_init_locks();
-    malloc_ptr = dlmalloc;
+    malloc_ptr = cached_malloc;
     realloc_ptr = dlrealloc;
-    free_ptr = dlfree;
+    free_ptr = cached_free;
 }
 
 void* malloc(size_t size) {
@@ -111,6 +116,18 @@ void free(void *p) {
         free_ptr(p);
 }
 
+// malloc with per-thread cache in front of dlmalloc
+
+static void* cached_malloc(size_t size) {
+    void *res = ThreadCache::alloc(size);
+    return res ? res : dlmalloc(size);
+}
+
+static void cached_free(void *ptr) {
+    if(ptr && !ThreadCache::free(ptr))
+        dlfree(ptr);
+}
+
 // startup malloc implementation
 
 static void* startup_malloc(size_t size) {
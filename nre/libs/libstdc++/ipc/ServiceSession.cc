@@ -16,22 +16,107 @@
 
 #include <ipc/Service.h>
 #include <ipc/ServiceSession.h>
+#include <ipc/Batch.h>
+#include <util/Math.h>
+#include <Compiler.h>
 
 namespace nre {
 
 ServiceSession::ServiceSession(Service *s, size_t id, portal_func func)
     : SListTreapNode<size_t>(id), RefCounted(), _id(id),
-      _caps(CapSelSpace::get().allocate(1 << CPU::order(), 1 << CPU::order())),
+      _caps(CapSelSpace::get().allocate(1 << CPU::order(), 1 << CPU::order())), _func(func),
       _pts(new Pt *[CPU::count()]) {
     for(uint i = 0; i < CPU::count(); ++i) {
         _pts[i] = nullptr;
         if(s->available().is_set(i)) {
             Reference<LocalThread> ec = s->get_thread(i);
             assert(ec.valid());
-            _pts[i] = new Pt(ec, _caps + i, func);
+            _pts[i] = new Pt(ec, _caps + i, portal);
             _pts[i]->set_id(reinterpret_cast<word_t>(this));
         }
     }
 }
 
+void ServiceSession::portal(void *obj) {
+    ServiceSession *sess = reinterpret_cast<ServiceSession*>(obj);
+    bool batch = false;
+    {
+        UtcbFrameRef uf;
+        if(uf.untyped() > 0) {
+            word_t first;
+            uf >> first;
+            batch = first == Batch::MAGIC;
+        }
+    }
+    if(EXPECT_FALSE(batch))
+        run_batch(sess);
+    else
+        sess->_func(sess);
+}
+
+void ServiceSession::run_batch(ServiceSession *sess) {
+    UtcbFrameRef uf;
+    // the frames for the commands overwrite the UTCB. thus, copy the commands out first and
+    // collect the replies behind them
+    const size_t max = Utcb::SIZE / sizeof(word_t);
+    word_t *buf = new word_t[max];
+    size_t total = uf.untyped() - 1;
+    word_t magic;
+    uf >> magic;
+    for(size_t i = 0; i < total; ++i)
+        uf >> buf[i];
+    uf.clear();
+
+    word_t *reply = buf + total;
+    for(size_t pos = 0; pos < total; ) {
+        size_t len = buf[pos++];
+        if(len > total - pos)
+            break;
+
+        size_t rlen;
+        try {
+            rlen = run_command(sess, buf + pos, len, reply, max - total);
+        }
+        catch(const Exception&) {
+            // not even the error fits into the UTCB anymore. the client notices that replies
+            // are missing
+            break;
+        }
+        pos += len;
+
+        // if the reply doesn't fit, stop here. the client notices that replies are missing
+        if(uf.free_untyped() < rlen + 1)
+            break;
+        uf << static_cast<word_t>(rlen);
+        for(size_t i = 0; i < rlen; ++i)
+            uf << reply[i];
+    }
+    delete[] buf;
+}
+
+size_t ServiceSession::run_command(ServiceSession *sess, const word_t *words, size_t len,
+                                   word_t *reply, size_t max) {
+    UtcbFrame cmd;
+    try {
+        // the frame has less space than the one of the client, because the UTCB holds the replies
+        // that have been collected so far as well
+        if(len > cmd.free_untyped())
+            throw Exception(E_CAPACITY, "The command doesn't fit into the UTCB");
+        for(size_t i = 0; i < len; ++i)
+            cmd << words[i];
+        sess->_func(sess);
+        if(cmd.typed() > 0)
+            throw Exception(E_ARGS_INVALID, "Capabilities can't be transferred in a batch");
+    }
+    catch(const Exception &e) {
+        cmd.clear();
+        cmd << e;
+    }
+
+    size_t rlen = Math::min(cmd.untyped(), max);
+    for(size_t i = 0; i < rlen; ++i)
+        cmd >> reply[i];
+    return rlen;
+}
+
 }
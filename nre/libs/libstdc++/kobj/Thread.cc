@@ -17,6 +17,7 @@
 #include <kobj/Sc.h>
 #include <kobj/Thread.h>
 #include <kobj/Pt.h>
+#include <mem/ThreadCache.h>
 #include <utcb/UtcbFrame.h>
 #include <CPU.h>
 #include <RCU.h>
@@ -29,12 +30,13 @@ size_t Thread::_tls_idx = 1;
 Thread::Thread(Pd *pd, Syscalls::ECType type, ExecEnv::startup_func start, uintptr_t ret, cpu_t cpu,
                capsel_t evb, uintptr_t stack, uintptr_t uaddr)
     : Ec(cpu, evb, create(this, pd, type, cpu, evb, start, ret, uaddr, stack, _flags)),
-      SListItem(), RefCounted(), _rcu_counter(0), _utcb_addr(uaddr), _stack_addr(stack), _tls() {
+      SListItem(), RefCounted(), _rcu_counter(0), _utcb_addr(uaddr), _stack_addr(stack), _tls(),
+      _cache() {
 }
 
 Thread::Thread(cpu_t cpu, capsel_t evb, capsel_t cap, uintptr_t stack, uintptr_t uaddr)
     : Ec(cpu, evb, cap), SListItem(), RefCounted(), _rcu_counter(0), _utcb_addr(uaddr), _stack_addr(stack),
-      _flags(), _tls() {
+      _flags(), _tls(), _cache() {
 }
 
 capsel_t Thread::create(Thread *t, Pd *pd, Syscalls::ECType type, cpu_t cpu, capsel_t evb,
@@ -69,6 +71,7 @@ capsel_t Thread::create(Thread *t, Pd *pd, Syscalls::ECType type, cpu_t cpu, cap
 
 Thread::~Thread() {
     RCU::remove(this);
+    ThreadCache::destroy(this);
 }
 
 }
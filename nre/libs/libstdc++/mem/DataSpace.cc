@@ -15,6 +15,7 @@
  */
 
 #include <mem/DataSpace.h>
+#include <arch/Startup.h>
 #include <kobj/Pt.h>
 #include <utcb/UtcbFrame.h>
 #include <util/ScopedCapSels.h>
@@ -22,6 +23,8 @@
 
 namespace nre {
 
+Slab<DataSpace> DataSpace::_slab INIT_PRIO_SLAB;
+
 void DataSpace::create(DataSpaceDesc &desc, capsel_t *sel, capsel_t *unmapsel) {
     UtcbFrame uf;
     // prepare for receiving map and unmap-cap
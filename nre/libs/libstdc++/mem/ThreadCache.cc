@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <mem/ThreadCache.h>
+#include <kobj/Thread.h>
+#include <util/Math.h>
+#include <Compiler.h>
+#include <new>
+
+EXTERN_C void* dlmalloc(size_t);
+EXTERN_C void dlfree(void*);
+EXTERN_C void** dlindependent_comalloc(size_t, size_t*, void**);
+EXTERN_C size_t dlbulk_free(void**, size_t);
+EXTERN_C size_t dlmalloc_usable_size(void*);
+
+namespace nre {
+
+ThreadCache::ThreadCache() {
+    for(size_t i = 0; i < CLASSES; ++i) {
+        _bins[i].head = nullptr;
+        _bins[i].count = 0;
+    }
+}
+
+ThreadCache *ThreadCache::get() {
+    Thread *t = ExecEnv::get_current_thread();
+    if(EXPECT_FALSE(!t))
+        return nullptr;
+    if(EXPECT_FALSE(!t->_cache)) {
+        // don't use new here, because that would end up in malloc again
+        void *mem = dlmalloc(sizeof(ThreadCache));
+        if(!mem)
+            return nullptr;
+        t->_cache = new (mem) ThreadCache();
+    }
+    return t->_cache;
+}
+
+void *ThreadCache::alloc(size_t size) {
+    if(size == 0 || size > MAX_SIZE)
+        return nullptr;
+    ThreadCache *c = get();
+    if(EXPECT_FALSE(!c))
+        return nullptr;
+
+    size_t cls = (size - 1) / GRANULE;
+    Bin &bin = c->_bins[cls];
+    if(EXPECT_FALSE(!bin.head))
+        return c->refill(cls);
+    Object *obj = bin.head;
+    bin.head = obj->next;
+    bin.count--;
+    return obj;
+}
+
+bool ThreadCache::free(void *p) {
+    // the usable size might be larger than the requested one. take the largest class that fits
+    // into it, so that the object is large enough for everybody that gets it from this class.
+    size_t size = dlmalloc_usable_size(p);
+    if(size < GRANULE || size >= MAX_SIZE + GRANULE)
+        return false;
+    ThreadCache *c = get();
+    if(EXPECT_FALSE(!c))
+        return false;
+
+    size_t cls = size / GRANULE - 1;
+    Bin &bin = c->_bins[cls];
+    if(EXPECT_FALSE(bin.count >= limit(cls)))
+        c->drain(cls, bin.count / 2);
+    Object *obj = reinterpret_cast<Object*>(p);
+    obj->next = bin.head;
+    bin.head = obj;
+    bin.count++;
+    return true;
+}
+
+void ThreadCache::destroy(Thread *t) {
+    ThreadCache *c = t->_cache;
+    if(c) {
+        for(size_t i = 0; i < CLASSES; ++i) {
+            while(c->_bins[i].count > 0)
+                c->drain(i, c->_bins[i].count);
+        }
+        t->_cache = nullptr;
+        dlfree(c);
+    }
+}
+
+void *ThreadCache::refill(size_t cls) {
+    // allocate a batch of objects with a single lock operation. we keep the first one for the
+    // caller and put the rest into the bin.
+    size_t count = Math::min(Math::max<size_t>(limit(cls) / 2, 1), MAX_BATCH);
+    size_t sizes[MAX_BATCH];
+    void *objs[MAX_BATCH];
+    for(size_t i = 0; i < count; ++i)
+        sizes[i] = class_size(cls);
+    if(!dlindependent_comalloc(count, sizes, objs))
+        return nullptr;
+
+    Bin &bin = _bins[cls];
+    for(size_t i = 1; i < count; ++i) {
+        Object *obj = reinterpret_cast<Object*>(objs[i]);
+        obj->next = bin.head;
+        bin.head = obj;
+    }
+    bin.count += count - 1;
+    return objs[0];
+}
+
+void ThreadCache::drain(size_t cls, size_t count) {
+    // give them back with a single lock operation as well
+    void *objs[BIN_BYTES / GRANULE];
+    Bin &bin = _bins[cls];
+    size_t n = 0;
+    while(n < count && bin.head) {
+        objs[n++] = bin.head;
+        bin.head = bin.head->next;
+    }
+    bin.count -= n;
+    dlbulk_free(objs, n);
+}
+
+}
@@ -15,6 +15,8 @@
  */
 
 #include <arch/ExecEnv.h>
+#include <stream/Serial.h>
+#include <Trace.h>
 #include <cstdlib>
 
 using namespace nre;
@@ -22,6 +24,7 @@ using namespace nre;
 EXTERN_C void __cxa_finalize(void *d);
 
 void abort() {
+    Trace::dump(Serial::get());
     ExecEnv::exit(ExecEnv::EXIT_FAILURE);
 }
 
@@ -30,6 +33,8 @@ void thread_exit() {
 }
 
 void exit(int code) {
+    // do that before the destructors are called because we need the log-service for it
+    Trace::dump(Serial::get());
     __cxa_finalize(nullptr);
     ExecEnv::exit(code);
 }
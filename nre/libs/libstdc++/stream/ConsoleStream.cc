@@ -57,12 +57,17 @@ void VGAStream::put(ushort value, ushort *base, uint &pos) {
             break;
     }
 
+    size_t offset = reinterpret_cast<uintptr_t>(base) - _sess.screen().virt();
     // scroll?
     if(pos >= COLS * ROWS) {
         memmove(base, base + COLS, (ROWS - 1) * COLS * 2);
         memset(base + (ROWS - 1) * COLS, 0, COLS * 2);
         pos = COLS * (ROWS - 1);
+        _sess.mark_dirty(offset, COLS * ROWS * 2);
+    }
+    if(visible) {
+        base[pos] = value;
+        _sess.mark_dirty(offset + pos * 2, 2);
+        pos++;
     }
-    if(visible)
-        base[pos++] = value;
 }
@@ -17,7 +17,30 @@
 #include <arch/Defines.h>
 #include <cstring>
 
-void* memcpy(void *dest, const void *src, size_t len) {
+/*
+ * The memory operations exist in several variants. The best one for the CPU is selected at the
+ * first call by means of CPUID. The word-wise variants are the fallback and are used for small
+ * sizes and the remaining bytes. SSE2 is always available, because we build with -msse2.
+ */
+
+// below this size, the vector variants are not worth it
+#define VEC_THRESHOLD       64
+// above this size, rep movsb/stosb beats the SSE2 loop on CPUs with ERMS
+#define ERMS_THRESHOLD      256
+// above this size, we bypass the caches with non-temporal stores. this pays off for framebuffers
+// and other large buffers that are not read again soon.
+#define NT_THRESHOLD        (256 * 1024)
+
+typedef void *(*memcpy_func)(void *dest, const void *src, size_t len);
+typedef void *(*memset_func)(void *addr, int value, size_t count);
+
+static void *memcpy_resolve(void *dest, const void *src, size_t len);
+static void *memset_resolve(void *addr, int value, size_t count);
+
+static memcpy_func memcpy_impl = memcpy_resolve;
+static memset_func memset_impl = memset_resolve;
+
+static void *memcpy_words(void *dest, const void *src, size_t len) {
     uchar *bdest = (uchar*)dest;
     uchar *bsrc = (uchar*)src;
     // copy bytes for alignment
@@ -59,33 +82,7 @@ void* memcpy(void *dest, const void *src, size_t len) {
     return dest;
 }
 
-void *memmove(void *dest, const void *src, size_t count) {
-    uchar *s, *d;
-    // nothing to do?
-    if((uchar*)dest == (uchar*)src || count == 0)
-        return dest;
-
-    // moving forward
-    if((uintptr_t)dest > (uintptr_t)src) {
-        word_t *dsrc = (word_t*)((uintptr_t)src + count - sizeof(word_t));
-        word_t *ddest = (word_t*)((uintptr_t)dest + count - sizeof(word_t));
-        while(count >= sizeof(word_t)) {
-            *ddest-- = *dsrc--;
-            count -= sizeof(word_t);
-        }
-        s = (uchar*)dsrc + (sizeof(word_t) - 1);
-        d = (uchar*)ddest + (sizeof(word_t) - 1);
-        while(count-- > 0)
-            *d-- = *s--;
-    }
-    // moving backwards
-    else
-        memcpy(dest, src, count);
-
-    return dest;
-}
-
-void *memset(void *addr, int value, size_t count) {
+static void *memset_words(void *addr, int value, size_t count) {
     uchar *baddr = (uchar*)addr;
     // align it
     while(count > 0 && (uintptr_t)baddr % sizeof(word_t)) {
@@ -108,6 +105,234 @@ void *memset(void *addr, int value, size_t count) {
     return addr;
 }
 
+/**
+ * Copies <len> bytes (a multiple of 64) from <src> to <dest>, which is 16-byte aligned
+ */
+static void copy_sse2(uchar *dest, const uchar *src, size_t len) {
+    __asm__ __volatile__ (
+        "1:\n\t"
+        "movdqu    (%1), %%xmm0\n\t"
+        "movdqu  16(%1), %%xmm1\n\t"
+        "movdqu  32(%1), %%xmm2\n\t"
+        "movdqu  48(%1), %%xmm3\n\t"
+        "movdqa  %%xmm0,   (%0)\n\t"
+        "movdqa  %%xmm1, 16(%0)\n\t"
+        "movdqa  %%xmm2, 32(%0)\n\t"
+        "movdqa  %%xmm3, 48(%0)\n\t"
+        "add     $64, %0\n\t"
+        "add     $64, %1\n\t"
+        "sub     $64, %2\n\t"
+        "jnz     1b\n\t"
+        : "+r" (dest), "+r" (src), "+r" (len)
+        :
+        : "memory", "xmm0", "xmm1", "xmm2", "xmm3"
+    );
+}
+
+/**
+ * Like copy_sse2, but with non-temporal stores
+ */
+static void copy_sse2_nt(uchar *dest, const uchar *src, size_t len) {
+    __asm__ __volatile__ (
+        "1:\n\t"
+        "movdqu    (%1), %%xmm0\n\t"
+        "movdqu  16(%1), %%xmm1\n\t"
+        "movdqu  32(%1), %%xmm2\n\t"
+        "movdqu  48(%1), %%xmm3\n\t"
+        "movntdq %%xmm0,   (%0)\n\t"
+        "movntdq %%xmm1, 16(%0)\n\t"
+        "movntdq %%xmm2, 32(%0)\n\t"
+        "movntdq %%xmm3, 48(%0)\n\t"
+        "add     $64, %0\n\t"
+        "add     $64, %1\n\t"
+        "sub     $64, %2\n\t"
+        "jnz     1b\n\t"
+        // the non-temporal stores are weakly ordered
+        "sfence\n\t"
+        : "+r" (dest), "+r" (src), "+r" (len)
+        :
+        : "memory", "xmm0", "xmm1", "xmm2", "xmm3"
+    );
+}
+
+/**
+ * Copies <len> bytes (a multiple of 16) backwards from <src> to <dest>, i.e. starting at the end.
+ * The areas may overlap, if dest > src.
+ */
+static void copy_sse2_backwards(uchar *dest, const uchar *src, size_t len) {
+    __asm__ __volatile__ (
+        "1:\n\t"
+        "sub     $16, %2\n\t"
+        "movdqu  (%1,%2), %%xmm0\n\t"
+        "movdqu  %%xmm0, (%0,%2)\n\t"
+        "jnz     1b\n\t"
+        : "+r" (dest), "+r" (src), "+r" (len)
+        :
+        : "memory", "xmm0"
+    );
+}
+
+/**
+ * Sets <len> bytes (a multiple of 64) at <addr>, which is 16-byte aligned, to <value>
+ */
+static void set_sse2(uchar *addr, uint32_t value, size_t len, int nt) {
+    if(nt) {
+        __asm__ __volatile__ (
+            "movd    %2, %%xmm0\n\t"
+            "pshufd  $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movntdq %%xmm0,   (%0)\n\t"
+            "movntdq %%xmm0, 16(%0)\n\t"
+            "movntdq %%xmm0, 32(%0)\n\t"
+            "movntdq %%xmm0, 48(%0)\n\t"
+            "add     $64, %0\n\t"
+            "sub     $64, %1\n\t"
+            "jnz     1b\n\t"
+            "sfence\n\t"
+            : "+r" (addr), "+r" (len)
+            : "r" (value)
+            : "memory", "xmm0"
+        );
+    }
+    else {
+        __asm__ __volatile__ (
+            "movd    %2, %%xmm0\n\t"
+            "pshufd  $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movdqa  %%xmm0,   (%0)\n\t"
+            "movdqa  %%xmm0, 16(%0)\n\t"
+            "movdqa  %%xmm0, 32(%0)\n\t"
+            "movdqa  %%xmm0, 48(%0)\n\t"
+            "add     $64, %0\n\t"
+            "sub     $64, %1\n\t"
+            "jnz     1b\n\t"
+            : "+r" (addr), "+r" (len)
+            : "r" (value)
+            : "memory", "xmm0"
+        );
+    }
+}
+
+static void *memcpy_sse2(void *dest, const void *src, size_t len) {
+    uchar *bdest = (uchar*)dest;
+    const uchar *bsrc = (const uchar*)src;
+    if(len >= VEC_THRESHOLD) {
+        // align the destination; the loads may be unaligned
+        size_t head = (16 - ((uintptr_t)bdest & 15)) & 15;
+        memcpy_words(bdest, bsrc, head);
+        bdest += head;
+        bsrc += head;
+        len -= head;
+
+        size_t vlen = len & ~(size_t)63;
+        if(vlen > 0) {
+            if(vlen >= NT_THRESHOLD)
+                copy_sse2_nt(bdest, bsrc, vlen);
+            else
+                copy_sse2(bdest, bsrc, vlen);
+            bdest += vlen;
+            bsrc += vlen;
+            len -= vlen;
+        }
+    }
+    memcpy_words(bdest, bsrc, len);
+    return dest;
+}
+
+static void *memcpy_erms(void *dest, const void *src, size_t len) {
+    if(len < ERMS_THRESHOLD || len >= NT_THRESHOLD)
+        return memcpy_sse2(dest, src, len);
+
+    void *d = dest;
+    __asm__ __volatile__ ("rep movsb" : "+D" (d), "+S" (src), "+c" (len) : : "memory");
+    return dest;
+}
+
+static void *memset_sse2(void *addr, int value, size_t count) {
+    uchar *baddr = (uchar*)addr;
+    if(count >= VEC_THRESHOLD) {
+        size_t head = (16 - ((uintptr_t)baddr & 15)) & 15;
+        memset_words(baddr, value, head);
+        baddr += head;
+        count -= head;
+
+        size_t vlen = count & ~(size_t)63;
+        if(vlen > 0) {
+            set_sse2(baddr, (uchar)value * 0x01010101U, vlen, vlen >= NT_THRESHOLD);
+            baddr += vlen;
+            count -= vlen;
+        }
+    }
+    memset_words(baddr, value, count);
+    return addr;
+}
+
+static void *memset_erms(void *addr, int value, size_t count) {
+    if(count < ERMS_THRESHOLD || count >= NT_THRESHOLD)
+        return memset_sse2(addr, value, count);
+
+    void *a = addr;
+    __asm__ __volatile__ ("rep stosb" : "+D" (a), "+c" (count) : "a" (value) : "memory");
+    return addr;
+}
+
+static void memops_init(void) {
+    uint32_t max, ebx = 0, ecx = 0, edx;
+    __asm__ __volatile__ ("cpuid" : "=a" (max), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (0));
+
+    // enhanced rep movsb/stosb (CPUID.(EAX=7,ECX=0):EBX[9])
+    int erms = 0;
+    if(max >= 7) {
+        __asm__ __volatile__ ("cpuid" : "=a" (max), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                              : "a" (7), "c" (0));
+        erms = (ebx >> 9) & 1;
+    }
+
+    // it doesn't matter if multiple threads do that concurrently
+    memcpy_impl = erms ? memcpy_erms : memcpy_sse2;
+    memset_impl = erms ? memset_erms : memset_sse2;
+}
+
+static void *memcpy_resolve(void *dest, const void *src, size_t len) {
+    memops_init();
+    return memcpy_impl(dest, src, len);
+}
+
+static void *memset_resolve(void *addr, int value, size_t count) {
+    memops_init();
+    return memset_impl(addr, value, count);
+}
+
+void* memcpy(void *dest, const void *src, size_t len) {
+    return memcpy_impl(dest, src, len);
+}
+
+void *memmove(void *dest, const void *src, size_t count) {
+    // nothing to do?
+    if((uchar*)dest == (uchar*)src || count == 0)
+        return dest;
+
+    // if dest is behind src and they overlap, we have to copy backwards
+    if((uintptr_t)dest > (uintptr_t)src && (uintptr_t)dest < (uintptr_t)src + count) {
+        uchar *d = (uchar*)dest;
+        const uchar *s = (const uchar*)src;
+        size_t vlen = count & ~(size_t)15;
+        size_t tail = count - vlen;
+        // first the bytes at the end, then the rest from the back to the front
+        while(tail-- > 0)
+            d[vlen + tail] = s[vlen + tail];
+        if(vlen > 0)
+            copy_sse2_backwards(d, s, vlen);
+    }
+    else
+        memcpy(dest, src, count);
+    return dest;
+}
+
+void *memset(void *addr, int value, size_t count) {
+    return memset_impl(addr, value, count);
+}
+
 size_t strlen(const char *src) {
     size_t len = 0;
     while(*src++)
@@ -224,8 +224,12 @@ void Child::release_regs() {
     ScopedLock<UserSm> guard(&_cm->_sm);
     for(auto it = _regs.begin(); it != _regs.end(); ++it) {
         DataSpaceDesc desc = it->desc();
-        if(it->cap() != ObjCap::INVALID && desc.type() != DataSpaceDesc::VIRTUAL)
-            _cm->_dsm.release(desc, it->cap());
+        if(it->cap() != ObjCap::INVALID && desc.type() != DataSpaceDesc::VIRTUAL) {
+            // if it was the last user of a shared segment, forget the segment
+            if(_cm->_dsm.release(desc, it->cap()))
+                _cm->release_segment(it->cap());
+            _cm->remove_user(it->cap(), this);
+        }
     }
 }
 
@@ -244,6 +248,7 @@ OStream & operator<<(OStream &os, const Child &c) {
         os << "\t\t" << it->name() << " on CPU " << CPU::get(it->cpu()).phys_id() << "\n";
     os << "\tGSIs: " << c.gsis() << "\n";
     os << "\tPorts:\n" << c.io();
+    os << "\tPagefaults: " << c.faults() << " (" << c.fault_pages() << " pages mapped)\n";
     os << c.reglist();
     os << "\n";
     return os;
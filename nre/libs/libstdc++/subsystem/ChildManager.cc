@@ -23,13 +23,15 @@
 #include <arch/Elf.h>
 #include <util/Math.h>
 #include <Logging.h>
+#include <Trace.h>
 #include <new>
 
 namespace nre {
 
 ChildManager::ChildManager()
-    : _next_id(0), _child_count(0), _childs(), _deleter(this), _dsm(), _registry(), _sm(),
-      _switchsm(), _slotsm(), _regsm(0), _diesm(0), _ecs(), _srvecs() {
+    : _next_id(0), _child_count(0), _childs(), _deleter(this), _dsm(), _segments(), _dsusers(),
+      _dsusersm(), _registry(), _sm(),
+      _switchlck(), _slotsm(), _regsm(0), _diesm(0), _ecs(), _srvecs() {
     _ecs = new Reference<LocalThread>[CPU::count()];
     _srvecs = new Reference<LocalThread>[CPU::count()];
     for(auto it = CPU::begin(); it != CPU::end(); ++it) {
@@ -169,7 +171,8 @@ void ChildManager::build_hip(Child *c, const ChildConfig &config) {
     c->reglist().add(ds.desc(), c->_hip, ChildMemory::R | ChildMemory::OWN, ds.unmapsel());
 }
 
-Child::id_type ChildManager::load(uintptr_t addr, size_t size, const ChildConfig &config) {
+Child::id_type ChildManager::load(uintptr_t addr, size_t size, const ChildConfig &config,
+                                  bool wait) {
     ElfEh *elf = reinterpret_cast<ElfEh*>(addr);
 
     // check ELF
@@ -270,14 +273,34 @@ Child::id_type ChildManager::load(uintptr_t addr, size_t size, const ChildConfig
                 perms |= ChildMemory::X;
 
             size_t dssize = Math::round_up<size_t>(ph->p_memsz, ExecEnv::PAGE_SIZE);
+            uintptr_t src = addr + ph->p_offset;
+            if(!(ph->p_flags & PF_W)) {
+                // the full pages of read-only segments are mapped directly from the ELF file.
+                // thus, they are shared between all instances of it.
+                size_t direct = 0;
+                if((src & (ExecEnv::PAGE_SIZE - 1)) == 0)
+                    direct = Math::round_dn<size_t>(ph->p_filesz, ExecEnv::PAGE_SIZE);
+                if(direct > 0) {
+                    c->reglist().add(DataSpaceDesc(direct, DataSpaceDesc::ANONYMOUS, 0, 0, src),
+                                     ph->p_vaddr, perms & ~ChildMemory::OWN);
+                }
+                // the rest is copied once and shared as well. this way, the child doesn't see
+                // the bytes behind the segment in the file
+                if(direct < dssize) {
+                    const DataSpace &ds = shared_segment(src + direct, ph->p_filesz - direct,
+                                                         dssize - direct);
+                    c->reglist().add(ds.desc(), ph->p_vaddr + direct, perms, ds.unmapsel());
+                }
+                continue;
+            }
+
+            // for all others, we create a dataspace that is filled on demand in the pagefault
+            // handler
             // TODO leak, if reglist().add throws
             const DataSpace &ds = _dsm.create(
                 DataSpaceDesc(dssize, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RWX));
-            // TODO actually it would be better to do that later
-            memcpy(reinterpret_cast<void*>(ds.virt()),
-                   reinterpret_cast<void*>(addr + ph->p_offset), ph->p_filesz);
-            memset(reinterpret_cast<void*>(ds.virt() + ph->p_filesz), 0, ph->p_memsz - ph->p_filesz);
-            c->reglist().add(ds.desc(), ph->p_vaddr, perms, ds.unmapsel());
+            ChildMemory::DS *cds = c->reglist().add(ds.desc(), ph->p_vaddr, perms, ds.unmapsel());
+            cds->load_from(src, ph->p_filesz);
         }
 
         // utcb
@@ -316,17 +339,9 @@ Child::id_type ChildManager::load(uintptr_t addr, size_t size, const ChildConfig
     Atomic::add(&_child_count, +1);
 
     // wait until all services are registered
-    if(config.waits() > 0) {
-        size_t services_present;
-        do {
-            _regsm.down();
-            services_present = 0;
-            for(size_t i = 0; i < config.waits(); ++i) {
-                if(_registry.find(config.wait(i)))
-                    services_present++;
-            }
-        }
-        while(services_present < config.waits());
+    if(wait) {
+        for(size_t i = 0; i < config.waits(); ++i)
+            wait_for_service(config.wait(i));
     }
     return c->id();
 }
@@ -630,6 +645,80 @@ void ChildManager::Portals::sc(Child *c) {
     }
 }
 
+const DataSpace &ChildManager::shared_segment(uintptr_t src, size_t filesz, size_t size) {
+    ScopedLock<UserSm> guard(&_sm);
+    for(auto it = _segments.begin(); it != _segments.end(); ++it) {
+        if(it->src == src && it->filesz == filesz && it->size == size)
+            return _dsm.join(it->sel);
+    }
+
+    const DataSpace &ds = _dsm.create(
+        DataSpaceDesc(size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RWX));
+    memcpy(reinterpret_cast<void*>(ds.virt()), reinterpret_cast<void*>(src), filesz);
+    memset(reinterpret_cast<void*>(ds.virt() + filesz), 0, size - filesz);
+    _segments.append(new SharedSegment(src, filesz, size, ds));
+    return ds;
+}
+
+void ChildManager::release_segment(capsel_t unmapsel) {
+    for(auto it = _segments.begin(); it != _segments.end(); ++it) {
+        if(it->unmapsel == unmapsel) {
+            SharedSegment *seg = &*it;
+            _segments.remove(seg);
+            delete seg;
+            break;
+        }
+    }
+}
+
+void ChildManager::add_user(capsel_t unmapsel, Child *c) {
+    ScopedLock<UserSm> guard(&_dsusersm);
+    DSUsers *ds = _dsusers.find(unmapsel);
+    if(!ds) {
+        ds = new DSUsers(unmapsel);
+        _dsusers.insert(ds);
+    }
+    for(auto it = ds->users.begin(); it != ds->users.end(); ++it) {
+        if(it->child == c->id()) {
+            it->count++;
+            return;
+        }
+    }
+    ds->users.append(new DSUser(c->id()));
+}
+
+void ChildManager::remove_user(capsel_t unmapsel, Child *c) {
+    ScopedLock<UserSm> guard(&_dsusersm);
+    DSUsers *ds = _dsusers.find(unmapsel);
+    if(!ds)
+        return;
+    for(auto it = ds->users.begin(); it != ds->users.end(); ++it) {
+        if(it->child == c->id()) {
+            if(--it->count == 0) {
+                DSUser *u = &*it;
+                ds->users.remove(u);
+                delete u;
+            }
+            break;
+        }
+    }
+    if(ds->users.length() == 0) {
+        _dsusers.remove(ds);
+        delete ds;
+    }
+}
+
+size_t ChildManager::get_users(capsel_t unmapsel, Child::id_type *ids, size_t max) {
+    ScopedLock<UserSm> guard(&_dsusersm);
+    DSUsers *ds = _dsusers.find(unmapsel);
+    if(!ds)
+        return 0;
+    size_t count = 0;
+    for(auto it = ds->users.begin(); it != ds->users.end() && count < max; ++it)
+        ids[count++] = it->child;
+    return ds->users.length();
+}
+
 void ChildManager::map(UtcbFrameRef &uf, Child *c, DataSpace::RequestType type) {
     Crd crd(0);
     DataSpaceDesc desc;
@@ -669,6 +758,7 @@ void ChildManager::map(UtcbFrameRef &uf, Child *c, DataSpace::RequestType type)
             size_t align = 1 << (ds.desc().align() + ExecEnv::PAGE_SHIFT);
             addr = c->reglist().find_free(ds.size(), align);
             c->reglist().add(ds.desc(), addr, flags, ds.unmapsel());
+            add_user(ds.unmapsel(), c);
         }
         catch(...) {
             _dsm.release(desc, ds.unmapsel());
@@ -707,7 +797,7 @@ void ChildManager::switch_to(UtcbFrameRef &uf, Child *c) {
         // note that we need another lock here since it may also involve childs of c (c may have
         // delegated it and if they cause a pagefault during this operation, we might get mixed
         // results)
-        ScopedLock<UserSm> guard_switch(&_switchsm);
+        ScopedLock<SwitchLock> guard_switch(&_switchlck);
 
         uintptr_t srcorg, dstorg;
         {
@@ -743,26 +833,44 @@ void ChildManager::switch_to(UtcbFrameRef &uf, Child *c) {
             src->swap_backend(dst);
         }
 
-        // now change the mapping for all other childs that have one of these dataspaces
+        // now change the mapping for all other childs that have one of these dataspaces. we use
+        // the reverse index to find them and grab references to those that are still alive, so
+        // that we don't need to hold _sm while changing their regions.
         {
-            ScopedLock<UserSm> guard_childs(&_sm);
-            for(auto it = _childs.begin(); it != _childs.end(); ++it) {
-                if(&*it == c)
-                    continue;
+            size_t total = get_users(srcsel, nullptr, 0) + get_users(dstsel, nullptr, 0);
+            Child::id_type *ids = new Child::id_type[total];
+            size_t count = Math::min(get_users(srcsel, ids, total), total);
+            count += Math::min(get_users(dstsel, ids + count, total - count), total - count);
 
-                ScopedLock<UserSm> guard_regs(&it->_sm);
-                DataSpaceDesc dummy;
-                ChildMemory::DS *src, *dst;
-                src = it->reglist().find(srcsel);
-                dst = it->reglist().find(dstsel);
-                if(!src && !dst)
-                    continue;
+            Reference<Child> *childs = new Reference<Child>[count];
+            size_t n = 0;
+            {
+                ScopedLock<UserSm> guard_childs(&_sm);
+                for(size_t i = 0; i < count; ++i) {
+                    Child *ch = _childs.find(ids[i]);
+                    if(!ch || ch == c)
+                        continue;
+                    // a child might use both dataspaces
+                    size_t j;
+                    for(j = 0; j < n && &*childs[j] != ch; ++j)
+                        ;
+                    if(j == n)
+                        childs[n++] = Reference<Child>(ch);
+                }
+            }
 
+            for(size_t i = 0; i < n; ++i) {
+                ScopedLock<UserSm> guard_regs(&childs[i]->_sm);
+                ChildMemory::DS *src, *dst;
+                src = childs[i]->reglist().find(srcsel);
+                dst = childs[i]->reglist().find(dstsel);
                 if(src)
                     src->switch_to(dstorg);
                 if(dst)
                     dst->switch_to(srcorg);
             }
+            delete[] childs;
+            delete[] ids;
         }
 
         // now swap the origins also in the dataspace-manager (otherwise clients that join
@@ -792,6 +900,7 @@ void ChildManager::unmap(UtcbFrameRef &uf, Child *c) {
         // destroy (decrease refs) the ds
         _dsm.release(desc, sel);
         c->reglist().remove(sel);
+        remove_user(sel, c);
     }
     uf << E_SUCCESS;
 }
@@ -842,8 +951,14 @@ void ChildManager::Portals::ex_pf(Child *c) {
         return;
     }
 
+    // pagefaults of different childs are handled in parallel. the ones of the same child are
+    // serialized by its semaphore, because unmap() and term_thread() release dataspaces while
+    // holding it. that is, we have to hold it until we're done with the memory of the dataspace.
+    TRACE(PFS, PF_BEGIN, pfaddr, eip);
+    size_t mapped = 0;
+    Atomic::add(&c->_faults, +1);
+    cm->_switchlck.enter();
     try {
-        ScopedLock<UserSm> guard_switch(&cm->_switchsm);
         ScopedLock<UserSm> guard_regs(&c->_sm);
 
         LOG(PFS, "Child '" << c->cmdline() << "': Pagefault for " << fmt(pfaddr, "p")
@@ -889,15 +1004,19 @@ void ChildManager::Portals::ex_pf(Child *c) {
         }
 
         if(!kill && (remap || !flags)) {
-            // try to map the next few pages
-            size_t pages = 32;
+            // try to map the next few pages, depending on the access pattern
+            size_t pages;
             if(ds->desc().flags() & DataSpaceDesc::BIGPAGES) {
-                // try to map the whole pagetable at once
-                pages = ExecEnv::PT_ENTRY_COUNT;
                 // take care that we start at the beginning (note that this assumes that it is
                 // properly aligned, which is made sure by root. otherwise we might leave the ds
                 pfpage &= ~(ExecEnv::BIG_PAGE_SIZE - 1);
+                // map whole pagetables at once. the window counts big pages in this case, starting
+                // with one for the minimum window
+                size_t window = ds->fault_window(pfpage) / ChildMemory::DS::MIN_WINDOW;
+                pages = window * ExecEnv::PT_ENTRY_COUNT;
             }
+            else
+                pages = ds->fault_window(pfpage);
 
             // build CapRange
             uintptr_t src = ds->origin(pfpage);
@@ -906,6 +1025,10 @@ void ChildManager::Portals::ex_pf(Child *c) {
             // ensure that it fits into the utcb
             cr.limit_to(uf.free_typed());
             cr.count(ds->page_perms(pfpage, cr.count(), perms));
+            ds->load(pfpage, cr.count());
+            ds->faulted(pfpage, cr.count());
+            Atomic::add(&c->_fault_pages, cr.count());
+            mapped = cr.count();
             uf.delegate(cr);
 
             // ensure that we have the memory (if we're a subsystem this might not be true)
@@ -918,6 +1041,8 @@ void ChildManager::Portals::ex_pf(Child *c) {
     catch(...) {
         kill = true;
     }
+    cm->_switchlck.leave();
+    TRACE(PFS, PF_END, mapped, kill);
 
     // we can't release the lock after having killed the child. thus, we do out here (it's save
     // because there can't be any running Ecs anyway since we only destroy it when there are no
@@ -1054,6 +1179,9 @@ void ChildManager::kill_child(Child *c, int vector, UtcbExcFrameRef &uf, ExitTyp
                          << ", rfl=" << fmt(uf->rfl, "#0x", 16) << "\n");
             LOG(CHILD_KILL, c->reglist());
             LOG(CHILD_KILL, "Unable to resolve fault; killing child\n");
+            // the events that lead to the fault are probably interesting as well. but only the
+            // latest ones, because we block the fault handling while writing to the serial line
+            Trace::dump(Serial::get(), KILL_TRACE_RECORDS);
         }
         // if its a thread exit, free stack and utcb
         else if(type == THREAD_EXIT)
@@ -26,6 +26,19 @@ const ServiceRegistry::Service* ServiceRegistry::reg(Child *child, const String
         VTHROW(ServiceRegistryException, E_EXISTS, "Service '" << name << "' does already exist");
     Service *s = new Service(child, name, pts, count, available);
     _srvs.append(s);
+    size_t idx = hash(name);
+    s->_hnext = _buckets[idx];
+    _buckets[idx] = s;
+
+    // wake up the ones that wait for this service
+    SList<Waiter> &waiters = _waiters[idx];
+    for(auto it = waiters.begin(); it != waiters.end(); ) {
+        Waiter *w = &*it++;
+        if(w->_name == name) {
+            waiters.remove(w);
+            w->_sm.up();
+        }
+    }
     return s;
 }
 
@@ -37,8 +50,16 @@ void ServiceRegistry::unreg(Child *child, const String &name) {
         VTHROW(ServiceRegistryException, E_NOT_FOUND,
                "Child '" << child->cmdline() << "' does not own service '" << name << "'");
     }
-    _srvs.remove(s);
+    unlink(s);
     delete s;
 }
 
+void ServiceRegistry::unlink(Service *s) {
+    _srvs.remove(s);
+    Service **p = _buckets + hash(s->name());
+    while(*p != s)
+        p = &(*p)->_hnext;
+    *p = s->_hnext;
+}
+
 }
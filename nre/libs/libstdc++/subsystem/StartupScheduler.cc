@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <subsystem/StartupScheduler.h>
+#include <Logging.h>
+
+namespace nre {
+
+bool StartupScheduler::startable(const Entry &e) const {
+    if(e._config->deps_given()) {
+        for(size_t i = 0; i < e._config->deps(); ++i) {
+            if(!_mng.registry().find(e._config->dep(i)))
+                return false;
+        }
+        return true;
+    }
+
+    // without explicit dependencies, we have to wait for all childs in front of it
+    for(auto it = _entries.cbegin(); it != _entries.cend() && &*it != &e; ++it) {
+        if(!it->_ready)
+            return false;
+    }
+    return true;
+}
+
+bool StartupScheduler::provided(const Entry &e) const {
+    for(size_t i = 0; i < e._config->waits(); ++i) {
+        if(!_mng.registry().find(e._config->wait(i)))
+            return false;
+    }
+    return true;
+}
+
+void StartupScheduler::start(Entry &e) {
+    e._id = _mng.load(e._addr, e._size, *e._config, false);
+    e._started = true;
+    e._start_time = elapsed();
+    LOG(CHILD_CREATE, "Started child '" << e._config->cmdline() << "' after "
+                                        << e._start_time << " us\n");
+}
+
+void StartupScheduler::run() {
+    _begin = _clock.source_time();
+    size_t unready = _entries.length();
+    while(unready > 0) {
+        bool waiting = false;
+        for(auto it = _entries.begin(); it != _entries.end(); ++it) {
+            if(!it->_started && startable(*it))
+                start(*it);
+            if(it->_started && !it->_ready) {
+                if(provided(*it)) {
+                    it->_ready = true;
+                    it->_ready_time = elapsed();
+                    unready--;
+                    LOG(CHILD_CREATE, "Child '" << it->_config->cmdline() << "' is ready after "
+                                                << it->_ready_time << " us\n");
+                }
+                else
+                    waiting = true;
+            }
+        }
+        if(unready == 0)
+            break;
+
+        // if nobody is about to register a service, we would wait forever. thus, start the first
+        // child that is left and hope that the dependencies will be satisfied by somebody else.
+        if(!waiting) {
+            for(auto it = _entries.begin(); it != _entries.end(); ++it) {
+                if(!it->_started) {
+                    LOG(CHILD_CREATE, "Dependencies of child '" << it->_config->cmdline()
+                                                                << "' can't be satisfied\n");
+                    start(*it);
+                    break;
+                }
+            }
+            continue;
+        }
+
+        // wait until the next service is registered
+        _mng.reg_sm().down();
+    }
+}
+
+}
@@ -19,7 +19,15 @@
 
 namespace nre {
 
-Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
+uint PCI::msix_vectors(BDF bdf) {
+    size_t msix_offset = find_cap(bdf, CAP_MSIX);
+    if(!msix_offset)
+        return 0;
+    // the table size is encoded as N-1 in the message control register
+    return ((conf_read(bdf, msix_offset) >> 16) & 0x7FF) + 1;
+}
+
+Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table, cpu_t cpu) {
     size_t msix_offset = find_cap(bdf, CAP_MSIX);
     size_t msi_offset = find_cap(bdf, CAP_MSI);
     if(!(msix_offset || msi_offset))
@@ -33,7 +41,7 @@ Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
     DataSpace devds(ExecEnv::PAGE_SIZE, DataSpaceDesc::LOCKED, DataSpaceDesc::R, phys_addr);
 
     // create GSI
-    Gsi *gsi = new Gsi(reinterpret_cast<void*>(devds.virt()), CPU::current().log_id());
+    Gsi *gsi = new Gsi(reinterpret_cast<void*>(devds.virt()), cpu);
     if(!gsi->msi_addr())
         throw PCIException(E_FAILURE, "Attach to MSI failed - IRQs may be broken!");
 
@@ -43,7 +51,8 @@ Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
             value_type table_offset = conf_read(bdf, msix_offset + 1);
             uintptr_t base = bar_base(bdf, BAR0 + (table_offset & 0x7)) + (table_offset & ~0x7u);
             uintptr_t start = Math::round_dn<uintptr_t>(base, ExecEnv::PAGE_SIZE);
-            uintptr_t end = Math::round_up<uintptr_t>(base + ExecEnv::PAGE_SIZE, ExecEnv::PAGE_SIZE);
+            // each entry has 16 bytes; make sure that the nr-th one is mapped as well
+            uintptr_t end = Math::round_up<uintptr_t>(base + (nr + 1) * 16, ExecEnv::PAGE_SIZE);
             DataSpace msixbar(end - start, DataSpaceDesc::LOCKED, DataSpaceDesc::RW, start);
             msix_table = reinterpret_cast<void*>(msixbar.virt() + (base & (ExecEnv::PAGE_SIZE - 1)));
             init_msix_table(msix_table, bdf, msix_offset, nr, gsi);
@@ -66,10 +75,10 @@ Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
     return gsi;
 }
 
-Gsi *PCI::get_gsi(BDF bdf, uint nr, bool /*level*/, void *msix_table) {
+Gsi *PCI::get_gsi(BDF bdf, uint nr, bool /*level*/, void *msix_table, cpu_t cpu) {
     // If the device is MSI or MSI-X capable, don't use legacy interrupts.
     if(find_cap(bdf, CAP_MSIX) || find_cap(bdf, CAP_MSI)) {
-        Gsi *gsi = get_gsi_msi(bdf, nr, msix_table);
+        Gsi *gsi = get_gsi_msi(bdf, nr, msix_table, cpu);
         // fall back to legacy interrupts, if it failed
         if(gsi)
             return gsi;
@@ -92,7 +101,7 @@ Gsi *PCI::get_gsi(BDF bdf, uint nr, bool /*level*/, void *msix_table) {
         // No clue which GSI is triggered - fall back to PIC irq
         gsi = conf_read(bdf, 0xf) & 0xff;
     }
-    return new Gsi(gsi, CPU::current().log_id());
+    return new Gsi(gsi, cpu);
 }
 
 size_t PCI::find_cap(BDF bdf, cap_type id) {
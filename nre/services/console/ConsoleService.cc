@@ -55,7 +55,7 @@ void ConsoleService::create_dummy(uint page, const String &title) {
     ConsoleSessionData *sess = static_cast<ConsoleSessionData*>(new_session(args.str()));
     DataSpace *ds = new DataSpace(ExecEnv::PAGE_SIZE * VGAScreen::PAGES, DataSpaceDesc::ANONYMOUS,
                                   DataSpaceDesc::RW);
-    sess->create(nullptr, ds, 0);
+    sess->create(nullptr, ds, nullptr, 0);
     sess->set_page(page);
     memset(reinterpret_cast<void*>(ds->virt()), 0, ExecEnv::PAGE_SIZE * VGAScreen::PAGES);
     memcpy(reinterpret_cast<void*>(ds->virt() + sess->offset()),
@@ -19,12 +19,13 @@
 
 using namespace nre;
 
-void ConsoleSessionData::create(DataSpace *in_ds, DataSpace *out_ds, Sm *sm) {
+void ConsoleSessionData::create(DataSpace *in_ds, DataSpace *out_ds, DataSpace *dirty_ds, Sm *sm) {
     ScopedLock<UserSm> guard(&_sm);
     if(_in_ds != nullptr)
         throw Exception(E_EXISTS, "Console session already initialized");
     _in_ds = in_ds;
     _out_ds = out_ds;
+    _dirty_ds = dirty_ds;
     _in_sm = sm;
     if(_in_ds)
         _prod = new Producer<Console::ReceivePacket>(*in_ds, *sm, false);
@@ -32,21 +33,74 @@ void ConsoleSessionData::create(DataSpace *in_ds, DataSpace *out_ds, Sm *sm) {
     _srv->session_ready(this);
 }
 
-void ConsoleSessionData::change_mode(nre::DataSpace *out_ds, size_t mode) {
+void ConsoleSessionData::change_mode(nre::DataSpace *out_ds, nre::DataSpace *dirty_ds, size_t mode) {
     ScopedLock<UserSm> guard(&_sm);
     if(!_srv->is_valid_mode(mode))
         VTHROW(Exception, E_ARGS_INVALID, "Mode " << mode << " does not exist");
     _mode = mode;
     delete _out_ds;
+    delete _dirty_ds;
     delete _screen;
     _out_ds = out_ds;
+    _dirty_ds = dirty_ds;
     _screen = _srv->create_screen(_mode, _out_ds->size());
+    _invalid = true;
     if(_has_screen) {
         activate();
         swap();
     }
 }
 
+static word_t take_bits(volatile word_t *word) {
+    word_t bits;
+    do
+        bits = *word;
+    while(bits && !Atomic::cmpnswap(word, bits, static_cast<word_t>(0)));
+    return bits;
+}
+
+bool ConsoleSessionData::refresh(bool all) {
+    typedef Console::DirtyMap map_type;
+    if(!_out_ds)
+        return false;
+
+    all |= _invalid;
+    _invalid = false;
+    const char *src = reinterpret_cast<const char*>(_out_ds->virt());
+    size_t size = _out_ds->size();
+    map_type *map = _dirty_ds ? reinterpret_cast<map_type*>(_dirty_ds->virt()) : nullptr;
+    size_t words = map ? map_type::words_in(_dirty_ds->size()) : 0;
+    if(all || !map || !map->tracking) {
+        // forget the changes so far; we're copying everything anyway
+        for(size_t i = 0; i < words; ++i)
+            take_bits(map->bits + i);
+        _screen->refresh(src, size, 0, size);
+        return all;
+    }
+
+    // copy all runs of changed chunks; if nothing changed, we don't touch the screen at all
+    size_t start = 0, run = 0;
+    for(size_t i = 0; i < words; ++i) {
+        word_t bits = take_bits(map->bits + i);
+        if(!bits && !run)
+            continue;
+        for(size_t b = 0; b < map_type::WORD_BITS; ++b) {
+            if(bits & (static_cast<word_t>(1) << b)) {
+                if(run++ == 0)
+                    start = i * map_type::WORD_BITS + b;
+            }
+            else if(run) {
+                _screen->refresh(src, size, start << map_type::CHUNK_SHIFT,
+                                 run << map_type::CHUNK_SHIFT);
+                run = 0;
+            }
+        }
+    }
+    if(run)
+        _screen->refresh(src, size, start << map_type::CHUNK_SHIFT, run << map_type::CHUNK_SHIFT);
+    return false;
+}
+
 void ConsoleSessionData::portal(ConsoleSessionData *sess) {
     UtcbFrameRef uf;
     try {
@@ -57,9 +111,11 @@ void ConsoleSessionData::portal(ConsoleSessionData *sess) {
                 capsel_t insel = uf.get_delegated(0).offset();
                 capsel_t outsel = uf.get_delegated(0).offset();
                 capsel_t smsel = uf.get_delegated(0).offset();
+                capsel_t dirtysel = uf.get_delegated(0).offset();
                 uf.finish_input();
 
-                sess->create(new DataSpace(insel), new DataSpace(outsel), new Sm(smsel, false));
+                sess->create(new DataSpace(insel), new DataSpace(outsel), new DataSpace(dirtysel),
+                             new Sm(smsel, false));
                 uf.accept_delegates();
                 uf << E_SUCCESS;
             }
@@ -67,11 +123,12 @@ void ConsoleSessionData::portal(ConsoleSessionData *sess) {
 
             case Console::SET_MODE: {
                 capsel_t outsel = uf.get_delegated(0).offset();
+                capsel_t dirtysel = uf.get_delegated(0).offset();
                 size_t mode;
                 uf >> mode;
                 uf.finish_input();
 
-                sess->change_mode(new DataSpace(outsel), mode);
+                sess->change_mode(new DataSpace(outsel), new DataSpace(dirtysel), mode);
                 uf.accept_delegates();
                 uf << E_SUCCESS;
             }
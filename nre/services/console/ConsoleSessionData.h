@@ -28,7 +28,8 @@ public:
     ConsoleSessionData(ConsoleService *srv, size_t id, portal_func func,
                        size_t con, size_t mode, const nre::String &title)
         : ServiceSession(srv, id, func), DListItem(), _has_screen(false), _console(con), _mode(mode),
-          _screen(), _title(title), _sm(), _in_ds(), _out_ds(), _in_sm(), _prod(), _regs(), _srv(srv) {
+          _screen(), _title(title), _sm(), _in_ds(), _out_ds(), _dirty_ds(), _in_sm(), _prod(),
+          _regs(), _invalid(true), _srv(srv) {
         _regs.offset = nre::VGAStream::TEXT_OFF >> 1;
         _regs.mode = 0;
         _regs.cursor_pos = (nre::VGAStream::ROWS - 1) * nre::VGAStream::COLS + (nre::VGAStream::TEXT_OFF >> 1);
@@ -39,6 +40,7 @@ public:
         delete _in_ds;
         delete _in_sm;
         delete _out_ds;
+        delete _dirty_ds;
         delete _screen;
     }
 
@@ -74,8 +76,18 @@ public:
         return _out_ds;
     }
 
-    void create(nre::DataSpace *in_ds, nre::DataSpace *out_ds, nre::Sm *sm);
-    void change_mode(nre::DataSpace *out_ds, size_t mode);
+    void create(nre::DataSpace *in_ds, nre::DataSpace *out_ds, nre::DataSpace *dirty_ds,
+                nre::Sm *sm);
+    void change_mode(nre::DataSpace *out_ds, nre::DataSpace *dirty_ds, size_t mode);
+
+    /**
+     * Copies the changed parts of the out-dataspace to the screen. If the client does not track
+     * its changes, everything is copied.
+     *
+     * @param all whether everything should be copied in any case
+     * @return true if the screen has been set up from scratch, i.e. the tag has to be drawn
+     */
+    bool refresh(bool all);
 
     void to_front() {
         if(!_has_screen) {
@@ -129,8 +141,11 @@ private:
     nre::UserSm _sm;
     nre::DataSpace *_in_ds;
     nre::DataSpace *_out_ds;
+    nre::DataSpace *_dirty_ds;
     nre::Sm *_in_sm;
     nre::Producer<nre::Console::ReceivePacket> *_prod;
     nre::Console::Register _regs;
+    // whether the screen has to be set up from scratch on the next refresh
+    bool _invalid;
     ConsoleService *_srv;
 };
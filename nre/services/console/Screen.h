@@ -29,6 +29,15 @@ public:
 
     virtual nre::DataSpace &mem() = 0;
     virtual void set_regs(const nre::Console::Register &regs, bool force) = 0;
-    virtual void refresh(const char *src, size_t size) = 0;
+    /**
+     * Copies the range <off>..<off>+<len> of <src> to the screen, as far as it is visible and
+     * does not belong to the tag.
+     *
+     * @param src the buffer of the session
+     * @param size the size of the buffer
+     * @param off the offset of the range in the buffer
+     * @param len the length of the range
+     */
+    virtual void refresh(const char *src, size_t size, size_t off, size_t len) = 0;
     virtual void write_tag(const char *tag, size_t len, uint8_t color) = 0;
 };
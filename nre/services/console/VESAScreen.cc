@@ -58,11 +58,15 @@ void VESAScreen::write_tag(const char *tag, size_t len, uint8_t color) {
     }
 }
 
-void VESAScreen::refresh(const char *src, size_t size) {
-    size_t firstline = _info.resolution[0] * FONT_HEIGHT * (_info.bpp / 8);
-    size_t len = nre::Math::min<size_t>(size,
+void VESAScreen::refresh(const char *src, size_t size, size_t off, size_t len) {
+    // leave the first line alone, because it contains the tag
+    size_t start = _info.resolution[0] * FONT_HEIGHT * (_info.bpp / 8);
+    size_t end = nre::Math::min<size_t>(size,
             _info.resolution[0] * _info.resolution[1] * (_info.bpp / 8));
-    memcpy(reinterpret_cast<void*>(_ds.virt() + firstline), src + firstline, len - firstline);
+    start = nre::Math::max(start, off);
+    end = nre::Math::min(end, off + len);
+    if(start < end)
+        memcpy(reinterpret_cast<void*>(_ds.virt() + start), src + start, end - start);
 }
 
 void VESAScreen::draw_char(unsigned xoff, unsigned yoff, char c, uint8_t color) {
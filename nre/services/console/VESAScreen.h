@@ -37,7 +37,7 @@ public:
     }
     virtual void set_regs(const nre::Console::Register &, bool);
     virtual void write_tag(const char *tag, size_t len, uint8_t color);
-    virtual void refresh(const char *src, size_t size);
+    virtual void refresh(const char *src, size_t size, size_t off, size_t len);
 
 private:
     void draw_char(unsigned x, unsigned y, char c, uint8_t color);
@@ -47,8 +47,12 @@ void VGAScreen::write_tag(const char *tag, size_t len, uint8_t color) {
     }
 }
 
-void VGAScreen::refresh(const char *src, size_t size) {
-    size_t offset = _last.offset << 1;
-    memcpy(reinterpret_cast<void*>(_ds.virt() + offset + COLS * 2),
-           src + offset + COLS * 2, nre::Math::min<size_t>(size, SIZE - COLS * 2));
+void VGAScreen::refresh(const char *src, size_t size, size_t off, size_t len) {
+    // leave the first line alone, because it contains the tag
+    size_t start = (_last.offset << 1) + COLS * 2;
+    size_t end = start + nre::Math::min<size_t>(size, SIZE - COLS * 2);
+    start = nre::Math::max(start, off);
+    end = nre::Math::min(end, off + len);
+    if(start < end)
+        memcpy(reinterpret_cast<void*>(_ds.virt() + start), src + start, end - start);
 }
@@ -60,7 +60,7 @@ public:
     }
     virtual void set_regs(const nre::Console::Register &regs, bool force);
     virtual void write_tag(const char *tag, size_t len, uint8_t color);
-    virtual void refresh(const char *src, size_t size);
+    virtual void refresh(const char *src, size_t size, size_t off, size_t len);
 
 private:
     void write(Register reg, uint8_t val) {
@@ -51,6 +51,7 @@ void ViewSwitcher::switch_thread(void*) {
     TimerSession timer("timer");
     timevalue_t until = 0;
     size_t sessid = 0;
+    bool all = false;
     while(1) {
         // are we finished?
         if(until && clock.source_time() >= until) {
@@ -94,6 +95,7 @@ void ViewSwitcher::switch_thread(void*) {
                 // just ignore it
             }
             sessid = cmd->sessid;
+            all = true;
             // show the tag for 1sec
             until = clock.source_time(SWITCH_TIME);
             vs->_cons.next();
@@ -103,19 +105,20 @@ void ViewSwitcher::switch_thread(void*) {
             Reference<ConsoleSessionData> sess = vs->_srv->get_session<ConsoleSessionData>(sessid);
             ScopedLock<UserSm> guard(&sess->sm());
 
-            // repaint all lines from the buffer except the first
-            Screen *screen = sess->screen();
-            if(sess->out_ds())
-                screen->refresh(reinterpret_cast<char*>(sess->out_ds()->virt()), sess->out_ds()->size());
+            // repaint the lines from the buffer that have changed, except the first
+            bool fresh = sess->refresh(all);
+            all = false;
 
-            // write tag into buffer
-            memset(_buffer, 0, sizeof(_buffer));
-            OStringStream os(_buffer, sizeof(_buffer));
-            os << "Console " << sess->console() << ": " << sess->title() << " (" <<
-            sess->id() << ")";
+            if(fresh) {
+                // write tag into buffer
+                memset(_buffer, 0, sizeof(_buffer));
+                OStringStream os(_buffer, sizeof(_buffer));
+                os << "Console " << sess->console() << ": " << sess->title() << " (" <<
+                sess->id() << ")";
 
-            // write console tag
-            screen->write_tag(_buffer, os.length(), COLOR);
+                // write console tag
+                sess->screen()->write_tag(_buffer, os.length(), COLOR);
+            }
         }
         catch(const Exception &e) {
             LOG(CONSOLE, e);
@@ -16,7 +16,13 @@
 
 #include <ipc/Service.h>
 #include <stream/Serial.h>
+#include <kobj/GlobalThread.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
+#include <util/Math.h>
 #include <String.h>
+#include <CPU.h>
+#include <cstring>
 
 #include "VirtualMemory.h"
 #include "Hypervisor.h"
@@ -44,7 +50,8 @@ Ports::port_t Log::get_com1_base() {
     return base;
 }
 
-Log::Log() : BaseSerial(), _ports(get_com1_base(), 6), _sm(1), _ready(true) {
+Log::Log() : BaseSerial(), _ports(get_com1_base(), 6), _sm(1), _ready(true), _rings(),
+              _waiting(), _drainsm() {
     _ports.out<uint8_t>(0x80, LCR);          // Enable DLAB (set baud rate divisor)
     _ports.out<uint8_t>(0x01, DLR_LO);       // Set divisor to 1 (lo byte) 115200 baud
     _ports.out<uint8_t>(0x00, DLR_HI);       //                  (hi byte)
@@ -55,12 +62,90 @@ Log::Log() : BaseSerial(), _ports(get_com1_base(), 6), _sm(1), _ready(true) {
 }
 
 void Log::start() {
+    _drainsm = new Sm(0);
+    Ring *rings = new Ring[CPU::count()]();
+    Sync::memory_barrier();
+    _rings = rings;
+    GlobalThread::create(drain_thread, CPU::current().log_id(), "root-logdrain")->start();
+
     _srv = new LogService("log");
     _srv->start();
 }
 
+void Log::enqueue(const char *name, uint sessid, const char *line, size_t len) {
+    // there is one service thread per CPU, so that we are the only producer for this ring
+    Ring &r = _rings[CPU::current().log_id()];
+    size_t pos = r.wpos;
+    if(pos - r.rpos == RING_SIZE) {
+        r.dropped++;
+        return;
+    }
+
+    Line &l = r.lines[pos % RING_SIZE];
+    l.sessid = sessid;
+    l.len = Math::min(len, MAX_LINE_LEN);
+    size_t i;
+    for(i = 0; i < NAME_LEN && name[i]; ++i)
+        l.name[i] = name[i];
+    l.name[i] = '\0';
+    memcpy(l.text, line, l.len);
+    Sync::memory_barrier();
+    r.wpos = pos + 1;
+
+    // the line has to be visible before we look at the flag
+    Sync::memory_fence();
+    if(_waiting && Atomic::cmpnswap(&_waiting, static_cast<size_t>(1), static_cast<size_t>(0)))
+        _drainsm->up();
+}
+
+size_t Log::drain() {
+    size_t count = 0;
+    ScopedLock<UserSm> guard(&_sm);
+    for(cpu_t cpu = 0; cpu < CPU::count(); ++cpu) {
+        Ring &r = _rings[cpu];
+        for(size_t pos = r.rpos; pos != r.wpos; ++pos, ++count) {
+            Line &l = r.lines[pos % RING_SIZE];
+            write_line(l.name, l.sessid, l.text, l.len);
+            Sync::memory_barrier();
+            r.rpos = pos + 1;
+        }
+        size_t dropped = r.dropped;
+        if(dropped != r.reported) {
+            *this << "\e[0;31m[log] dropped " << (dropped - r.reported) << " lines on CPU "
+                  << CPU::get(cpu).phys_id() << "\e[0m\n";
+            r.reported = dropped;
+        }
+    }
+    return count;
+}
+
+void Log::drain_thread(void*) {
+    Log &log = Log::get();
+    while(1) {
+        if(log.drain() > 0)
+            continue;
+
+        // announce that we're going to block and check again afterwards, so that we don't miss a
+        // line that has been put into the ring before the producer saw the flag
+        log._waiting = 1;
+        Sync::memory_fence();
+        bool empty = true;
+        for(cpu_t cpu = 0; empty && cpu < CPU::count(); ++cpu)
+            empty = log._rings[cpu].rpos == log._rings[cpu].wpos;
+        if(!empty) {
+            log._waiting = 0;
+            continue;
+        }
+        log._drainsm->zero();
+    }
+}
+
 void Log::write(const char *name, uint sessid, const char *line, size_t len) {
     ScopedLock<UserSm> guard(&_sm);
+    write_line(name, sessid, line, len);
+}
+
+void Log::write_line(const char *name, uint sessid, const char *line, size_t len) {
     *this << "\e[0;" << _colors[sessid % ARRAY_SIZE(_colors)] << "m[" << fmt(name, 8, 8) << "] ";
     for(size_t i = 0; i < len; ++i) {
         char c = line[i];
@@ -77,7 +162,7 @@ void Log::LogService::portal(LogServiceSession *sess) {
         uf >> line;
         uf.finish_input();
 
-        Log::get().write(sess->name().str(), sess->id() + 1, line.str(), line.length());
+        Log::get().enqueue(sess->name().str(), sess->id() + 1, line.str(), line.length());
         uf << E_SUCCESS;
     }
     catch(const Exception &e) {
@@ -21,16 +21,50 @@
 #include <stream/IStringStream.h>
 #include <kobj/Ports.h>
 #include <kobj/Sm.h>
+#include <arch/ExecEnv.h>
+#include <Hip.h>
 
 class BufferedLog;
 
 /**
  * The log implementation that provides a service for child tasks that allows them to print lines
- * to the serial line.
+ * to the serial line. The portal does not write to the serial line itself, but puts the line into
+ * a ring for the current CPU and returns immediately. A separate thread drains the rings and writes
+ * the lines in batches. If a ring is full, the line is dropped and counted instead of blocking the
+ * client. The output of root itself is written synchronously.
  */
 class Log : public nre::BaseSerial {
     friend class BufferedLog;
 
+    static const size_t NAME_LEN            = 8;
+    static const size_t RING_SIZE           = 64;
+
+    /**
+     * A line of a client that has not been written yet
+     */
+    struct Line {
+        uint sessid;
+        size_t len;
+        char name[NAME_LEN + 1];
+        char text[MAX_LINE_LEN];
+    };
+
+    /**
+     * The lines of all clients on one CPU. It is written by the service thread of this CPU and
+     * read by the drain thread.
+     */
+    struct Ring {
+        // written by the drain thread
+        volatile size_t rpos;
+        size_t reported;
+        char pad1[nre::ExecEnv::CACHE_LINE_SIZE - sizeof(size_t) * 2];
+        // written by the service thread
+        volatile size_t wpos;
+        volatile size_t dropped;
+        char pad2[nre::ExecEnv::CACHE_LINE_SIZE - sizeof(size_t) * 2];
+        Line lines[RING_SIZE];
+    };
+
     class LogServiceSession : public nre::ServiceSession {
     public:
         explicit LogServiceSession(nre::Service *s, size_t id, portal_func func, const nre::String &name)
@@ -108,7 +142,11 @@ public:
 private:
     explicit Log();
 
+    void enqueue(const char *name, uint sessid, const char *line, size_t len);
+    size_t drain();
+    static void drain_thread(void*);
     void write(const char *name, uint sessid, const char *line, size_t len);
+    void write_line(const char *name, uint sessid, const char *line, size_t len);
 
     virtual void write(char c) {
         if(c == '\0')
@@ -124,6 +162,9 @@ private:
     nre::Ports _ports;
     nre::UserSm _sm;
     bool _ready;
+    Ring *_rings;
+    volatile size_t _waiting;
+    nre::Sm *_drainsm;
     static Log _inst;
     static nre::Service *_srv;
     static const char *_colors[];
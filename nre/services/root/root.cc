@@ -19,6 +19,7 @@
 #include <utcb/UtcbFrame.h>
 #include <subsystem/ChildManager.h>
 #include <subsystem/ChildHip.h>
+#include <subsystem/StartupScheduler.h>
 #include <ipc/Service.h>
 #include <collection/Cycler.h>
 #include <util/Math.h>
@@ -28,6 +29,7 @@
 #include <CPU.h>
 #include <Exception.h>
 #include <Logging.h>
+#include <Trace.h>
 #include <cstring>
 #include <new>
 
@@ -240,6 +242,16 @@ int main() {
         }
     }
 
+    // tracing is enabled by "trace=<levels>" in our own cmdline (we are the first module)
+    for(auto it = hip.mem_begin(); it != hip.mem_end(); ++it) {
+        if(it->type == HipMem::MB_MODULE) {
+            const char *trace = strstr(it->cmdline(), "trace=");
+            if(trace)
+                Trace::enable(strtoul(trace + 6, nullptr, 0));
+            break;
+        }
+    }
+
     LOG(MEM_MAP, "Memory map:\n");
     for(auto it = hip.mem_begin(); it != hip.mem_end(); ++it) {
         LOG(MEM_MAP, "\t" << "addr=" << fmt(it->addr, "p")
@@ -256,8 +268,8 @@ int main() {
     GlobalThread::create(sysinfo_thread, CPU::current().log_id(), "root-sysinfo")->start();
 
     // wait until log and sysinfo are registered
-    while(mng->registry().find("log") == nullptr || mng->registry().find("sysinfo") == nullptr)
-        Util::pause();
+    mng->wait_for_service("log");
+    mng->wait_for_service("sysinfo");
 
     start_childs();
  
@@ -278,6 +290,7 @@ static void sysinfo_thread(void*) {
 static void start_childs() {
     size_t mod = 0, i = 0;
     ForwardCycler<CPU::iterator> cpus(CPU::begin(), CPU::end());
+    StartupScheduler sched(*mng);
     const Hip &hip = Hip::get();
     for(auto it = hip.mem_begin(); it != hip.mem_end(); ++it, ++mod) {
         // we are the first one :)
@@ -286,12 +299,14 @@ static void start_childs() {
             uintptr_t virt = VirtualMemory::alloc(it->size);
             Hypervisor::map_mem(it->addr, virt, it->size);
 
-            ChildConfig cfg(mod, it->cmdline(), cpus.next()->log_id());
-            mng->load(virt, it->size, cfg);
-            if(cfg.last())
+            ChildConfig *cfg = new ChildConfig(mod, it->cmdline(), cpus.next()->log_id());
+            sched.add(virt, it->size, cfg);
+            if(cfg->last())
                 break;
         }
     }
+    // start them in parallel, as far as their dependencies allow it
+    sched.run();
 }
 
 static void portal_service(void*) {
@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <util/ScopedLock.h>
+#include <util/Bytes.h>
+#include <Logging.h>
+
+#include "BlockCache.h"
+
+using namespace nre;
+
+BlockCache::BlockCache(ControllerMng *mng, size_t size, bool writeback)
+    : _mng(mng), _writeback(writeback), _count(Math::max<size_t>(size / BLOCK_SIZE, MAX_BLOCKS * 2)),
+      _ds(_count * BLOCK_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW),
+      _blocks(new Block[_count]), _tree(), _lru(), _dirty(), _waiting(), _writes(),
+      _write_failed(), _issue(), _sm(),
+      // every block has at most one operation in flight, plus the writes we passed on. the ring
+      // uses only a power of two of the available slots, so be generous here
+      _compds(Math::round_up<size_t>(8 * (_count + MAX_WRITES + 1) * sizeof(Storage::Packet),
+                                     ExecEnv::PAGE_SIZE),
+              DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW),
+      _compsm(0), _prod(_compds, _compsm, true), _cons(_compds, _compsm, false), _gt() {
+    for(size_t i = 0; i < _count; ++i)
+        place(_blocks + i);
+
+    LOG(STORAGE, "Using a block cache of " << Bytes(_count * BLOCK_SIZE) << " ("
+                                           << (_writeback ? "write-back" : "write-through") << ")\n");
+
+    _gt = GlobalThread::create(completion_thread, CPU::current().log_id(), "storage-cache");
+    _gt->set_tls<BlockCache*>(Thread::TLS_PARAM, this);
+    _gt->start();
+}
+
+void BlockCache::read(const Reference<ServiceSession> &sess, producer_type *prod, tag_type tag,
+                      const DataSpace &ds, const Storage::Parameter &params, size_t drive,
+                      sector_type sector, const dma_type &dma, Stream &stream) {
+    Request *req = new Request(sess, prod, tag, &ds, params, Storage::READ, drive, sector, dma);
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        // grow the read-ahead window as long as the client reads sequentially
+        if(sector == stream.next)
+            stream.window = Math::min(Math::max(stream.window * 2, MIN_READAHEAD), MAX_READAHEAD);
+        else
+            stream.window = 0;
+        stream.next = sector + req->count;
+        if(stream.window && last_block(req) - first_block(req) < MAX_BLOCKS)
+            prefetch(req, stream.window);
+
+        _waiting.append(req);
+        process_waiting();
+    }
+    issue();
+}
+
+void BlockCache::write(const Reference<ServiceSession> &sess, producer_type *prod, tag_type tag,
+                       const DataSpace &ds, const Storage::Parameter &params, size_t drive,
+                       sector_type sector, const dma_type &dma) {
+    Request *req = new Request(sess, prod, tag, &ds, params, Storage::WRITE, drive, sector, dma);
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        _waiting.append(req);
+        process_waiting();
+    }
+    issue();
+}
+
+void BlockCache::flush(const Reference<ServiceSession> &sess, producer_type *prod, tag_type tag,
+                       const Storage::Parameter &params, size_t drive) {
+    Request *req = new Request(sess, prod, tag, nullptr, params, Storage::FLUSH, drive, 0, dma_type());
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        _waiting.append(req);
+        process_waiting();
+    }
+    issue();
+}
+
+void BlockCache::process_waiting() {
+    // retry all waiting requests in FIFO order
+    for(auto it = _waiting.begin(); it != _waiting.end(); ) {
+        Request *req = &*it;
+        ++it;
+        if(process(req)) {
+            _waiting.remove(req);
+            // the writes we passed on are finished on their completion
+            if(req->passed)
+                _writes.append(req);
+            else
+                delete req;
+        }
+    }
+}
+
+bool BlockCache::process(Request *req) {
+    if(req->cmd == Storage::FLUSH)
+        return process_flush(req);
+
+    uint64_t first = first_block(req);
+    uint64_t last = last_block(req);
+    if(last - first + 1 > MAX_BLOCKS)
+        return process_uncached(req);
+    if(!req->acquired && !acquire(req))
+        return false;
+
+    uint status = 0;
+    for(uint64_t b = first; b <= last; ++b) {
+        if(!(req->pinned & (1ULL << (b - first))))
+            continue;
+        // pinned blocks are never evicted
+        Block *blk = _tree.find(block_key(req->drive, b));
+        if(blk->busy())
+            return false;
+        if(blk->flags & FAILED)
+            status = E_FAILURE;
+    }
+
+    if(status == 0) {
+        for(uint64_t b = first; b <= last; ++b) {
+            if(!(req->pinned & (1ULL << (b - first))))
+                continue;
+            Block *blk = _tree.find(block_key(req->drive, b));
+            if(req->cmd == Storage::READ)
+                copy(req, blk, false);
+            else if(blk->flags & VALID) {
+                copy(req, blk, true);
+                if(_writeback)
+                    blk->flags |= DIRTY;
+            }
+        }
+    }
+    release(req);
+
+    if(req->cmd == Storage::WRITE && !_writeback && status == 0)
+        submit_write(req);
+    else
+        complete(req, status);
+
+    // don't let the dirty blocks fill up the whole cache
+    if(_dirty.length() > _count / 2)
+        writeback(0, true);
+    return true;
+}
+
+bool BlockCache::process_flush(Request *req) {
+    writeback(req->drive, false);
+    // writes that have been submitted before have to reach the drive first
+    for(auto it = _waiting.begin(); it != _waiting.end() && &*it != req; ++it) {
+        if(it->cmd == Storage::WRITE && it->drive == req->drive)
+            return false;
+    }
+    for(auto it = _writes.begin(); it != _writes.end(); ++it) {
+        if(it->drive == req->drive)
+            return false;
+    }
+    for(size_t i = 0; i < _count; ++i) {
+        Block *blk = _blocks + i;
+        if(blk->cached && blk->drive == req->drive && (blk->flags & (DIRTY | WRITING)))
+            return false;
+    }
+
+    // the data of a failed write-back is lost, which the client learns by the FLUSH
+    if(_write_failed[req->drive]) {
+        _write_failed[req->drive] = false;
+        complete(req, E_FAILURE);
+        return true;
+    }
+
+    submit(req);
+    return true;
+}
+
+bool BlockCache::process_uncached(Request *req) {
+    if(overlaps_write(req->drive, req->sector, req->count))
+        return false;
+    if(req->cmd == Storage::WRITE && _writes.length() >= MAX_WRITES)
+        return false;
+
+    // the drive has to be up to date and nobody may work with the blocks in the range
+    bool busy = false;
+    for(uint64_t b = first_block(req); b <= last_block(req); ++b) {
+        Block *blk = _tree.find(block_key(req->drive, b));
+        if(!blk)
+            continue;
+        if((blk->flags & DIRTY) && !blk->busy() && blk->pins == 0)
+            start_write(blk);
+        if(blk->busy() || blk->pins > 0 || (blk->flags & DIRTY))
+            busy = true;
+    }
+    if(busy)
+        return false;
+
+    // the cached blocks would be outdated after the write
+    if(req->cmd == Storage::WRITE) {
+        for(uint64_t b = first_block(req); b <= last_block(req); ++b) {
+            Block *blk = _tree.find(block_key(req->drive, b));
+            if(blk) {
+                blk->flags = 0;
+                place(blk);
+            }
+        }
+        submit_write(req);
+    }
+    else
+        submit(req);
+    return true;
+}
+
+bool BlockCache::overlaps_write(size_t drive, sector_type sector, sector_type count) const {
+    for(auto it = _writes.cbegin(); it != _writes.cend(); ++it) {
+        if(it->drive == drive && Math::overlapped(it->sector, it->count, sector, count))
+            return true;
+    }
+    return false;
+}
+
+bool BlockCache::acquire(Request *req) {
+    uint64_t first = first_block(req);
+    uint64_t last = last_block(req);
+    // the drive and the cache are only up to date with the writes in the blocks once they are done
+    if(overlaps_write(req->drive, first * per_block(req), (last - first + 1) * per_block(req)))
+        return false;
+    if(req->cmd == Storage::WRITE && !_writeback && _writes.length() >= MAX_WRITES)
+        return false;
+    // in write-through mode, we only update the blocks that are already in the cache
+    bool alloc_missing = req->cmd == Storage::READ || _writeback;
+
+    // we either get all blocks or none to prevent that requests block each other
+    if(alloc_missing) {
+        size_t missing = 0, evictable = _lru.length();
+        for(uint64_t b = first; b <= last; ++b) {
+            Block *blk = _tree.find(block_key(req->drive, b));
+            if(!blk)
+                missing++;
+            else if(blk->list == &_lru)
+                evictable--;
+        }
+        if(missing > evictable) {
+            writeback(0, true);
+            return false;
+        }
+    }
+
+    for(uint64_t b = first; b <= last; ++b) {
+        Block *blk = _tree.find(block_key(req->drive, b));
+        if(blk) {
+            blk->pins++;
+            unlink(blk);
+            req->pinned |= 1ULL << (b - first);
+        }
+    }
+    if(alloc_missing) {
+        for(uint64_t b = first; b <= last; ++b) {
+            if(req->pinned & (1ULL << (b - first)))
+                continue;
+            Block *blk = alloc(req->drive, req->secsize, req->capacity, b);
+            blk->pins++;
+            req->pinned |= 1ULL << (b - first);
+
+            // if we overwrite the block completely, there is no need to read it first
+            uint64_t end = blk->sector + blk->size / req->secsize;
+            if(req->cmd == Storage::WRITE && blk->sector >= req->sector &&
+               end <= req->sector + req->count) {
+                copy(req, blk, true);
+                blk->flags = VALID | DIRTY;
+            }
+            else
+                start_read(blk);
+        }
+    }
+    req->acquired = true;
+    return true;
+}
+
+void BlockCache::release(Request *req) {
+    uint64_t first = first_block(req);
+    for(uint64_t b = first; b <= last_block(req); ++b) {
+        if(!(req->pinned & (1ULL << (b - first))))
+            continue;
+        Block *blk = _tree.find(block_key(req->drive, b));
+        blk->pins--;
+        place(blk);
+    }
+    req->pinned = 0;
+}
+
+void BlockCache::copy(Request *req, Block *blk, bool in) {
+    uint64_t bstart = blk->sector * req->secsize;
+    uint64_t bend = bstart + blk->size;
+    uint64_t rstart = req->sector * req->secsize;
+    uint64_t rend = rstart + req->count * req->secsize;
+    uint64_t start = Math::max(bstart, rstart);
+    uint64_t end = Math::min(bend, rend);
+    if(start >= end)
+        return;
+
+    void *addr = reinterpret_cast<void*>(data(blk) + (start - bstart));
+    if(in)
+        req->dma.in(addr, end - start, start - rstart, *req->ds);
+    else
+        req->dma.out(addr, end - start, start - rstart, *req->ds);
+}
+
+void BlockCache::prefetch(const Request *req, size_t count) {
+    uint64_t block = last_block(req) + 1;
+    for(size_t i = 0; i < count; ++i, ++block) {
+        if(block * per_block(req) >= req->capacity)
+            break;
+        if(_tree.find(block_key(req->drive, block)))
+            continue;
+        if(overlaps_write(req->drive, block * per_block(req), per_block(req)))
+            break;
+        // leave enough blocks for the requests of the clients
+        if(_lru.length() <= MAX_BLOCKS)
+            break;
+
+        Block *blk = alloc(req->drive, req->secsize, req->capacity, block);
+        start_read(blk);
+    }
+}
+
+BlockCache::Block *BlockCache::alloc(size_t drive, size_t secsize, sector_type capacity,
+                                     uint64_t block) {
+    // the least recently used block is at the front
+    Block *blk = &*_lru.begin();
+    unlink(blk);
+    if(blk->cached)
+        _tree.remove(blk);
+
+    sector_type per = BLOCK_SIZE / secsize;
+    blk->key(block_key(drive, block));
+    blk->drive = drive;
+    blk->sector = block * per;
+    blk->size = Math::min<sector_type>(per, capacity - blk->sector) * secsize;
+    blk->flags = 0;
+    blk->pins = 0;
+    blk->cached = true;
+    _tree.insert(blk);
+    return blk;
+}
+
+void BlockCache::start_read(Block *blk) {
+    blk->flags = PENDING;
+    submit(blk, Storage::READ);
+}
+
+void BlockCache::start_write(Block *blk) {
+    unlink(blk);
+    blk->flags |= WRITING;
+    submit(blk, Storage::WRITE);
+}
+
+void BlockCache::writeback(size_t drive, bool all) {
+    for(auto it = _dirty.begin(); it != _dirty.end(); ) {
+        Block *blk = &*it;
+        ++it;
+        if(all || blk->drive == drive)
+            start_write(blk);
+    }
+}
+
+void BlockCache::submit(Request *req) {
+    _issue.append(new IO(req->sess, req->prod, req->tag, req->ds, req->cmd, req->drive,
+                         req->sector, req->dma, nullptr));
+}
+
+void BlockCache::submit_write(Request *req) {
+    // let the completion come back to us to finish the request (requests are word-aligned)
+    req->passed = true;
+    _issue.append(new IO(req->sess, &_prod, reinterpret_cast<tag_type>(req) | WRITE_TAG, req->ds,
+                         req->cmd, req->drive, req->sector, req->dma, nullptr));
+}
+
+void BlockCache::submit(Block *blk, Storage::Command cmd) {
+    dma_type dma;
+    dma.push(DMADesc(index(blk) * BLOCK_SIZE, blk->size));
+    _issue.append(new IO(Reference<ServiceSession>(), &_prod, index(blk), &_ds, cmd, blk->drive,
+                         blk->sector, dma, blk));
+}
+
+void BlockCache::issue() {
+    while(1) {
+        IO *io;
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            if(_issue.length() == 0)
+                break;
+            io = &*_issue.begin();
+            _issue.remove(io);
+        }
+
+        try {
+            Controller *ctrl = _mng->get(io->drive / Storage::MAX_DRIVES);
+            if(io->cmd == Storage::FLUSH)
+                ctrl->flush(io->drive, io->sess, io->prod, io->tag);
+            else if(io->cmd == Storage::READ)
+                ctrl->read(io->drive, io->sess, io->prod, io->tag, *io->ds, io->sector, io->dma);
+            else
+                ctrl->write(io->drive, io->sess, io->prod, io->tag, *io->ds, io->sector, io->dma);
+        }
+        catch(const Exception &e) {
+            if(io->blk) {
+                LOG(STORAGE, "Unable to access sector " << io->sector << " of drive " << io->drive
+                                                        << ": " << e.msg() << "\n");
+                // the block is busy until now, so that nobody else touched it in the meantime
+                ScopedLock<UserSm> guard(&_sm);
+                finish(io->blk, e.code());
+                process_waiting();
+            }
+            else {
+                LOG(STORAGE, "[" << io->sess->id() << "," << fmt(io->tag, "#x")
+                                 << "] Request failed: " << e.msg() << "\n");
+                io->prod->produce(Storage::Packet(io->tag, e.code()));
+            }
+        }
+        delete io;
+    }
+}
+
+void BlockCache::finish(Block *blk, uint status) {
+    if(blk->flags & PENDING) {
+        if(status != 0) {
+            LOG(STORAGE, "Reading sector " << blk->sector << " of drive " << blk->drive
+                                           << " failed (" << status << ")\n");
+        }
+        blk->flags = status == 0 ? VALID : FAILED;
+    }
+    else if(blk->flags & WRITING) {
+        if(status != 0) {
+            LOG(STORAGE, "Writing sector " << blk->sector << " of drive " << blk->drive
+                                           << " failed (" << status << ")\n");
+            _write_failed[blk->drive] = true;
+        }
+        blk->flags &= ~(WRITING | DIRTY);
+    }
+    place(blk);
+}
+
+void BlockCache::place(Block *blk) {
+    unlink(blk);
+    if(blk->pins > 0 || blk->busy())
+        return;
+
+    if(!(blk->flags & VALID) || (blk->flags & FAILED)) {
+        if(blk->cached) {
+            _tree.remove(blk);
+            blk->cached = false;
+        }
+        blk->flags = 0;
+        blk->list = &_lru;
+    }
+    else if(blk->flags & DIRTY)
+        blk->list = &_dirty;
+    else
+        blk->list = &_lru;
+    blk->list->append(blk);
+}
+
+void BlockCache::unlink(Block *blk) {
+    if(blk->list) {
+        blk->list->remove(blk);
+        blk->list = nullptr;
+    }
+}
+
+void BlockCache::complete(Request *req, uint status) {
+    LOG(STORAGE_DETAIL, "[" << req->sess->id() << "," << fmt(req->tag, "#x") << "] finished by cache"
+                            << " with status " << status << "\n");
+    req->prod->produce(Storage::Packet(req->tag, status));
+}
+
+void BlockCache::completion_thread(void*) {
+    BlockCache *bc = Thread::current()->get_tls<BlockCache*>(Thread::TLS_PARAM);
+    while(1) {
+        // wait for the next completion
+        bc->_cons.get();
+
+        {
+            ScopedLock<UserSm> guard(&bc->_sm);
+            // release all available completions at once
+            for(size_t n; (n = bc->_cons.available()) > 0; bc->_cons.next(n)) {
+                for(size_t i = 0; i < n; ++i) {
+                    Storage::Packet *pk = bc->_cons.get(i);
+                    if(pk->tag & WRITE_TAG) {
+                        Request *req = reinterpret_cast<Request*>(pk->tag & ~WRITE_TAG);
+                        bc->_writes.remove(req);
+                        bc->complete(req, pk->status);
+                        delete req;
+                    }
+                    else
+                        bc->finish(bc->_blocks + pk->tag, pk->status);
+                }
+            }
+            bc->process_waiting();
+        }
+        bc->issue();
+    }
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <kobj/Sm.h>
+#include <kobj/UserSm.h>
+#include <kobj/GlobalThread.h>
+#include <ipc/ServiceSession.h>
+#include <ipc/MPProducer.h>
+#include <ipc/MPConsumer.h>
+#include <mem/DataSpace.h>
+#include <collection/Treap.h>
+#include <collection/DList.h>
+#include <collection/SList.h>
+#include <services/Storage.h>
+#include <util/Reference.h>
+
+#include "ControllerMng.h"
+
+/**
+ * A page-granular cache for the blocks of all drives, shared by all sessions. It sits between
+ * the storage service and the controllers. Blocks are replaced in LRU order. Sequential reads of
+ * a session trigger read-ahead. Writes are either written back lazily (and at the latest, when
+ * the client requests a FLUSH) or written through to the drive.
+ *
+ * Requests that span more than MAX_BLOCKS blocks are not cached, but passed to the controller
+ * as soon as no cached block in their range is dirty or busy. Writes that are passed to the
+ * controller (uncached or written through) are finished by the cache as well, so that no request
+ * in their range touches the drive or the cache until they are done.
+ */
+class BlockCache {
+    typedef nre::Storage::sector_type sector_type;
+    typedef nre::Storage::tag_type tag_type;
+    typedef nre::Storage::dma_type dma_type;
+    typedef nre::MPProducer<nre::Storage::Packet> producer_type;
+
+    static const size_t BLOCK_SIZE      = nre::ExecEnv::PAGE_SIZE;
+    static const size_t MAX_BLOCKS      = 64;
+    static const size_t MIN_READAHEAD   = 4;
+    static const size_t MAX_READAHEAD   = 32;
+    // the maximum number of writes that are passed to the controller at once
+    static const size_t MAX_WRITES      = 256;
+    // marks the completions of writes, whose tag is the request (blocks use their index)
+    static const tag_type WRITE_TAG     = 1;
+
+    enum {
+        VALID       = 1 << 0,   // contains the data of the drive (or newer)
+        DIRTY       = 1 << 1,   // contains data that has not been written to the drive yet
+        PENDING     = 1 << 2,   // is being read from the drive
+        WRITING     = 1 << 3,   // is being written to the drive
+        FAILED      = 1 << 4,   // reading from the drive failed
+    };
+
+    struct Block : public nre::TreapNode<uint64_t>, public nre::DListItem {
+        explicit Block()
+            : nre::TreapNode<uint64_t>(0), nre::DListItem(), drive(), sector(), size(), flags(),
+              pins(), cached(), list() {
+        }
+
+        bool busy() const {
+            return flags & (PENDING | WRITING);
+        }
+
+        size_t drive;
+        sector_type sector;
+        size_t size;
+        uint flags;
+        uint pins;
+        bool cached;
+        nre::DList<Block> *list;
+    };
+
+    struct Request : public nre::SListItem {
+        explicit Request(const nre::Reference<nre::ServiceSession> &sess, producer_type *prod,
+                         tag_type tag, const nre::DataSpace *ds, const nre::Storage::Parameter &params,
+                         nre::Storage::Command cmd, size_t drive, sector_type sector,
+                         const dma_type &dma)
+            : nre::SListItem(), sess(sess), prod(prod), tag(tag), ds(ds), cmd(cmd), drive(drive),
+              secsize(params.sector_size), capacity(params.sectors), sector(sector),
+              count(dma.bytecount() / params.sector_size), dma(dma), acquired(false), passed(false),
+              pinned(0) {
+        }
+
+        nre::Reference<nre::ServiceSession> sess;
+        producer_type *prod;
+        tag_type tag;
+        const nre::DataSpace *ds;
+        nre::Storage::Command cmd;
+        size_t drive;
+        size_t secsize;
+        sector_type capacity;
+        sector_type sector;
+        sector_type count;
+        dma_type dma;
+        bool acquired;
+        // whether it has been passed to the controller and is finished on its completion
+        bool passed;
+        // the blocks in the range of the request that it has pinned
+        uint64_t pinned;
+    };
+
+    /**
+     * An operation for the controller. These are collected while holding _sm and issued after
+     * releasing it, because the controller might block (e.g. until a command slot is free).
+     */
+    struct IO : public nre::SListItem {
+        explicit IO(const nre::Reference<nre::ServiceSession> &sess, producer_type *prod,
+                    tag_type tag, const nre::DataSpace *ds, nre::Storage::Command cmd,
+                    size_t drive, sector_type sector, const dma_type &dma, Block *blk)
+            : nre::SListItem(), sess(sess), prod(prod), tag(tag), ds(ds), cmd(cmd), drive(drive),
+              sector(sector), dma(dma), blk(blk) {
+        }
+
+        nre::Reference<nre::ServiceSession> sess;
+        producer_type *prod;
+        tag_type tag;
+        const nre::DataSpace *ds;
+        nre::Storage::Command cmd;
+        size_t drive;
+        sector_type sector;
+        dma_type dma;
+        // the block, if it is an operation of the cache itself
+        Block *blk;
+    };
+
+public:
+    /**
+     * The per-session state to detect sequential reads
+     */
+    struct Stream {
+        explicit Stream() : next(), window() {
+        }
+
+        sector_type next;
+        size_t window;
+    };
+
+    /**
+     * Creates a cache of <size> bytes
+     *
+     * @param mng the controller manager
+     * @param size the size of the cache in bytes
+     * @param writeback whether to write back lazily instead of writing through
+     */
+    explicit BlockCache(ControllerMng *mng, size_t size, bool writeback);
+
+    /**
+     * Reads the sectors described by <dma> (see Controller::read). The completion is reported via
+     * <prod>, either by the cache or by the controller.
+     *
+     * @param sess the session (is kept alive as long as the request is in the cache)
+     * @param prod the producer to notify when the command is finished
+     * @param tag the tag to use for the notify
+     * @param ds the dataspace of the client
+     * @param params the parameters of the drive
+     * @param drive the drive number
+     * @param sector the start-sector
+     * @param dma the DMA descriptor list
+     * @param stream the read-ahead state of the session
+     */
+    void read(const nre::Reference<nre::ServiceSession> &sess, producer_type *prod, tag_type tag,
+              const nre::DataSpace &ds, const nre::Storage::Parameter &params, size_t drive,
+              sector_type sector, const dma_type &dma, Stream &stream);
+
+    /**
+     * Writes the sectors described by <dma> (see Controller::write and read()).
+     */
+    void write(const nre::Reference<nre::ServiceSession> &sess, producer_type *prod, tag_type tag,
+               const nre::DataSpace &ds, const nre::Storage::Parameter &params, size_t drive,
+               sector_type sector, const dma_type &dma);
+
+    /**
+     * Writes all dirty blocks of <drive> to the drive and flushes the disk cache afterwards.
+     */
+    void flush(const nre::Reference<nre::ServiceSession> &sess, producer_type *prod, tag_type tag,
+               const nre::Storage::Parameter &params, size_t drive);
+
+private:
+    static uint64_t block_key(size_t drive, uint64_t block) {
+        return (block << 8) | drive;
+    }
+    static size_t per_block(const Request *req) {
+        return BLOCK_SIZE / req->secsize;
+    }
+    static uint64_t first_block(const Request *req) {
+        return req->sector / per_block(req);
+    }
+    static uint64_t last_block(const Request *req) {
+        return (req->sector + req->count - 1) / per_block(req);
+    }
+    size_t index(const Block *blk) const {
+        return blk - _blocks;
+    }
+    uintptr_t data(const Block *blk) const {
+        return _ds.virt() + index(blk) * BLOCK_SIZE;
+    }
+
+    void process_waiting();
+    bool process(Request *req);
+    bool process_flush(Request *req);
+    bool process_uncached(Request *req);
+    bool overlaps_write(size_t drive, sector_type sector, sector_type count) const;
+    bool acquire(Request *req);
+    void release(Request *req);
+    void copy(Request *req, Block *blk, bool in);
+    void prefetch(const Request *req, size_t count);
+    Block *alloc(size_t drive, size_t secsize, sector_type capacity, uint64_t block);
+    void start_read(Block *blk);
+    void start_write(Block *blk);
+    void writeback(size_t drive, bool all);
+    void submit(Request *req);
+    void submit_write(Request *req);
+    void submit(Block *blk, nre::Storage::Command cmd);
+    void issue();
+    void finish(Block *blk, uint status);
+    void place(Block *blk);
+    void unlink(Block *blk);
+    void complete(Request *req, uint status);
+    static void completion_thread(void*);
+
+    ControllerMng *_mng;
+    bool _writeback;
+    size_t _count;
+    nre::DataSpace _ds;
+    Block *_blocks;
+    nre::Treap<Block> _tree;
+    // free blocks and clean, unpinned blocks in LRU order
+    nre::DList<Block> _lru;
+    // dirty, unpinned blocks that are not being written
+    nre::DList<Block> _dirty;
+    nre::SList<Request> _waiting;
+    // the writes that have been passed to the controller
+    nre::SList<Request> _writes;
+    // whether writing back a block of the drive failed since the last FLUSH
+    bool _write_failed[nre::Storage::MAX_CONTROLLER * nre::Storage::MAX_DRIVES];
+    nre::SList<IO> _issue;
+    nre::UserSm _sm;
+    nre::DataSpace _compds;
+    nre::Sm _compsm;
+    producer_type _prod;
+    nre::MPConsumer<nre::Storage::Packet> _cons;
+    nre::Reference<nre::GlobalThread> _gt;
+};
@@ -17,8 +17,11 @@
 #pragma once
 
 #include <mem/DataSpace.h>
-#include <ipc/Producer.h>
+#include <ipc/MPProducer.h>
+#include <ipc/ServiceSession.h>
 #include <services/Storage.h>
+#include <util/Reference.h>
+#include <CPU.h>
 
 /**
  * The base class for all disk controllers
@@ -27,7 +30,7 @@ class Controller {
 protected:
     typedef nre::Storage::sector_type sector_type;
     typedef nre::Storage::tag_type tag_type;
-    typedef nre::Producer<nre::Storage::Packet> producer_type;
+    typedef nre::MPProducer<nre::Storage::Packet> producer_type;
     typedef nre::DMADescList<nre::Storage::MAX_DMA_DESCS> dma_type;
 
 public:
@@ -58,20 +61,34 @@ public:
      */
     virtual void get_params(size_t drive, nre::Storage::Parameter *params) const = 0;
 
+    /**
+     * @param drive the drive number (has to be valid)
+     * @return the CPU on which the completions of the given drive are handled. Submitting the
+     *  requests from this CPU avoids that the request state bounces between the CPUs.
+     */
+    virtual cpu_t completion_cpu(size_t drive) const = 0;
+
     /**
      * Flushes the disk cache
      *
      * @param drive the drive number (has to be valid)
+     * @param sess the session the request belongs to (might be empty). Controllers that queue
+     *  requests have to keep a reference to it until the request is finished, because <prod>
+     *  and <ds> belong to it.
      * @param prod the producer to notify when the command is finished
      * @param tag the tag to use for the notify
      * @throws Exception if something goes wrong
      */
-    virtual void flush(size_t drive, producer_type *prod, tag_type tag) = 0;
+    virtual void flush(size_t drive, const nre::Reference<nre::ServiceSession> &sess,
+                       producer_type *prod, tag_type tag) = 0;
 
     /**
      * Reads into <ds> from sector <sector> of drive <drive>
      *
      * @param drive the drive number (has to be valid)
+     * @param sess the session the request belongs to (might be empty). Controllers that queue
+     *  requests have to keep a reference to it until the request is finished, because <prod>
+     *  and <ds> belong to it.
      * @param prod the producer to notify when the command is finished
      * @param tag the tag to use for the notify
      * @param ds the dataspace to read into
@@ -79,13 +96,17 @@ public:
      * @param dma the DMA descriptor list
      * @throws Exception if something goes wrong
      */
-    virtual void read(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
+    virtual void read(size_t drive, const nre::Reference<nre::ServiceSession> &sess,
+                      producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                       sector_type sector, const dma_type &dma) = 0;
 
     /**
      * Writes to sector <sector> of drive <drive> from <ds>
      *
      * @param drive the drive number (has to be valid)
+     * @param sess the session the request belongs to (might be empty). Controllers that queue
+     *  requests have to keep a reference to it until the request is finished, because <prod>
+     *  and <ds> belong to it.
      * @param prod the producer to notify when the command is finished
      * @param tag the tag to use for the notify
      * @param ds the dataspace to read from
@@ -93,7 +114,8 @@ public:
      * @param dma the DMA descriptor list
      * @throws Exception if something goes wrong
      */
-    virtual void write(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
+    virtual void write(size_t drive, const nre::Reference<nre::ServiceSession> &sess,
+                       producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                        sector_type sector, const dma_type &dma) = 0;
 
 protected:
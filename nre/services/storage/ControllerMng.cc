@@ -38,13 +38,12 @@ void ControllerMng::find_ahci_controller() {
         //MessageHostOp msg1(MessageHostOp::OP_ASSIGN_PCI,bdf);
         // TODO bool dmar = mb.bus_hostop.send(msg1);
         bool dmar = false;
-        Gsi *gsi = _pci.get_gsi(bdf, 0);
 
         LOG(STORAGE, "Disk controller " << fmt(_count, "#x") << " AHCI " << bdf
                                         << " id " << fmt(_pci.conf_read(bdf, 0), "#x")
                                         << " mmio " << fmt(_pci.conf_read(bdf, 9), "#x") << "\n");
 
-        HostAHCICtrl * ctrl = new HostAHCICtrl(_count, _pci, bdf, gsi, dmar);
+        HostAHCICtrl * ctrl = new HostAHCICtrl(_count, _pci, bdf, next_cpu(), dmar);
         _ctrls[_count++] = ctrl;
         inst++;
     }
@@ -101,7 +100,8 @@ void ControllerMng::find_ide_controller() {
 
             // create controller
             try {
-                Controller *ctrl = new HostIDECtrl(_count, gsi, bar0 & ~0x3, bmr, 8, _idedma);
+                Controller *ctrl = new HostIDECtrl(_count, gsi, next_cpu(), bar0 & ~0x3, bmr, 8,
+                                                 _idedma);
                 _ctrls[_count++] = ctrl;
             }
             catch(const Exception &e) {
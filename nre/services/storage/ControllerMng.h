@@ -32,7 +32,8 @@ class ControllerMng {
 
 public:
     explicit ControllerMng(bool idedma)
-        : _idedma(idedma), _pcicfg("pcicfg"), _acpi("acpi"), _pci(_pcicfg, &_acpi), _count(0), _ctrls() {
+        : _idedma(idedma), _pcicfg("pcicfg"), _acpi("acpi"), _pci(_pcicfg, &_acpi), _count(0),
+          _cpu(0), _ctrls() {
         find_ahci_controller();
         find_ide_controller();
     }
@@ -45,6 +46,12 @@ public:
     }
 
 private:
+    /**
+     * @return the CPU to handle the interrupts of the next controller on (round robin)
+     */
+    cpu_t next_cpu() {
+        return _cpu++ % nre::CPU::count();
+    }
     void find_ahci_controller();
     void find_ide_controller();
 
@@ -53,5 +60,6 @@ private:
     nre::ACPISession _acpi;
     nre::PCI _pci;
     size_t _count;
+    cpu_t _cpu;
     Controller *_ctrls[nre::Storage::MAX_CONTROLLER];
 };
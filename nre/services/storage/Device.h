@@ -141,7 +141,7 @@ class Device {
 public:
     typedef nre::Storage::sector_type sector_type;
     typedef nre::Storage::tag_type tag_type;
-    typedef nre::Producer<nre::Storage::Packet> producer_type;
+    typedef nre::MPProducer<nre::Storage::Packet> producer_type;
     typedef nre::DMADescList<nre::Storage::MAX_DMA_DESCS> dma_type;
 
     enum Operation {
@@ -346,7 +346,7 @@ public:
     size_t sector_size() const {
         return _sector_size;
     }
-    size_t max_requests() const {
+    virtual size_t max_requests() const {
         return (1 << (has_lba48() ? 16 : 8)) - 1;
     }
     const char *name() const {
@@ -355,9 +355,15 @@ public:
     bool is_atapi() const {
         return _info.general.isATAPI;
     }
+    bool is_rotational() const {
+        // word 217 is the nominal media rotation rate; 1 means non-rotating media (e.g. SSD)
+        return _info.reserved[217 - 104] != 1;
+    }
     void get_params(nre::Storage::Parameter *params) const {
         params->flags = is_atapi()
                         ? nre::Storage::Parameter::FLAG_ATAPI : nre::Storage::Parameter::FLAG_HARDDISK;
+        if(!is_rotational())
+            params->flags |= nre::Storage::Parameter::FLAG_NONROTATIONAL;
         params->max_requests = max_requests();
         memcpy(params->name, name(), nre::Math::min<size_t>(sizeof(params->name), strlen(name()) + 1));
         params->sector_size = sector_size();
@@ -15,15 +15,17 @@
  * General Public License version 2 for more details.
  */
 
+#include <util/Atomic.h>
 #include <Logging.h>
+#include <Trace.h>
 
 #include "HostAHCICtrl.h"
 
 using namespace nre;
 
-HostAHCICtrl::HostAHCICtrl(uint id, PCI &pci, BDF bdf, Gsi *gsi, bool dmar)
-    : Controller(id), _gsi(gsi), _bdf(bdf), _regs_ds(), _regs_high_ds(), _regs(),
-      _regs_high(0), _portcount(0), _ports() {
+HostAHCICtrl::HostAHCICtrl(uint id, PCI &pci, BDF bdf, cpu_t cpu, bool dmar)
+    : Controller(id), _bdf(bdf), _regs_ds(), _regs_high_ds(), _regs(), _regs_high(0),
+      _portcount(0), _ports(), _veccount(0), _vecs(), _irqs() {
     assert(!(~pci.conf_read(_bdf, 1) & 6) && "we need mem-decode and busmaster dma");
     PCI::value_type bar = pci.conf_read(_bdf, 9);
     assert(!(bar & 7) && "we need a 32bit memory bar");
@@ -53,18 +55,56 @@ HostAHCICtrl::HostAHCICtrl(uint id, PCI &pci, BDF bdf, Gsi *gsi, bool dmar)
     for(uint i = 30; _regs_high && i < 32; i++)
         create_ahci_port(i, _regs_high + (i - 30), dmar);
 
+    create_vectors(pci, cpu);
+
     // clear pending irqs
     _regs->is = _regs->pi;
     // enable IRQs
     _regs->ghc |= 2;
+}
 
-    // start the gsi thread
-    char name[32];
-    OStringStream os(name, sizeof(name));
-    os << "ahci-gsi-" << _gsi->gsi();
-    Reference<GlobalThread> gt = GlobalThread::create(gsi_thread, CPU::current().log_id(), name);
-    gt->set_tls<HostAHCICtrl*>(Thread::TLS_PARAM, this);
-    gt->start();
+void HostAHCICtrl::create_vectors(PCI &pci, cpu_t cpu) {
+    // with MSI-X, every port can get its own vector, which allows us to handle the completions of
+    // different ports on different CPUs. otherwise, there is only one vector for all ports.
+    uint ports = Math::bit_scan_reverse<uint32_t>(_regs->pi | 1) + 1;
+    uint count = Math::min<uint>(pci.msix_vectors(_bdf), ports);
+    for(uint i = 0; i < Math::max<uint>(count, 1); ++i) {
+        Vector *vec = _vecs + i;
+        vec->ctrl = this;
+        vec->cpu = (cpu + i) % CPU::count();
+        try {
+            vec->gsi = count ? pci.get_gsi_msi(_bdf, i, nullptr, vec->cpu) : nullptr;
+        }
+        catch(const Exception &e) {
+            // if we got at least one vector, we can live with that
+            if(i == 0)
+                throw;
+            LOG(STORAGE, "AHCI: unable to allocate MSI-X vector " << i << ": " << e.msg() << "\n");
+            break;
+        }
+        if(!vec->gsi) {
+            if(i > 0)
+                break;
+            // without MSI-X (or if the device can't be found), use a single MSI or legacy IRQ
+            vec->gsi = pci.get_gsi(_bdf, 0, false, nullptr, vec->cpu);
+            _veccount++;
+            break;
+        }
+        _veccount++;
+    }
+
+    for(size_t i = 0; i < _veccount; ++i) {
+        Vector *vec = _vecs + i;
+        LOG(STORAGE, "AHCI: vector " << i << " uses GSI " << vec->gsi->gsi()
+                                     << " on CPU " << vec->cpu << "\n");
+
+        char name[32];
+        OStringStream os(name, sizeof(name));
+        os << "ahci-gsi-" << vec->gsi->gsi();
+        Reference<GlobalThread> gt = GlobalThread::create(gsi_thread, vec->cpu, name);
+        gt->set_tls<Vector*>(Thread::TLS_PARAM, vec);
+        gt->start();
+    }
 }
 
 void HostAHCICtrl::create_ahci_port(uint nr, HostAHCIDevice::Register *portreg, bool dmar) {
@@ -77,7 +117,8 @@ void HostAHCICtrl::create_ahci_port(uint nr, HostAHCIDevice::Register *portreg,
     if(sig != HostAHCIDevice::SATA_SIG_NONE) {
         try {
             _ports[nr] = new HostAHCIDevice(portreg, _id * Storage::MAX_DRIVES + _portcount,
-                                            ((_regs->cap >> 8) & 0x1f) + 1, dmar);
+                                            ((_regs->cap >> 8) & 0x1f) + 1,
+                                            _regs->cap & CAP_SNCQ, dmar);
             _ports[nr]->determine_capacity();
             LOG(STORAGE, *_ports[nr] << "\n");
             _portcount++;
@@ -90,18 +131,35 @@ void HostAHCICtrl::create_ahci_port(uint nr, HostAHCIDevice::Register *portreg,
 }
 
 void HostAHCICtrl::gsi_thread(void*) {
-    HostAHCICtrl *ha = Thread::current()->get_tls<HostAHCICtrl*>(Thread::TLS_PARAM);
+    Vector *vec = Thread::current()->get_tls<Vector*>(Thread::TLS_PARAM);
+    HostAHCICtrl *ha = vec->ctrl;
     while(1) {
-        ha->_gsi->down();
+        vec->gsi->down();
+        TRACE(STORAGE, STORAGE_IRQ_BEGIN, vec->gsi->gsi(), ha->_id);
 
+        // we don't know which ports use this vector, so look at all of them. the bits are
+        // write-1-to-clear, so that we only acknowledge what we've seen
         uint32_t is = ha->_regs->is;
         uint32_t oldis = is;
         while(is) {
             uint32_t port = Math::bit_scan_forward(is);
             if(ha->_ports[port])
-                ha->_ports[port]->irq();
+                ha->port_irq(port);
             is &= ~(1 << port);
         }
         ha->_regs->is = oldis;
+        TRACE(STORAGE, STORAGE_IRQ_END, vec->gsi->gsi(), ha->_id);
+    }
+}
+
+void HostAHCICtrl::port_irq(uint port) {
+    // the threads of multiple vectors might see the same port. the first one handles it and does
+    // that once more for every other one that came in meanwhile. this way, a port is never
+    // handled concurrently and no completion is missed.
+    if(Atomic::add(_irqs + port, 1) != 0)
+        return;
+    do {
+        _ports[port]->irq();
     }
+    while(Atomic::add(_irqs + port, -1) != 1);
 }
@@ -32,9 +32,26 @@
  * A simple driver for AHCI.
  *
  * State: testing
- * Features: Ports
+ * Features: Ports, MSI-X with multiple vectors
  */
 class HostAHCICtrl : public Controller {
+    enum {
+        // supports native command queuing
+        CAP_SNCQ        = 1 << 30,
+    };
+
+    /**
+     * An interrupt vector. Each vector is routed to its own CPU and handled by a thread on that
+     * CPU. AHCI doesn't define which MSI-X vector is used for which port. Thus, every vector
+     * handles all ports, but we expect port i to use vector i and handle its completions on the
+     * CPU of that vector.
+     */
+    struct Vector {
+        HostAHCICtrl *ctrl;
+        nre::Gsi *gsi;
+        cpu_t cpu;
+    };
+
     /**
      * The register set of an AHCI controller.
      */
@@ -59,9 +76,10 @@ class HostAHCICtrl : public Controller {
     };
 
 public:
-    explicit HostAHCICtrl(uint id, nre::PCI &pci, nre::BDF bdf, nre::Gsi *gsi, bool dmar);
+    explicit HostAHCICtrl(uint id, nre::PCI &pci, nre::BDF bdf, cpu_t cpu, bool dmar);
     virtual ~HostAHCICtrl() {
-        delete _gsi;
+        for(size_t i = 0; i < _veccount; ++i)
+            delete _vecs[i].gsi;
         delete _regs_ds;
         delete _regs_high_ds;
     }
@@ -76,17 +94,23 @@ public:
         assert(_ports[idx(drive)]);
         _ports[idx(drive)]->get_params(params);
     }
+    virtual cpu_t completion_cpu(size_t drive) const {
+        return _vecs[vector(idx(drive))].cpu;
+    }
 
-    virtual void flush(size_t drive, producer_type *prod, tag_type tag) {
+    virtual void flush(size_t drive, const nre::Reference<nre::ServiceSession> &,
+                       producer_type *prod, tag_type tag) {
         assert(_ports[idx(drive)]);
         _ports[idx(drive)]->flush(prod, tag);
     }
-    virtual void read(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
+    virtual void read(size_t drive, const nre::Reference<nre::ServiceSession> &,
+                      producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                       sector_type sector, const dma_type &dma) {
         assert(_ports[idx(drive)]);
         _ports[idx(drive)]->readwrite(prod, tag, ds, sector, dma, false);
     }
-    virtual void write(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
+    virtual void write(size_t drive, const nre::Reference<nre::ServiceSession> &,
+                       producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                        sector_type sector, const dma_type &dma) {
         assert(_ports[idx(drive)]);
         _ports[idx(drive)]->readwrite(prod, tag, ds, sector, dma, true);
@@ -96,10 +120,15 @@ private:
     static size_t idx(size_t drive) {
         return drive % nre::Storage::MAX_DRIVES;
     }
+    size_t vector(uint port) const {
+        // if there are less vectors than ports, the last one is shared
+        return port < _veccount ? port : _veccount - 1;
+    }
+    void create_vectors(nre::PCI &pci, cpu_t cpu);
+    void port_irq(uint port);
     void create_ahci_port(uint nr, HostAHCIDevice::Register *portreg, bool dmar);
     static void gsi_thread(void*);
 
-    nre::Gsi *_gsi;
     nre::BDF _bdf;
     nre::DataSpace *_regs_ds;
     nre::DataSpace *_regs_high_ds;
@@ -107,4 +136,7 @@ private:
     HostAHCIDevice::Register *_regs_high;
     size_t _portcount;
     HostAHCIDevice *_ports[32];
+    size_t _veccount;
+    Vector _vecs[32];
+    volatile ulong _irqs[32];
 };
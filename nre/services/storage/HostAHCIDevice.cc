@@ -22,6 +22,22 @@
 using namespace nre;
 
 void HostAHCIDevice::init() {
+    reset();
+    try {
+        identify_drive(_bufferds);
+    }
+    catch(...) {
+        // disable all interrupts (we couldn't acknowledge them because HostAHCICtrl will
+        // ignore this port since identify failed)
+        _regs->ie = 0;
+        throw;
+    }
+    //set_features(0x3, 0x46);
+    //set_features(0x2, 0);
+    //return identify_drive(buffer);
+}
+
+void HostAHCIDevice::reset() {
     if(_regs->cmd & 0xc009) {
         // stop processing by clearing ST
         _regs->cmd &= ~1;
@@ -60,50 +76,205 @@ void HostAHCIDevice::init() {
     }
     _regs->cmd |= 0x1;
 
-    // nothing in progress anymore
-    _inprogress = 0;
-
     // enable irqs
     _regs->ie = 0xf98000f1;
-    try {
-        identify_drive(_bufferds);
+}
+
+void HostAHCIDevice::init_slots(bool ncq) {
+    const uint16_t *words = reinterpret_cast<const uint16_t*>(&_info);
+    // NCQ requires support by the HBA and the device. the device reports its queue depth - 1.
+    _ncq = ncq && !is_atapi() && (words[76] & SATA_CAP_NCQ);
+    _depth = _ncq ? Math::min<size_t>(_max_slots, (words[75] & 0x1F) + 1) : _max_slots;
+    _free = slot_mask();
+    for(size_t i = 0; i < _depth; ++i)
+        _slotsm.up();
+}
+
+size_t HostAHCIDevice::alloc_slot() {
+    // the semaphore guarantees that there is a free slot for us; we only have to find it
+    _slotsm.down();
+    while(1) {
+        uint32_t free = _free;
+        assert(free != 0);
+        size_t slot = Math::bit_scan_forward(free);
+        if(Atomic::cmpnswap(&_free, free, free & ~(1U << slot)))
+            return slot;
     }
-    catch(...) {
-        // disable all interrupts (we couldn't acknowledge them because HostAHCICtrl will
-        // ignore this port since identify failed)
-        _regs->ie = 0;
-        throw;
+}
+
+void HostAHCIDevice::free_slot(size_t slot) {
+    Atomic::bit_or(&_free, 1U << slot);
+    _slotsm.up();
+}
+
+bool HostAHCIDevice::claim_slot(size_t slot) {
+    // the irq-thread and the submitter might both see that the command is finished. only one of
+    // them is allowed to report it
+    uint32_t bit = 1U << slot;
+    while(1) {
+        uint32_t active = _active;
+        if(!(active & bit))
+            return false;
+        if(Atomic::cmpnswap(&_active, active, active & ~bit))
+            return true;
     }
-    //set_features(0x3, 0x46);
-    //set_features(0x2, 0);
-    //return identify_drive(buffer);
 }
 
-void HostAHCIDevice::readwrite(Producer<Storage::Packet> *prod, Storage::tag_type tag,
-                               const DataSpace &ds, sector_type sector, const dma_type &dma,
-                               bool write) {
-    ScopedLock<UserSm> guard(&_sm);
-    size_t length = dma.bytecount();
-    // exceeds max. length?
-    if(length >> 22) {
-        VTHROW(Exception, E_ARGS_INVALID,
-               "Device " << _id << ": Max. sector count exceeded (" << (length >> 9) << ")");
+MPProducer<Storage::Packet> *HostAHCIDevice::complete(size_t slot, uint status, bool notify) {
+    // copy the tag first, because the slot might be reused as soon as we've released it
+    UserTag ut = _usertags[slot];
+    _usertags[slot].tag = ~0;
+    _usertags[slot].prod = nullptr;
+    _usertags[slot].split = nullptr;
+
+    if(ut.exclusive) {
+        // a non-queued command owns all slots
+        _free = slot_mask();
+        for(size_t i = 0; i < _depth; ++i)
+            _slotsm.up();
     }
+    else
+        free_slot(slot);
 
-    uint8_t command = has_lba48() ? 0x25 : 0xc8;
-    if(write)
-        command = has_lba48() ? 0x35 : 0xca;
-    set_command(command, sector, !write, length >> 9);
+    if(ut.split) {
+        Atomic::bit_or(&ut.split->status, status);
+        // the last one reports the whole request
+        if(Atomic::add(&ut.split->pending, -1) != 1)
+            return nullptr;
+        MPProducer<Storage::Packet> *prod = report(ut.split->prod, ut.split->tag,
+                                                   ut.split->status, notify);
+        delete ut.split;
+        return prod;
+    }
+    return report(ut.prod, ut.tag, status, notify);
+}
+
+MPProducer<Storage::Packet> *HostAHCIDevice::report(MPProducer<Storage::Packet> *prod,
+                                                    Storage::tag_type tag, uint status,
+                                                    bool notify) {
+    if(prod && prod->produce(Storage::Packet(tag, status), notify) && !notify)
+        return prod;
+    return nullptr;
+}
+
+void HostAHCIDevice::flush(MPProducer<Storage::Packet> *prod, Storage::tag_type tag) {
+    // FLUSH CACHE is not queued. thus, we have to wait until all queued commands are finished
+    // and prevent that new ones are issued until the flush is done
+    ScopedLock<UserSm> guard(&_exclusive);
+    for(size_t i = 0; i < _depth; ++i)
+        _slotsm.down();
+    _free = 0;
+    set_command(0, has_lba48() ? 0xea : 0xe7, 0, true);
+    start_command(0, prod, tag, false, true);
+}
 
+void HostAHCIDevice::readwrite(MPProducer<Storage::Packet> *prod, Storage::tag_type tag,
+                               const DataSpace &ds, sector_type sector, const dma_type &dma,
+                               bool write) {
+    size_t length = dma.bytecount();
+    if(length == 0 || (length & 0x1FF))
+        VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Invalid length (" << length << ")");
     for(auto it = dma.begin(); it != dma.end(); ++it) {
-        if(it->offset > ds.size() || it->offset + it->count > ds.size()) {
+        if(it->offset > ds.size() || it->offset + it->count > ds.size() || (it->count & 1)) {
             VTHROW(Exception, E_ARGS_INVALID,
                    "Device " << _id << ": Invalid offset(" << it->offset <<")/"
                                                << "count(" << it->count << ")");
         }
-        add_dma(ds, it->offset, it->count);
     }
-    start_command(prod, tag);
+
+    // do the common case, a request that fits into one command, without the split bookkeeping
+    if(chunk_size(dma.begin(), dma.end(), 0) == length) {
+        size_t slot = alloc_slot();
+        try {
+            auto it = dma.begin();
+            size_t off = 0;
+            readwrite_chunk(slot, ds, sector, it, off, length, write);
+        }
+        catch(...) {
+            free_slot(slot);
+            throw;
+        }
+        start_command(slot, prod, tag, _ncq);
+        return;
+    }
+
+    // check whether we can split it at sector boundaries before we issue anything
+    size_t off = 0, total = 0;
+    for(auto it = dma.begin(); total < length; ) {
+        size_t bytes = chunk_size(it, dma.end(), off);
+        if(bytes == 0) {
+            VTHROW(Exception, E_ARGS_INVALID,
+                   "Device " << _id << ": Unable to split request at sector boundaries");
+        }
+        total += bytes;
+        for(off += bytes; it != dma.end() && off >= it->count; ++it)
+            off -= it->count;
+    }
+
+    Split *split = new Split(prod, tag);
+    auto it = dma.begin();
+    off = 0;
+    while(length > 0) {
+        size_t bytes = chunk_size(it, dma.end(), off);
+        size_t slot = alloc_slot();
+        // can't fail anymore, because we've checked everything above
+        readwrite_chunk(slot, ds, sector, it, off, bytes, write);
+        Atomic::add(&split->pending, +1);
+        start_command(slot, prod, tag, _ncq, false, split);
+        sector += bytes >> 9;
+        length -= bytes;
+    }
+
+    // drop our own reference; if all commands are already done, we have to report it
+    if(Atomic::add(&split->pending, -1) == 1) {
+        report(split->prod, split->tag, split->status, true);
+        delete split;
+    }
+}
+
+size_t HostAHCIDevice::chunk_size(dma_type::iterator it, dma_type::iterator end, size_t off) const {
+    size_t bytes = 0, prds = 0;
+    size_t max = max_sectors() << 9;
+    for(; it != end && prds < MAX_PRD_COUNT && bytes < max; ++it, off = 0) {
+        size_t rem = it->count - off;
+        // every PRD can hold at most MAX_PRD_BYTES
+        size_t descs = (rem + MAX_PRD_BYTES - 1) / MAX_PRD_BYTES;
+        if(prds + descs > MAX_PRD_COUNT) {
+            rem = (MAX_PRD_COUNT - prds) * MAX_PRD_BYTES;
+            descs = MAX_PRD_COUNT - prds;
+        }
+        bytes += rem;
+        prds += descs;
+    }
+    // a command has to end at a sector boundary
+    return Math::round_dn<size_t>(Math::min(bytes, max), 512);
+}
+
+void HostAHCIDevice::readwrite_chunk(size_t slot, const DataSpace &ds, sector_type sector,
+                                     dma_type::iterator &it, size_t &off, size_t bytes, bool write) {
+    if(_ncq) {
+        // READ/WRITE FPDMA QUEUED: the sector count is in the features and the tag in the
+        // count register
+        set_command(slot, write ? 0x61 : 0x60, sector, !write, slot << 3, false, 0, bytes >> 9);
+    }
+    else {
+        uint8_t command = has_lba48() ? 0x25 : 0xc8;
+        if(write)
+            command = has_lba48() ? 0x35 : 0xca;
+        set_command(slot, command, sector, !write, bytes >> 9);
+    }
+
+    while(bytes > 0) {
+        size_t amount = Math::min(Math::min(it->count - off, MAX_PRD_BYTES), bytes);
+        if(amount)
+            add_dma(slot, ds, it->offset + off, amount);
+        bytes -= amount;
+        off += amount;
+        if(off == it->count) {
+            ++it;
+            off = 0;
+        }
+    }
 }
 
 void HostAHCIDevice::irq() {
@@ -112,84 +283,115 @@ void HostAHCIDevice::irq() {
     // clear interrupt status
     _regs->is = is;
 
-    for(uint done = _inprogress & ~_regs->ci, tag; done; done &= ~(1 << tag)) {
-        tag = nre::Math::bit_scan_forward(done);
-        LOG(STORAGE_DETAIL, "Operation for user " << fmt(_usertags[tag].tag, "x") << " is finished\n");
-        if(_usertags[tag].prod)
-            _usertags[tag].prod->produce(nre::Storage::Packet(_usertags[tag].tag, 0));
+    // produce all completions first and notify every producer only once afterwards
+    MPProducer<Storage::Packet> *notify[32];
+    size_t notify_count = 0;
+    for(uint done = _active & ~(_regs->ci | _regs->sact), slot; done; done &= ~(1U << slot)) {
+        slot = nre::Math::bit_scan_forward(done);
+        if(!claim_slot(slot))
+            continue;
 
-        _usertags[tag].tag = ~0;
-        _inprogress &= ~(1 << tag);
+        LOG(STORAGE_DETAIL, "Operation for user " << fmt(_usertags[slot].tag, "x") << " is finished\n");
+        MPProducer<Storage::Packet> *prod = complete(slot, 0, false);
+        if(prod) {
+            size_t i;
+            for(i = 0; i < notify_count && notify[i] != prod; ++i)
+                ;
+            if(i == notify_count)
+                notify[notify_count++] = prod;
+        }
     }
+    for(size_t i = 0; i < notify_count; ++i)
+        notify[i]->notify();
 
     if((_regs->tfd & 1) && (~_regs->tfd & 0x400)) {
         LOG(STORAGE, "command failed with " << fmt(_regs->tfd, "x") << "\n");
-        init();
+        // submitters wait until the port runs again and all lost commands have been reported
+        ScopedLock<UserSm> guard(&_issuesm);
+        reset();
+        // the port has been restarted, so that all outstanding commands are lost
+        for(uint lost = _active, slot; lost; lost &= ~(1U << slot)) {
+            slot = nre::Math::bit_scan_forward(lost);
+            if(claim_slot(slot))
+                complete(slot, 1, true);
+        }
     }
 }
 
-void HostAHCIDevice::set_command(uint8_t command, uint64_t sector, bool read, uint count, bool atapi,
-                                 uint pmp, uint features) {
-    _cl[_tag * CL_DWORDS + 0] = (atapi ? 0x20 : 0) | (read ? 0 : 0x40) | 5 | ((pmp & 0xf) << 12);
-    _cl[_tag * CL_DWORDS + 1] = 0;
+void HostAHCIDevice::set_command(size_t slot, uint8_t command, uint64_t sector, bool read,
+                                 uint count, bool atapi, uint pmp, uint features) {
+    _cl[slot * CL_DWORDS + 0] = (atapi ? 0x20 : 0) | (read ? 0 : 0x40) | 5 | ((pmp & 0xf) << 12);
+    _cl[slot * CL_DWORDS + 1] = 0;
 
     // link command list and tables
-    addr2phys(_ctds, _ct + _tag * (128 + MAX_PRD_COUNT * 16) / 4, _cl + _tag * CL_DWORDS + 2);
+    addr2phys(_ctds, _ct + slot * (128 + MAX_PRD_COUNT * 16) / 4, _cl + slot * CL_DWORDS + 2);
 
     // XXX Does any one know how to avoid these type casts in C++0x mode?
 #define UC(x) static_cast<uint8_t>(x)
     uint8_t cfis[20] = {0x27, UC(0x80 | (pmp & 0xf)), command, UC(features), UC(sector),
                         UC(sector >> 8), UC(sector >> 16), 0x40, UC(sector >> 24), UC(sector >> 32),
                         UC(sector >> 40), UC(features >> 8), UC(count), UC(count >> 8), 0, 0, 0, 0, 0, 0};
-    memcpy(_ct + _tag * (128 + MAX_PRD_COUNT * 16) / 4, cfis, sizeof(cfis));
+    memcpy(_ct + slot * (128 + MAX_PRD_COUNT * 16) / 4, cfis, sizeof(cfis));
 }
 
-void HostAHCIDevice::add_dma(const nre::DataSpace &ds, size_t offset, uint bytes) {
-    uint32_t prd = _cl[_tag * CL_DWORDS] >> 16;
+void HostAHCIDevice::add_dma(size_t slot, const nre::DataSpace &ds, size_t offset, uint bytes) {
+    uint32_t prd = _cl[slot * CL_DWORDS] >> 16;
     if(prd >= MAX_PRD_COUNT)
         VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": No free PRD slot");
-    _cl[_tag * CL_DWORDS] += 1 << 16;
-    uint32_t *p = _ct + ((_tag * (128 + MAX_PRD_COUNT * 16) + 0x80 + prd * 16) >> 2);
+    _cl[slot * CL_DWORDS] += 1 << 16;
+    uint32_t *p = _ct + ((slot * (128 + MAX_PRD_COUNT * 16) + 0x80 + prd * 16) >> 2);
     addr2phys(ds, reinterpret_cast<void*>(ds.virt() + offset), p);
     p[3] = bytes - 1;
 }
 
-void HostAHCIDevice::add_prd(const nre::DataSpace &ds, uint bytes) {
-    uint32_t prd = _cl[_tag * CL_DWORDS] >> 16;
+void HostAHCIDevice::add_prd(size_t slot, const nre::DataSpace &ds, uint bytes) {
+    uint32_t prd = _cl[slot * CL_DWORDS] >> 16;
     assert(~bytes & 1);
     assert(!(bytes >> 22));
     if(prd >= MAX_PRD_COUNT)
         VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": No free PRD slot");
-    _cl[_tag * CL_DWORDS] += 1 << 16;
-    uint32_t *p = _ct + ((_tag * (128 + MAX_PRD_COUNT * 16) + 0x80 + prd * 16) >> 2);
+    _cl[slot * CL_DWORDS] += 1 << 16;
+    uint32_t *p = _ct + ((slot * (128 + MAX_PRD_COUNT * 16) + 0x80 + prd * 16) >> 2);
     addr2phys(ds, reinterpret_cast<void*>(ds.virt()), p);
     p[3] = bytes - 1;
 }
 
-size_t HostAHCIDevice::start_command(nre::Producer<nre::Storage::Packet> *prod, ulong usertag) {
-    // remember work in progress commands
-    assert(!(_inprogress & (1 << _tag)));
-    _inprogress |= 1 << _tag;
-    _usertags[_tag].tag = usertag;
-    _usertags[_tag].prod = prod;
+void HostAHCIDevice::issue(size_t slot, bool queued) {
+    // both registers are write-1-to-set, so that concurrent submitters don't interfere
+    if(queued)
+        _regs->sact = 1U << slot;
+    _regs->ci = 1U << slot;
+}
+
+void HostAHCIDevice::start_command(size_t slot, MPProducer<Storage::Packet> *prod,
+                                   ulong usertag, bool queued, bool exclusive, Split *split) {
+    assert(!(_active & (1U << slot)));
+    _usertags[slot].tag = usertag;
+    _usertags[slot].prod = prod;
+    _usertags[slot].split = split;
+    _usertags[slot].exclusive = exclusive;
+
+    ScopedLock<UserSm> guard(&_issuesm);
+    issue(slot, queued);
+    Atomic::bit_or(&_active, 1U << slot);
 
-    _regs->ci = 1 << _tag;
-    size_t res = _tag;
-    _tag = (_tag + 1) % _max_slots;
-    return res;
+    // if the command has already been finished before we've marked it active, the irq-thread
+    // might have missed it. so, report it here in this case
+    if(!((_regs->ci | _regs->sact) & (1U << slot)) && claim_slot(slot))
+        complete(slot, 0, true);
 }
 
 void HostAHCIDevice::identify_drive(nre::DataSpace &buffer) {
     uint16_t *buf = reinterpret_cast<uint16_t*>(buffer.virt());
     memset(reinterpret_cast<void*>(buffer.virt()), 0, 512);
-    set_command(0xec, 0, true);
-    add_prd(buffer, 512);
-    size_t tag = start_command(nullptr, 0);
+    // this is only done during initialization, i.e. no other command is in flight
+    set_command(0, 0xec, 0, true);
+    add_prd(0, buffer, 512);
+    issue(0);
 
     // there is no IRQ on identify, as this is PIO data-in command
-    if(wait_timeout(&_regs->ci, 1 << tag, 0))
+    if(wait_timeout(&_regs->ci, 1, 0))
         VTHROW(Exception, E_TIMEOUT, "Device " << _id << ": Timeout while waiting on IDENTIFY to finish");
-    _inprogress &= ~(1 << tag);
 
     // we do not support spinup
     // TODO is 0 in qemu!? assert(buf[2] == 0xc837);
@@ -198,11 +400,10 @@ void HostAHCIDevice::identify_drive(nre::DataSpace &buffer) {
 }
 
 uint HostAHCIDevice::set_features(uint features, uint count) {
-    set_command(0xef, 0, false, count, false, 0, features);
-    size_t tag = start_command(nullptr, 0);
+    set_command(0, 0xef, 0, false, count, false, 0, features);
+    issue(0);
 
     // there is no IRQ on set_features, as this is a PIO command
-    check3(wait_timeout(&_regs->ci, 1 << tag, 0));
-    _inprogress &= ~(1 << tag);
+    check3(wait_timeout(&_regs->ci, 1, 0));
     return 0;
 }
@@ -18,8 +18,10 @@
 #pragma once
 
 #include <mem/DataSpace.h>
-#include <ipc/Producer.h>
+#include <ipc/MPProducer.h>
+#include <kobj/UserSm.h>
 #include <util/Clock.h>
+#include <util/Atomic.h>
 #include <Assert.h>
 
 #include "Device.h"
@@ -30,12 +32,14 @@
  * A single AHCI port with its command list and receive FIS buffer.
  *
  * State: testing
- * Supports: read-sectors, write-sectors, identify-drive
+ * Supports: read-sectors, write-sectors, identify-drive, native command queuing
  * Missing: ATAPI detection
  */
 class HostAHCIDevice : public Device {
     static const size_t CL_DWORDS     = 8;
     static const size_t MAX_PRD_COUNT = 64;
+    // the maximum number of bytes per PRD
+    static const size_t MAX_PRD_BYTES = 4 * 1024 * 1024;
     // timeout in milliseconds
     static const uint FREQ            = 1000;
     static const uint TIMEOUT         = 200;
@@ -50,9 +54,32 @@ class HostAHCIDevice : public Device {
         DET_PRESENT                   = 0x3,
     };
 
+    enum {
+        // the device supports native command queuing (IDENTIFY word 76)
+        SATA_CAP_NCQ                  = 1 << 8,
+    };
+
+    /**
+     * A request that has been split into multiple commands. It is reported to the client when
+     * the last of them has been finished.
+     */
+    struct Split {
+        explicit Split(nre::MPProducer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag)
+            : prod(prod), tag(tag), pending(1), status(0) {
+        }
+
+        nre::MPProducer<nre::Storage::Packet> *prod;
+        nre::Storage::tag_type tag;
+        // the number of unfinished commands plus one for the submitter
+        volatile ulong pending;
+        volatile uint status;
+    };
+
     struct UserTag {
-        nre::Producer<nre::Storage::Packet> *prod;
+        nre::MPProducer<nre::Storage::Packet> *prod;
         nre::Storage::tag_type tag;
+        Split *split;
+        bool exclusive;
     };
 
 public:
@@ -102,9 +129,9 @@ public:
         return port->sig;
     }
 
-    explicit HostAHCIDevice(Register *regs, uint disknr, size_t max_slots, bool dmar)
-        : Device(disknr), _sm(), _regs(regs), _clock(FREQ), _max_slots(max_slots), _dmar(dmar),
-          _bufferds(512, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::RW),
+    explicit HostAHCIDevice(Register *regs, uint disknr, size_t max_slots, bool ncq, bool dmar)
+        : Device(disknr), _regs(regs), _clock(FREQ), _max_slots(max_slots), _depth(0), _ncq(false),
+          _dmar(dmar), _bufferds(512, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::RW),
           _clds(max_slots * CL_DWORDS * 4, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::RW),
           _ctds(max_slots * (32 + MAX_PRD_COUNT * 4) * 4,
                 nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::RW),
@@ -112,8 +139,9 @@ public:
           _cl(reinterpret_cast<uint32_t*>(_clds.virt())),
           _ct(reinterpret_cast<uint32_t*>(_ctds.virt())),
           _fis(reinterpret_cast<uint32_t*>(_fisds.virt())),
-          _tag(0), _usertags(), _inprogress() {
+          _slotsm(0), _exclusive(), _issuesm(), _free(0), _usertags(), _active() {
         init();
+        init_slots(ncq);
     }
 
     virtual const char *type() const {
@@ -122,22 +150,26 @@ public:
     virtual void determine_capacity() {
         _capacity = has_lba48() ? _info.lba48MaxLBA : _info.userSectorCount;
     }
-
-    void flush(nre::Producer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag) {
-        nre::ScopedLock<nre::UserSm> guard(&_sm);
-        set_command(has_lba48() ? 0xea : 0xe7, 0, true);
-        start_command(prod, tag);
+    virtual size_t max_requests() const {
+        return _depth;
     }
-    void readwrite(nre::Producer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag,
+
+    void flush(nre::MPProducer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag);
+    /**
+     * Reads or writes the sectors described by <dma>. Requests that do not fit into a single
+     * command (too many sectors or PRDs) are split into multiple commands, which are issued as
+     * soon as a slot is available.
+     */
+    void readwrite(nre::MPProducer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag,
                    const nre::DataSpace &ds, sector_type sector, const dma_type &dma, bool write);
     void irq();
 
     void debug() {
         auto &ser = nre::Serial::get();
         ser << "AHCI is " << nre::fmt(_regs->is, "#x") << " ci " << nre::fmt(_regs->ci, "#x")
-            << " ie " << nre::fmt(_regs->ie, "#x") << " cmd " << nre::fmt(_regs->cmd, "#x")
-            << " tfd " << nre::fmt(_regs->tfd, "#x") << " tag " << nre::fmt(_tag, "#x")
-            << "\n";
+            << " sact " << nre::fmt(_regs->sact, "#x") << " ie " << nre::fmt(_regs->ie, "#x")
+            << " cmd " << nre::fmt(_regs->cmd, "#x") << " tfd " << nre::fmt(_regs->tfd, "#x")
+            << " free " << nre::fmt(_free, "#x") << " active " << nre::fmt(_active, "#x") << "\n";
     }
 
 private:
@@ -159,19 +191,45 @@ private:
         dst[1] = 0; // support 64bit mode
     }
 
+    /**
+     * @return the mask with all usable command slots set
+     */
+    uint32_t slot_mask() const {
+        return _depth == 32 ? ~0U : (1U << _depth) - 1;
+    }
+
     void init();
-    void set_command(uint8_t command, uint64_t sector, bool read, uint count = 0, bool atapi = false,
-                     uint pmp = 0, uint features = 0);
-    void add_dma(const nre::DataSpace &ds, size_t offset, uint count);
-    void add_prd(const nre::DataSpace &ds, uint count);
-    size_t start_command(nre::Producer<nre::Storage::Packet> *prod, ulong usertag);
+    void reset();
+    void init_slots(bool ncq);
+    size_t alloc_slot();
+    void free_slot(size_t slot);
+    bool claim_slot(size_t slot);
+    size_t max_sectors() const {
+        // NCQ and LBA48 use a 16-bit sector count, LBA28 an 8-bit one
+        return (_ncq || has_lba48()) ? 0x8000 : 0x80;
+    }
+    size_t chunk_size(dma_type::iterator it, dma_type::iterator end, size_t off) const;
+    void readwrite_chunk(size_t slot, const nre::DataSpace &ds, sector_type sector,
+                         dma_type::iterator &it, size_t &off, size_t bytes, bool write);
+    nre::MPProducer<nre::Storage::Packet> *complete(size_t slot, uint status, bool notify);
+    nre::MPProducer<nre::Storage::Packet> *report(nre::MPProducer<nre::Storage::Packet> *prod,
+                                                  nre::Storage::tag_type tag, uint status,
+                                                  bool notify);
+    void set_command(size_t slot, uint8_t command, uint64_t sector, bool read, uint count = 0,
+                     bool atapi = false, uint pmp = 0, uint features = 0);
+    void add_dma(size_t slot, const nre::DataSpace &ds, size_t offset, uint count);
+    void add_prd(size_t slot, const nre::DataSpace &ds, uint count);
+    void issue(size_t slot, bool queued = false);
+    void start_command(size_t slot, nre::MPProducer<nre::Storage::Packet> *prod, ulong usertag,
+                       bool queued = false, bool exclusive = false, Split *split = nullptr);
     void identify_drive(nre::DataSpace &buffer);
     uint set_features(uint features, uint count = 0);
 
-    nre::UserSm _sm;
     Register volatile *_regs;
     nre::Clock _clock;
     size_t _max_slots;
+    size_t _depth;
+    bool _ncq;
     bool _dmar;
     nre::DataSpace _bufferds;
     nre::DataSpace _clds;
@@ -180,7 +238,16 @@ private:
     uint32_t *_cl;
     uint32_t *_ct;
     uint32_t *_fis;
-    size_t _tag;
+    // counts the free slots; we block on it if all slots are in use
+    nre::UserSm _slotsm;
+    // serializes non-queued commands, which need the whole port
+    nre::UserSm _exclusive;
+    // held while a command is issued and while the port is restarted after an error, so that
+    // nobody issues commands to a stopped port and no running command is reported as failed
+    nre::UserSm _issuesm;
+    // the bitmap of free command slots
+    volatile uint32_t _free;
     UserTag _usertags[32];
-    uint _inprogress;
+    // the bitmap of issued commands whose completion has not been reported yet
+    volatile uint32_t _active;
 };
@@ -34,8 +34,70 @@ uint HostATADevice::get_command(Operation op) {
     return commands[offset][has_lba48() ? 1 : 0];
 }
 
+bool HostATADevice::start(HostIDECtrl::Request &req) {
+    if(req.cmd == Storage::FLUSH) {
+        // wait until the drive is ready
+        int res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, CMD_ST_READY, 0);
+        _ctrl.handle_status(_id, res, "Flush cache");
+
+        // select drive
+        _ctrl.outb(ATA_REG_DRIVE_SELECT, (_id & SLAVE_BIT) << 4);
+        _ctrl.ctrloutb(_ctrl.irqs_enabled() ? 0 : CTRL_NIEN);
+
+        // send command
+        _ctrl.outb(ATA_REG_COMMAND, has_lba48() ? COMMAND_FLUSH_CACHE_EXT : COMMAND_FLUSH_CACHE);
+        if(_ctrl.irqs_enabled())
+            return false;
+        finishFlush();
+        return true;
+    }
+
+    Operation op = req.cmd == Storage::READ ? READ : WRITE;
+    uint cmd = get_command(op);
+    req.busmaster = cmd == COMMAND_READ_DMA || cmd == COMMAND_READ_DMA_EXT ||
+                    cmd == COMMAND_WRITE_DMA || cmd == COMMAND_WRITE_DMA_EXT;
+    setup_command(req.sector, req.dma.bytecount() / _sector_size, cmd);
+    if(req.busmaster) {
+        transferDMA(op, *req.ds, req.dma);
+        if(_ctrl.irqs_enabled())
+            return false;
+        finishDMA();
+        return true;
+    }
+
+    if(!_ctrl.irqs_enabled()) {
+        transferPIO(op, *req.ds, _sector_size, req.dma, true);
+        return true;
+    }
+    // the drive raises an interrupt as soon as a sector can be read. for writes, it only does that
+    // after a sector has been written, i.e. we have to provide the first one right away
+    if(op == WRITE)
+        transferSector(req);
+    return false;
+}
+
+bool HostATADevice::interrupt(HostIDECtrl::Request &req) {
+    if(req.cmd == Storage::FLUSH) {
+        finishFlush();
+        return true;
+    }
+    if(req.busmaster) {
+        finishDMA();
+        return true;
+    }
+
+    // the interrupt after the last written sector tells us that the drive is done
+    if(req.cmd == Storage::WRITE && req.done == req.dma.bytecount()) {
+        int res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, 0, CMD_ST_BUSY | CMD_ST_DRQ);
+        _ctrl.handle_status(_id, res, "PIO transfer");
+        return true;
+    }
+    transferSector(req);
+    return req.cmd == Storage::READ && req.done == req.dma.bytecount();
+}
+
 void HostATADevice::readwrite(Operation op, const DataSpace &ds, sector_type sector,
-                              const dma_type &dma, producer_type *prod, tag_type tag, size_t secsize) {
+                              const dma_type &dma, size_t secsize) {
     if(secsize == 0)
         secsize = _sector_size;
     uint cmd = get_command(op);
@@ -47,38 +109,28 @@ void HostATADevice::readwrite(Operation op, const DataSpace &ds, sector_type sec
         case COMMAND_READ_SEC_EXT:
         case COMMAND_WRITE_SEC:
         case COMMAND_WRITE_SEC_EXT:
-            transferPIO(op, ds, secsize, dma, prod, tag, true);
+            transferPIO(op, ds, secsize, dma, true);
             break;
         case COMMAND_READ_DMA:
         case COMMAND_READ_DMA_EXT:
         case COMMAND_WRITE_DMA:
         case COMMAND_WRITE_DMA_EXT:
-            transferDMA(op, ds, dma, prod, tag);
+            transferDMA(op, ds, dma);
+            finishDMA();
             break;
         default:
             throw Exception(E_ARGS_INVALID, "Invalid command");
     }
 }
 
-void HostATADevice::flush_cache() {
-    // wait until the drive is ready
-    int res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, CMD_ST_READY, 0);
-    _ctrl.handle_status(_id, res, "Flush cache");
-
-    // select drive
-    _ctrl.outb(ATA_REG_DRIVE_SELECT, (_id & SLAVE_BIT) << 4);
-
-    // send command
-    _ctrl.outb(ATA_REG_COMMAND, has_lba48() ? COMMAND_FLUSH_CACHE_EXT : COMMAND_FLUSH_CACHE);
-
+void HostATADevice::finishFlush() {
     // wait until BSY and DRQ cleared; RDY should be set
-    res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, CMD_ST_READY, CMD_ST_BUSY | CMD_ST_DRQ);
+    int res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, CMD_ST_READY, CMD_ST_BUSY | CMD_ST_DRQ);
     _ctrl.handle_status(_id, res, "Flush cache");
 }
 
 void HostATADevice::transferPIO(Operation op, const DataSpace &ds, size_t secsize,
-                                const dma_type &dma, producer_type *prod, tag_type tag,
-                                bool waitfirst) {
+                                const dma_type &dma, bool waitfirst) {
     size_t offset = 0;
     size_t length = dma.bytecount();
     int res;
@@ -86,14 +138,11 @@ void HostATADevice::transferPIO(Operation op, const DataSpace &ds, size_t secsiz
         if(op == WRITE && dma.in(buffer(), secsize, offset, ds))
             VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Unable to copyin data");
         if(offset > 0 || waitfirst) {
-            if(op == READ)
-                _ctrl.wait_ready();
             res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, CMD_ST_DRQ, CMD_ST_BUSY);
             _ctrl.handle_status(_id, res, "PIO transfer");
         }
 
         // now read / write the data
-        _ctrl.start_transfer(nullptr, 0, false);
         if(op == READ)
             _ctrl.inwords(ATA_REG_DATA, reinterpret_cast<uint16_t*>(buffer()), secsize / sizeof(uint16_t));
         else
@@ -104,16 +153,29 @@ void HostATADevice::transferPIO(Operation op, const DataSpace &ds, size_t secsiz
             VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Unable to copyout data");
         offset += secsize;
     }
-    if(prod)
-        prod->produce(Storage::Packet(tag, 0));
 }
 
-void HostATADevice::transferDMA(Operation op, const DataSpace &ds, const dma_type &dma,
-                                producer_type *prod, tag_type tag) {
-    // wait until previous transfers are done
-    ATA_LOGDETAIL("Waiting for previous transfers");
-    _ctrl.wait_ready();
+void HostATADevice::transferSector(HostIDECtrl::Request &req) {
+    // the drive should be ready immediately, because it told us so by the interrupt (or it has
+    // just received the write command)
+    int res = _ctrl.wait_until(PIO_TRANSFER_TIMEOUT, CMD_ST_DRQ, CMD_ST_BUSY);
+    _ctrl.handle_status(_id, res, "PIO transfer");
+
+    uint16_t *buf = reinterpret_cast<uint16_t*>(buffer());
+    if(req.cmd == Storage::WRITE) {
+        if(req.dma.in(buf, _sector_size, req.done, *req.ds))
+            VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Unable to copyin data");
+        _ctrl.outwords(ATA_REG_DATA, buf, _sector_size / sizeof(uint16_t));
+    }
+    else {
+        _ctrl.inwords(ATA_REG_DATA, buf, _sector_size / sizeof(uint16_t));
+        if(req.dma.out(buf, _sector_size, req.done, *req.ds))
+            VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Unable to copyout data");
+    }
+    req.done += _sector_size;
+}
 
+void HostATADevice::transferDMA(Operation op, const DataSpace &ds, const dma_type &dma) {
     // setup PRDTs
     ATA_LOGDETAIL("Setting PRDs");
     HostIDECtrl::PRD *prd = _ctrl.prdt();
@@ -134,9 +196,6 @@ void HostATADevice::transferDMA(Operation op, const DataSpace &ds, const dma_typ
         prd++;
     }
 
-    // stop running transfers
-    //ATA_LOGDETAIL("Stopping running transfers");
-    //_ctrl.outbmrb(BMR_REG_COMMAND,0);
     uint8_t status = _ctrl.inbmrb(BMR_REG_STATUS) | BMR_STATUS_ERROR | BMR_STATUS_IRQ;
     _ctrl.outbmrb(BMR_REG_STATUS, status);
 
@@ -148,7 +207,6 @@ void HostATADevice::transferDMA(Operation op, const DataSpace &ds, const dma_typ
     ATA_LOGDETAIL("Starting DMA-transfer");
     _ctrl.inbmrb(BMR_REG_COMMAND);
     _ctrl.inbmrb(BMR_REG_STATUS);
-    _ctrl.start_transfer(prod, tag, true);
     // start bus-mastering
     if(op == READ)
         _ctrl.outbmrb(BMR_REG_COMMAND, BMR_CMD_START | BMR_CMD_READ);
@@ -156,17 +214,16 @@ void HostATADevice::transferDMA(Operation op, const DataSpace &ds, const dma_typ
         _ctrl.outbmrb(BMR_REG_COMMAND, BMR_CMD_START);
     _ctrl.inbmrb(BMR_REG_COMMAND);
     _ctrl.inbmrb(BMR_REG_STATUS);
+}
 
-    // now wait for an interrupt
-    //ATA_LOGDETAIL("Waiting for an interrupt");
-    //_ctrl.wait_irq();
-
-    //int res = _ctrl.wait_until(DMA_TRANSFER_TIMEOUT,0,CMD_ST_BUSY | CMD_ST_DRQ);
-    //_ctrl.handle_status(_id,res,"DMA transfer");
-
-    //_ctrl.inbmrb(BMR_REG_STATUS);
-    //_ctrl.outbmrb(BMR_REG_COMMAND,0);
-    //ATA_LOGDETAIL("DMA transfer done");
+void HostATADevice::finishDMA() {
+    int res = _ctrl.wait_until(DMA_TRANSFER_TIMEOUT, 0, CMD_ST_BUSY | CMD_ST_DRQ);
+    uint8_t status = _ctrl.inbmrb(BMR_REG_STATUS);
+    // stop bus-mastering
+    _ctrl.outbmrb(BMR_REG_COMMAND, 0);
+    _ctrl.handle_status(_id, res, "DMA transfer");
+    if(status & BMR_STATUS_ERROR)
+        VTHROW(Exception, E_FAILURE, "Device " << _id << ": DMA transfer failed");
 }
 
 void HostATADevice::setup_command(sector_type sector, sector_type count, uint cmd) {
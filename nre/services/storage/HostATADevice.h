@@ -43,18 +43,39 @@ public:
     virtual void determine_capacity() {
         _capacity = has_lba48() ? _info.lba48MaxLBA : _info.userSectorCount;
     }
-    virtual void readwrite(Operation op, const nre::DataSpace &ds, sector_type sector,
-                           const dma_type &dma, producer_type *prod, tag_type tag, size_t secsize = 0);
-    void flush_cache();
+
+    /**
+     * Starts the given request. If interrupts are enabled, it returns as soon as the command has
+     * been issued and interrupt() is called when the drive raises an interrupt. Otherwise, the
+     * request is executed completely.
+     *
+     * @param req the request
+     * @return true if the request is finished
+     * @throws Exception if something goes wrong
+     */
+    virtual bool start(HostIDECtrl::Request &req);
+
+    /**
+     * Continues the given request after an interrupt of the drive
+     *
+     * @param req the request
+     * @return true if the request is finished
+     * @throws Exception if something goes wrong
+     */
+    virtual bool interrupt(HostIDECtrl::Request &req);
 
 protected:
     uint8_t *buffer() const {
         return reinterpret_cast<uint8_t*>(_buffer.virt());
     }
+    void readwrite(Operation op, const nre::DataSpace &ds, sector_type sector, const dma_type &dma,
+                   size_t secsize = 0);
     void transferPIO(Operation op, const nre::DataSpace &ds, size_t secsize, const dma_type &dma,
-                     producer_type *prod, tag_type tag, bool waitfirst);
-    void transferDMA(Operation op, const nre::DataSpace &ds, const dma_type &dma,
-                     producer_type *prod, tag_type tag);
+                     bool waitfirst);
+    void transferSector(HostIDECtrl::Request &req);
+    void transferDMA(Operation op, const nre::DataSpace &ds, const dma_type &dma);
+    void finishDMA();
+    void finishFlush();
 
     uint get_command(Operation op);
     void setup_command(sector_type sector, sector_type count, uint cmd);
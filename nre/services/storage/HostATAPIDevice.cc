@@ -18,19 +18,19 @@
 
 using namespace nre;
 
-void HostATAPIDevice::readwrite(Operation op, const DataSpace &ds, sector_type sector,
-                                const dma_type &dma, producer_type *prod, tag_type tag,
-                                size_t secsize) {
-    if(secsize == 0)
-        secsize = _sector_size;
-    size_t count = dma.bytecount() / _sector_size;
+bool HostATAPIDevice::start(HostIDECtrl::Request &req) {
+    if(req.cmd == Storage::FLUSH)
+        return HostATADevice::start(req);
+
+    size_t count = req.dma.bytecount() / _sector_size;
+    sector_type sector = req.sector;
     uint8_t *cmd = buffer();
     memset(cmd, 0, 12);
     cmd[0] = SCSI_CMD_READ_SECTORS_EXT;
     if(!has_lba48())
         cmd[0] = SCSI_CMD_READ_SECTORS;
     // no writing here ;)
-    if(op != READ)
+    if(req.cmd != Storage::READ)
         VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Writing is not supported for ATAPI");
     if(cmd[0] == SCSI_CMD_READ_SECTORS_EXT) {
         cmd[6] = (count >> 24) & 0xFF;
@@ -46,7 +46,8 @@ void HostATAPIDevice::readwrite(Operation op, const DataSpace &ds, sector_type s
     cmd[3] = (sector >> 16) & 0xFF;
     cmd[4] = (sector >> 8) & 0xFF;
     cmd[5] = (sector >> 0) & 0xFF;
-    request(_buffer, ds, dma, prod, tag);
+    request(_buffer, *req.ds, req.dma);
+    return true;
 }
 
 void HostATAPIDevice::determine_capacity() {
@@ -56,24 +57,20 @@ void HostATAPIDevice::determine_capacity() {
     uint8_t *resp = cmd + 8;
     memset(cmd, 0, 20);
     cmd[0] = SCSI_CMD_READ_CAPACITY;
-    request(_buffer, _buffer, dma, nullptr, 0);
-    // wait until the data is available
-    _ctrl.wait_ready();
+    request(_buffer, _buffer, dma);
     _capacity = (resp[0] << 24) | (resp[1] << 16) | (resp[2] << 8) | (resp[3] << 0);
 }
 
-void HostATAPIDevice::request(const DataSpace &cmd, const DataSpace &data, const dma_type &dma,
-                              producer_type *prod, tag_type tag) {
+void HostATAPIDevice::request(const DataSpace &cmd, const DataSpace &data, const dma_type &dma) {
     // send PACKET command to drive
     dma_type cdma;
     cdma.push(DMADesc(0, 12));
-    HostATADevice::readwrite(PACKET, cmd, 0xFFFF00, cdma, nullptr, 0, 12);
-    // we don't get an interrupt in this case
-    _ctrl.stop_transfer();
+    readwrite(PACKET, cmd, 0xFFFF00, cdma, 12);
 
     // now transfer the data
     if(_ctrl.dma_enabled() && has_dma()) {
-        transferDMA(READ, data, dma, prod, tag);
+        transferDMA(READ, data, dma);
+        finishDMA();
         return;
     }
 
@@ -85,5 +82,5 @@ void HostATAPIDevice::request(const DataSpace &cmd, const DataSpace &data, const
     ATA_LOGDETAIL("Reading response-size");
     size_t size = ((size_t)_ctrl.inb(ATA_REG_ADDRESS3) << 8) | (size_t)_ctrl.inb(ATA_REG_ADDRESS2);
     // do the PIO-transfer (no check at the beginning; seems to cause trouble on some machines)
-    transferPIO(READ, data, size, dma, prod, tag, false);
+    transferPIO(READ, data, size, dma, false);
 }
@@ -25,11 +25,13 @@ public:
     }
 
     virtual void determine_capacity();
-    virtual void readwrite(Operation op, const nre::DataSpace &ds, sector_type sector,
-                           const dma_type &dma, producer_type *prod, tag_type tag, size_t secsize = 0);
+
+    /**
+     * ATAPI requests are always executed synchronously (by polling)
+     */
+    virtual bool start(HostIDECtrl::Request &req);
 
 private:
-    void request(const nre::DataSpace &cmd, const nre::DataSpace &data, const dma_type &dma,
-                 producer_type *prod, tag_type tag);
+    void request(const nre::DataSpace &cmd, const nre::DataSpace &data, const dma_type &dma);
 };
 
@@ -14,6 +14,9 @@
  * General Public License version 2 for more details.
  */
 
+#include <services/Timer.h>
+#include <Trace.h>
+
 #include "HostIDECtrl.h"
 #include "HostATADevice.h"
 #include "HostATAPIDevice.h"
@@ -22,13 +25,14 @@ using namespace nre;
 
 /* for some reason virtualbox requires an additional port (9 instead of 8). Otherwise
  * we are not able to access port (portbase + 7). */
-HostIDECtrl::HostIDECtrl(uint id, uint gsi, Ports::port_t portbase,
+HostIDECtrl::HostIDECtrl(uint id, uint gsi, cpu_t cpu, Ports::port_t portbase,
                          Ports::port_t bmportbase, uint bmportcount, bool dma)
-    : Controller(id), _dma(dma && bmportbase), _irqs(gsi), _in_progress(false), _ready(0),
+    : Controller(id), _dma(dma && bmportbase), _irqs(gsi), _poll(true),
       _ctrl(portbase, 9), _ctrlreg(portbase + ATA_REG_CONTROL, 1),
       _bm(dma && bmportbase ? new Ports(bmportbase, bmportcount) : nullptr), _clock(1000), _sm(),
-      _gsi(gsi ? new Gsi(gsi) : nullptr),
-      _prdt(Storage::MAX_DMA_DESCS * 8, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _tag(), _devs() {
+      _cpu(cpu), _gsi(gsi ? new Gsi(gsi, cpu) : nullptr),
+      _prdt(Storage::MAX_DMA_DESCS * 8, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _cur(),
+      _deadline(), _queue(), _devs() {
     // check if the bus is empty
     if(!is_bus_responding())
         VTHROW(Exception, E_NOT_FOUND, "Bus " << _id << " is floating");
@@ -38,7 +42,14 @@ HostIDECtrl::HostIDECtrl(uint id, uint gsi, Ports::port_t portbase,
         char name[32];
         nre::OStringStream os(name, sizeof(name));
         os << "ide-gsi-" << gsi;
-        Reference<GlobalThread> gt = GlobalThread::create(gsi_thread, CPU::current().log_id(), name);
+        Reference<GlobalThread> gt = GlobalThread::create(gsi_thread, _cpu, name);
+        gt->set_tls<HostIDECtrl*>(Thread::TLS_PARAM, this);
+        gt->start();
+
+        // and another one that notices if an interrupt gets lost
+        nre::OStringStream wos(name, sizeof(name));
+        wos << "ide-watchdog-" << gsi;
+        gt = GlobalThread::create(watchdog_thread, _cpu, name);
         gt->set_tls<HostIDECtrl*>(Thread::TLS_PARAM, this);
         gt->start();
     }
@@ -60,22 +71,132 @@ void HostIDECtrl::get_params(size_t drive, nre::Storage::Parameter *params) cons
     _devs[idx(drive)]->get_params(params);
 }
 
-void HostIDECtrl::read(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
-                       sector_type sector, const dma_type &dma) {
-    nre::ScopedLock<nre::UserSm> guard(&_sm);
-    _devs[idx(drive)]->readwrite(HostATADevice::READ, ds, sector, dma, prod, tag);
+void HostIDECtrl::read(size_t drive, const Reference<ServiceSession> &sess, producer_type *prod,
+                       tag_type tag, const nre::DataSpace &ds, sector_type sector,
+                       const dma_type &dma) {
+    submit(new Request(_devs[idx(drive)], Storage::READ, &ds, sector, dma, sess, prod, tag));
 }
 
-void HostIDECtrl::write(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
-                        sector_type sector, const dma_type &dma) {
-    nre::ScopedLock<nre::UserSm> guard(&_sm);
-    _devs[idx(drive)]->readwrite(HostATADevice::WRITE, ds, sector, dma, prod, tag);
+void HostIDECtrl::write(size_t drive, const Reference<ServiceSession> &sess, producer_type *prod,
+                        tag_type tag, const nre::DataSpace &ds, sector_type sector,
+                        const dma_type &dma) {
+    submit(new Request(_devs[idx(drive)], Storage::WRITE, &ds, sector, dma, sess, prod, tag));
 }
 
-void HostIDECtrl::flush(size_t drive, producer_type *prod, tag_type tag) {
+void HostIDECtrl::flush(size_t drive, const Reference<ServiceSession> &sess, producer_type *prod,
+                        tag_type tag) {
+    submit(new Request(_devs[idx(drive)], Storage::FLUSH, nullptr, 0, dma_type(), sess, prod,
+                       tag));
+}
+
+void HostIDECtrl::submit(Request *req) {
     nre::ScopedLock<nre::UserSm> guard(&_sm);
-    _devs[idx(drive)]->flush_cache();
-    prod->produce(nre::Storage::Packet(tag, 0));
+    _queue.append(req);
+    if(!_cur)
+        start_next();
+}
+
+void HostIDECtrl::start_next() {
+    // commands that are finished immediately (polling, errors) let us continue with the next one
+    while(!_cur && _queue.length() > 0) {
+        _cur = &*_queue.begin();
+        _queue.remove(_cur);
+        // ATAPI devices are not interrupt-driven
+        _poll = !_irqs || _cur->dev->is_atapi();
+        _cur->tries++;
+        try {
+            if(_cur->dev->start(*_cur))
+                finish(0);
+            else
+                _deadline = _clock.source_time(IRQ_TIMEOUT);
+        }
+        catch(const Exception &e) {
+            ATA_LOG("Request " << fmt(_cur->tag, "#x") << " failed: " << e.msg());
+            finish(e.code());
+        }
+    }
+}
+
+void HostIDECtrl::finish(uint status) {
+    _cur->prod->produce(nre::Storage::Packet(_cur->tag, status));
+    delete _cur;
+    _cur = nullptr;
+    _deadline = 0;
+}
+
+void HostIDECtrl::reset() {
+    if(_bm)
+        outbmrb(BMR_REG_COMMAND, 0);
+    ctrloutb(CTRL_SOFTWARE_RESET | CTRL_NIEN);
+    wait();
+    ctrloutb(CTRL_NIEN);
+    wait_until(ATA_WAIT_TIMEOUT, 0, CMD_ST_BUSY);
+    // acknowledge a potentially pending interrupt
+    inb(ATA_REG_STATUS);
+}
+
+void HostIDECtrl::timeout() {
+    ATA_LOG("Request " << fmt(_cur->tag, "#x") << " timed out (try " << _cur->tries << ")");
+    reset();
+    if(_cur->tries < MAX_TRIES) {
+        // start it again from the beginning
+        _cur->busmaster = false;
+        _cur->done = 0;
+        _queue.insert(nullptr, _cur);
+        _cur = nullptr;
+        _deadline = 0;
+    }
+    else
+        finish(E_TIMEOUT);
+    start_next();
+}
+
+void HostIDECtrl::gsi_thread(void*) {
+    HostIDECtrl *ctrl = Thread::current()->get_tls<HostIDECtrl*>(Thread::TLS_PARAM);
+    while(1) {
+        ctrl->_gsi->down();
+        TRACE(STORAGE, STORAGE_IRQ_BEGIN, ctrl->_gsi->gsi(), ctrl->_id);
+
+        LOG(STORAGE_DETAIL, "Got GSI " << ctrl->_gsi->gsi() << "\n");
+        nre::ScopedLock<nre::UserSm> guard(&ctrl->_sm);
+        if(!ctrl->_cur || ctrl->_poll) {
+            // nobody waits for it; just acknowledge it
+            ctrl->inb(ATA_REG_STATUS);
+            TRACE(STORAGE, STORAGE_IRQ_END, ctrl->_gsi->gsi(), ctrl->_id);
+            continue;
+        }
+
+        try {
+            if(ctrl->_cur->dev->interrupt(*ctrl->_cur))
+                ctrl->finish(0);
+            else
+                ctrl->_deadline = ctrl->_clock.source_time(IRQ_TIMEOUT);
+        }
+        catch(const Exception &e) {
+            ATA_LOG("Request " << fmt(ctrl->_cur->tag, "#x") << " failed: " << e.msg());
+            ctrl->finish(e.code());
+        }
+        ctrl->start_next();
+        TRACE(STORAGE, STORAGE_IRQ_END, ctrl->_gsi->gsi(), ctrl->_id);
+    }
+}
+
+void HostIDECtrl::watchdog_thread(void*) {
+    HostIDECtrl *ctrl = Thread::current()->get_tls<HostIDECtrl*>(Thread::TLS_PARAM);
+    try {
+        TimerSession timer("timer");
+        while(1) {
+            timer.wait_until(ctrl->_clock.source_time(IRQ_TIMEOUT / 2));
+
+            nre::ScopedLock<nre::UserSm> guard(&ctrl->_sm);
+            if(ctrl->_cur && !ctrl->_poll && ctrl->_deadline &&
+               ctrl->_clock.source_time() >= ctrl->_deadline)
+                ctrl->timeout();
+        }
+    }
+    catch(const Exception &e) {
+        ATA_LOG("Unable to watch for lost interrupts: " << e.msg());
+    }
 }
 
 HostATADevice *HostIDECtrl::detect_drive(uint id) {
@@ -21,6 +21,9 @@
 #include <kobj/GlobalThread.h>
 #include <kobj/Sc.h>
 #include <util/Clock.h>
+#include <collection/SList.h>
+#include <ipc/ServiceSession.h>
+#include <util/Reference.h>
 #include <Logging.h>
 
 #include "Device.h"
@@ -28,13 +31,12 @@
 
 class HostATADevice;
 
+/**
+ * A driver for the legacy IDE controller. Requests are queued per channel; submission returns
+ * immediately and the interrupt of the current command starts the next one. If the interrupt
+ * does not arrive within IRQ_TIMEOUT, the channel is reset and the command is retried.
+ */
 class HostIDECtrl : public Controller {
-    struct UserTag {
-        nre::Producer<nre::Storage::Packet> *prod;
-        nre::Storage::tag_type tag;
-        bool dma;
-    };
-
 public:
     // physical region descriptor
     struct PRD {
@@ -44,8 +46,37 @@ public:
         uint16_t last : 1;
     } PACKED;
 
-    explicit HostIDECtrl(uint id, uint irq, nre::Ports::port_t portbase, nre::Ports::port_t bmportbase,
-                         uint bmportcount, bool dma = true);
+    /**
+     * A queued request for one of the drives of the channel
+     */
+    struct Request : public nre::SListItem {
+        explicit Request(HostATADevice *dev, nre::Storage::Command cmd, const nre::DataSpace *ds,
+                         sector_type sector, const dma_type &dma,
+                         const nre::Reference<nre::ServiceSession> &sess, producer_type *prod,
+                         tag_type tag)
+            : nre::SListItem(), dev(dev), cmd(cmd), ds(ds), sector(sector), dma(dma), sess(sess),
+              prod(prod), tag(tag), busmaster(false), done(0), tries(0) {
+        }
+
+        HostATADevice *dev;
+        nre::Storage::Command cmd;
+        const nre::DataSpace *ds;
+        sector_type sector;
+        dma_type dma;
+        // keeps <ds> and <prod> alive while the request is queued
+        nre::Reference<nre::ServiceSession> sess;
+        producer_type *prod;
+        tag_type tag;
+        // whether the transfer is done via DMA
+        bool busmaster;
+        // the number of bytes transferred so far via PIO
+        size_t done;
+        // the number of times the command has been started
+        uint tries;
+    };
+
+    explicit HostIDECtrl(uint id, uint irq, cpu_t cpu, nre::Ports::port_t portbase,
+                         nre::Ports::port_t bmportbase, uint bmportcount, bool dma = true);
     virtual ~HostIDECtrl() {
         delete _bm;
     }
@@ -58,10 +89,16 @@ public:
     }
 
     virtual void get_params(size_t drive, nre::Storage::Parameter *params) const;
-    virtual void flush(size_t drive, producer_type *prod, tag_type tag);
-    virtual void read(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
+    virtual cpu_t completion_cpu(size_t) const {
+        return _cpu;
+    }
+    virtual void flush(size_t drive, const nre::Reference<nre::ServiceSession> &sess,
+                       producer_type *prod, tag_type tag);
+    virtual void read(size_t drive, const nre::Reference<nre::ServiceSession> &sess,
+                      producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                       sector_type sector, const dma_type &dma);
-    virtual void write(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
+    virtual void write(size_t drive, const nre::Reference<nre::ServiceSession> &sess,
+                       producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                        sector_type sector, const dma_type &dma);
 
     /**
@@ -71,10 +108,10 @@ public:
         return _dma;
     }
     /**
-     * @return whether interrupts should be used
+     * @return whether interrupts should be used for the current command. Otherwise, we poll.
      */
     bool irqs_enabled() const {
-        return _irqs;
+        return _irqs && !_poll;
     }
 
     /**
@@ -87,32 +124,6 @@ public:
         inb(ATA_REG_STATUS);
     }
 
-    /**
-     * Stores that we're waiting for the result of a transfer. You should do that before actually
-     * starting the transfer.
-     */
-    void start_transfer(producer_type *prod, tag_type tag, bool dma) {
-        _tag.prod = prod;
-        _tag.tag = tag;
-        _tag.dma = dma;
-        _in_progress = true;
-    }
-
-    /**
-     * Stores that we're not waiting anymore. So, it assumes that the transfer is finished.
-     */
-    void stop_transfer() {
-        _in_progress = false;
-    }
-
-    /**
-     * Waits until a new transfer can be started, if necessary
-     */
-    void wait_ready() {
-        if(_irqs && _in_progress)
-            _ready.zero();
-    }
-
     /**
      * Waits for <set> to set and <unset> to unset in the status-register.
      * It gives up as soon as <timeout> is reached.
@@ -197,6 +208,9 @@ public:
     }
 
 private:
+    // how often a command is started before we give up on it
+    static const uint MAX_TRIES = 3;
+
     static size_t idx(size_t drive) {
         return drive % nre::Storage::MAX_DRIVES;
     }
@@ -204,45 +218,29 @@ private:
     HostATADevice *detect_drive(uint id);
     HostATADevice *identify(uint id, uint cmd);
 
-    static void gsi_thread(void *) {
-        HostIDECtrl *ctrl = nre::Thread::current()->get_tls<HostIDECtrl*>(nre::Thread::TLS_PARAM);
-        while(1) {
-            ctrl->_gsi->down();
-
-            LOG(STORAGE_DETAIL, "Got GSI " << ctrl->_gsi->gsi() << "\n");
-            uint status = 0;
-            if(ctrl->_tag.dma) {
-                int res = ctrl->wait_until(DMA_TRANSFER_TIMEOUT, 0, CMD_ST_BUSY | CMD_ST_DRQ);
-                if(res != 0)
-                    status = 1;
-
-                ctrl->inbmrb(BMR_REG_STATUS);
-                ctrl->outbmrb(BMR_REG_COMMAND, 0);
-            }
-            if(ctrl->_tag.prod)
-                ctrl->_tag.prod->produce(nre::Storage::Packet(ctrl->_tag.tag, status));
-            ctrl->_ready.up();
-            ctrl->_in_progress = false;
-            // just in case we receive another interrupt
-            // TODO this is not enough. we have to use the session-id and check whether the session
-            // still exists. because the user might have closed it between a transfer-start and
-            // the completion
-            ctrl->_tag.prod = nullptr;
-            ctrl->_tag.dma = false;
-        }
-    }
+    void submit(Request *req);
+    void start_next();
+    void finish(uint status);
+    void reset();
+    void timeout();
+    static void gsi_thread(void *);
+    static void watchdog_thread(void *);
 
     bool _dma;
     bool _irqs;
-    bool _in_progress;
-    nre::Sm _ready;
+    bool _poll;
     nre::Ports _ctrl;
     nre::Ports _ctrlreg;
     nre::Ports *_bm;
     nre::Clock _clock;
     nre::UserSm _sm;
+    cpu_t _cpu;
     nre::Gsi *_gsi;
     nre::DataSpace _prdt;
-    UserTag _tag;
+    // the request that is currently executed by the drive and the waiting ones
+    Request *_cur;
+    // until when we wait for the interrupt of the current command (0 = we don't)
+    timevalue_t _deadline;
+    nre::SList<Request> _queue;
     HostATADevice *_devs[2];
 };
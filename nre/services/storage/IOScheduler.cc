@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <util/ScopedLock.h>
+#include <Logging.h>
+#include <Trace.h>
+
+#include "IOScheduler.h"
+
+using namespace nre;
+
+// in milliseconds
+const timevalue_t IOScheduler::_deadlines[PRIO_COUNT] = {
+    /* PRIO_REALTIME */ 10,
+    /* PRIO_NORMAL */   250,
+    /* PRIO_IDLE */     5000,
+};
+
+IOScheduler::IOScheduler(ControllerMng *mng, BlockCache *cache)
+    : _mng(mng), _cache(cache), _clock(1000), _drives(new Drive[MAX_DRIVES]), _issue(), _sm(),
+      // the ring uses only a power of two of the available slots (including the sequence number)
+      _compds(Math::round_up<size_t>(2 * (MAX_DRIVES * MAX_DEPTH + 1) *
+                                     (sizeof(Storage::Packet) + sizeof(size_t)),
+                                     ExecEnv::PAGE_SIZE),
+              DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW),
+      _compsm(0), _prod(_compds, _compsm, true), _cons(_compds, _compsm, false), _gt() {
+    _gt = GlobalThread::create(completion_thread, CPU::current().log_id(), "storage-sched");
+    _gt->set_tls<IOScheduler*>(Thread::TLS_PARAM, this);
+    _gt->start();
+}
+
+void IOScheduler::submit(Client &client, const Reference<ServiceSession> &sess,
+                         producer_type *prod, tag_type tag, const DataSpace *ds,
+                         const Storage::Parameter &params, Storage::Command cmd, size_t drive,
+                         sector_type sector, const dma_type &dma) {
+    Request *req = new Request(sess, &client, prod, tag, ds, &params, cmd, drive, sector, dma);
+    req->deadline = _clock.source_time(_deadlines[client.prio]);
+
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        Drive &drv = _drives[drive];
+        if(EXPECT_FALSE(drv.depth == 0))
+            drv.depth = Math::min<size_t>(Math::max<size_t>(params.max_requests, 1), MAX_DEPTH);
+        // weighted fair queueing: the request starts when the previous one of the session is
+        // finished, but not before the current virtual time of the drive
+        uint64_t cost = Math::max<size_t>(dma.bytecount(), params.sector_size);
+        req->vstart = Math::max(drv.vtime, client.vfinish);
+        req->vfinish = req->vstart + cost / client.weight;
+        client.vfinish = req->vfinish;
+
+        drv.queues[client.prio].append(req);
+        schedule(drv);
+    }
+    issue();
+}
+
+bool IOScheduler::ordered(Request *prev, Request *req) {
+    if(prev->client != req->client)
+        return false;
+    // a FLUSH is a barrier for the requests of the session. that is, it has to wait for all
+    // requests that have been submitted before and all later ones have to wait for the FLUSH
+    if(req->cmd == Storage::FLUSH || prev->cmd == Storage::FLUSH)
+        return true;
+    // don't reorder overlapping requests if one of them writes
+    return (req->cmd == Storage::WRITE || prev->cmd == Storage::WRITE) &&
+           Math::overlapped(prev->sector, prev->count(), req->sector, req->count());
+}
+
+bool IOScheduler::eligible(Drive &drv, DList<Request> &queue, Request *req) {
+    // the drive may reorder the requests in flight (NCQ). thus, they count as well
+    for(auto it = drv.inflight.begin(); it != drv.inflight.end(); ++it) {
+        if(ordered(&*it, req))
+            return false;
+    }
+    for(auto it = queue.begin(); it != queue.end() && &*it != req; ++it) {
+        if(ordered(&*it, req))
+            return false;
+    }
+    return true;
+}
+
+void IOScheduler::schedule(Drive &drv) {
+    while(drv.inflight.length() < drv.depth) {
+        Request *req = pick(drv);
+        if(!req)
+            break;
+        dispatch(drv, req);
+    }
+}
+
+IOScheduler::Request *IOScheduler::pick(Drive &drv) {
+    // first, take care of the requests that wait for too long already
+    timevalue_t now = _clock.source_time();
+    for(size_t prio = 0; prio < PRIO_COUNT; ++prio) {
+        DList<Request> &queue = drv.queues[prio];
+        for(auto it = queue.begin(); it != queue.end(); ++it) {
+            if(it->deadline <= now && eligible(drv, queue, &*it)) {
+                merge(drv, queue, &*it);
+                return &*it;
+            }
+        }
+    }
+
+    for(size_t prio = 0; prio < PRIO_COUNT; ++prio) {
+        DList<Request> &queue = drv.queues[prio];
+        if(queue.length() == 0)
+            continue;
+
+        // the idle class only gets the drive if nobody else uses it
+        if(prio == Storage::PRIO_IDLE && drv.inflight.length() > 0)
+            return nullptr;
+
+        // choose the session that is most behind its share
+        Request *first = nullptr;
+        for(auto it = queue.begin(); it != queue.end(); ++it) {
+            if((!first || it->vfinish < first->vfinish) && eligible(drv, queue, &*it))
+                first = &*it;
+        }
+        if(!first)
+            continue;
+
+        drv.vtime = Math::max(drv.vtime, first->vstart);
+        Request *req = first;
+        bool rotational = !(first->params->flags & Storage::Parameter::FLAG_NONROTATIONAL);
+        if(first->cmd != Storage::FLUSH && rotational)
+            req = pick_elevator(drv, queue, first);
+        merge(drv, queue, req);
+        return req;
+    }
+    return nullptr;
+}
+
+IOScheduler::Request *IOScheduler::pick_elevator(Drive &drv, DList<Request> &queue,
+                                                 Request *first) {
+    // C-SCAN: the nearest request in front of the head; if there is none, the lowest one
+    Request *next = nullptr, *lowest = nullptr;
+    for(auto it = queue.begin(); it != queue.end(); ++it) {
+        Request *r = &*it;
+        if(r->client != first->client || r->cmd == Storage::FLUSH || !eligible(drv, queue, r))
+            continue;
+        if(r->sector >= drv.head && (!next || r->sector < next->sector))
+            next = r;
+        if(!lowest || r->sector < lowest->sector)
+            lowest = r;
+    }
+    return next ? next : lowest;
+}
+
+void IOScheduler::merge(Drive &drv, DList<Request> &queue, Request *req) {
+    if(req->cmd == Storage::FLUSH)
+        return;
+
+    bool merged;
+    do {
+        merged = false;
+        for(auto it = queue.begin(); it != queue.end(); ++it) {
+            Request *r = &*it;
+            if(r == req || r->client != req->client || r->cmd != req->cmd ||
+               !eligible(drv, queue, r))
+                continue;
+            if(r->dma.count() + req->dma.count() > Storage::MAX_DMA_DESCS ||
+               r->dma.bytecount() + req->dma.bytecount() > MAX_MERGE_SIZE)
+                continue;
+
+            if(r->sector == req->sector + req->count()) {
+                // append it
+                for(auto d = r->dma.begin(); d != r->dma.end(); ++d)
+                    req->dma.push(*d);
+            }
+            else if(r->sector + r->count() == req->sector) {
+                // prepend it
+                dma_type dma(r->dma);
+                for(auto d = req->dma.begin(); d != req->dma.end(); ++d)
+                    dma.push(*d);
+                req->dma = dma;
+                req->sector = r->sector;
+            }
+            else
+                continue;
+
+            queue.remove(r);
+            r->merged = req->merged;
+            req->merged = r;
+            merged = true;
+            break;
+        }
+    }
+    while(merged);
+}
+
+void IOScheduler::dispatch(Drive &drv, Request *req) {
+    drv.queues[req->client->prio].remove(req);
+    drv.inflight.append(req);
+    if(req->cmd != Storage::FLUSH)
+        drv.head = req->sector + req->count();
+
+    LOG(STORAGE_DETAIL, "[" << req->sess->id() << "," << fmt(req->tag, "#x") << "] dispatching "
+                            << (req->merged ? "merged " : "") << "request @ " << req->sector
+                            << " with " << req->dma << "\n");
+
+    TRACE(STORAGE, STORAGE_DISPATCH, req->sector, req->dma.bytecount());
+
+    _issue.append(new Issue(req));
+}
+
+void IOScheduler::issue() {
+    while(1) {
+        Request *req;
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            if(_issue.length() == 0)
+                break;
+            Issue *is = &*_issue.begin();
+            _issue.remove(is);
+            req = is->req;
+            delete is;
+        }
+
+        // the completion comes back to us; we use the request as tag. until then, the request
+        // stays in the in-flight list of the drive and is not touched by anybody else.
+        tag_type tag = reinterpret_cast<tag_type>(req);
+        try {
+            if(_cache) {
+                if(req->cmd == Storage::FLUSH)
+                    _cache->flush(req->sess, &_prod, tag, *req->params, req->drive);
+                else if(req->cmd == Storage::READ) {
+                    _cache->read(req->sess, &_prod, tag, *req->ds, *req->params, req->drive,
+                                 req->sector, req->dma, req->client->stream);
+                }
+                else {
+                    _cache->write(req->sess, &_prod, tag, *req->ds, *req->params, req->drive,
+                                  req->sector, req->dma);
+                }
+            }
+            else {
+                Controller *ctrl = _mng->get(req->drive / Storage::MAX_DRIVES);
+                if(req->cmd == Storage::FLUSH)
+                    ctrl->flush(req->drive, req->sess, &_prod, tag);
+                else if(req->cmd == Storage::READ)
+                    ctrl->read(req->drive, req->sess, &_prod, tag, *req->ds, req->sector,
+                               req->dma);
+                else
+                    ctrl->write(req->drive, req->sess, &_prod, tag, *req->ds, req->sector,
+                                req->dma);
+            }
+        }
+        catch(const Exception &e) {
+            LOG(STORAGE, "[" << req->sess->id() << "," << fmt(req->tag, "#x")
+                             << "] Request failed: " << e.msg() << "\n");
+            ScopedLock<UserSm> guard(&_sm);
+            Drive &drv = _drives[req->drive];
+            drv.inflight.remove(req);
+            complete(req, e.code());
+            schedule(drv);
+        }
+    }
+}
+
+void IOScheduler::complete(Request *req, uint status) {
+    while(req) {
+        Request *next = req->merged;
+        TRACE(STORAGE, STORAGE_COMPLETE, req->tag, status);
+        req->prod->produce(Storage::Packet(req->tag, status));
+        delete req;
+        req = next;
+    }
+}
+
+void IOScheduler::completion_thread(void*) {
+    IOScheduler *sched = Thread::current()->get_tls<IOScheduler*>(Thread::TLS_PARAM);
+    while(1) {
+        // wait for the next completion
+        sched->_cons.get();
+
+        {
+            ScopedLock<UserSm> guard(&sched->_sm);
+            // the drives that have capacity for new requests now
+            size_t drives[MAX_DRIVES];
+            size_t count = 0;
+            // release all available completions at once
+            for(size_t n; (n = sched->_cons.available()) > 0; sched->_cons.next(n)) {
+                for(size_t j = 0; j < n; ++j) {
+                    Storage::Packet *pk = sched->_cons.get(j);
+                    Request *req = reinterpret_cast<Request*>(pk->tag);
+                    Drive &drv = sched->_drives[req->drive];
+                    size_t i;
+                    for(i = 0; i < count && drives[i] != req->drive; ++i)
+                        ;
+                    if(i == count)
+                        drives[count++] = req->drive;
+                    drv.inflight.remove(req);
+                    sched->complete(req, pk->status);
+                }
+            }
+            for(size_t i = 0; i < count; ++i)
+                sched->schedule(sched->_drives[drives[i]]);
+        }
+        sched->issue();
+    }
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <kobj/Sm.h>
+#include <kobj/UserSm.h>
+#include <kobj/GlobalThread.h>
+#include <ipc/ServiceSession.h>
+#include <ipc/MPProducer.h>
+#include <ipc/MPConsumer.h>
+#include <mem/DataSpace.h>
+#include <collection/DList.h>
+#include <collection/SList.h>
+#include <services/Storage.h>
+#include <util/Reference.h>
+#include <util/Clock.h>
+
+#include "ControllerMng.h"
+#include "BlockCache.h"
+
+/**
+ * Decides in which order the requests of the sessions are passed to the drives. It keeps as many
+ * requests per drive in flight as the drive can queue (at most MAX_DEPTH) and chooses the next one
+ * as follows:
+ *  1. the highest priority class with pending requests wins. the idle class is only served if the
+ *     drive has nothing else to do.
+ *  2. requests that have exceeded the deadline of their class are dispatched in arrival order.
+ *  3. otherwise, the session with the smallest virtual finish time is chosen (weighted fair
+ *     queueing) and, for rotational drives, its request that is next in C-SCAN order.
+ * Before dispatching, adjacent requests of the same session are merged into one. A request is never
+ * moved in front of a FLUSH or an overlapping write of its session, whether queued or in flight.
+ */
+class IOScheduler {
+    typedef nre::Storage::sector_type sector_type;
+    typedef nre::Storage::tag_type tag_type;
+    typedef nre::Storage::dma_type dma_type;
+    typedef nre::MPProducer<nre::Storage::Packet> producer_type;
+
+    static const size_t PRIO_COUNT      = nre::Storage::PRIO_IDLE + 1;
+    static const size_t MAX_DRIVES      = nre::Storage::MAX_CONTROLLER * nre::Storage::MAX_DRIVES;
+    // the number of command slots of AHCI
+    static const size_t MAX_DEPTH       = 32;
+    // merged requests are not made larger than that
+    static const size_t MAX_MERGE_SIZE  = 1024 * 1024;
+
+public:
+    /**
+     * The per-session scheduling state
+     */
+    struct Client {
+        explicit Client(nre::Storage::Priority prio, uint weight)
+            : prio(prio), weight(weight), vfinish(), stream() {
+        }
+
+        nre::Storage::Priority prio;
+        uint weight;
+        // the virtual finish time of the last request
+        uint64_t vfinish;
+        BlockCache::Stream stream;
+    };
+
+private:
+    struct Request : public nre::DListItem {
+        explicit Request(const nre::Reference<nre::ServiceSession> &sess, Client *client,
+                         producer_type *prod, tag_type tag, const nre::DataSpace *ds,
+                         const nre::Storage::Parameter *params, nre::Storage::Command cmd,
+                         size_t drive, sector_type sector, const dma_type &dma)
+            : nre::DListItem(), sess(sess), client(client), prod(prod), tag(tag), ds(ds),
+              params(params), cmd(cmd), drive(drive), sector(sector), dma(dma), vstart(),
+              vfinish(), deadline(), merged() {
+        }
+
+        sector_type count() const {
+            return dma.bytecount() / params->sector_size;
+        }
+
+        nre::Reference<nre::ServiceSession> sess;
+        Client *client;
+        producer_type *prod;
+        tag_type tag;
+        const nre::DataSpace *ds;
+        const nre::Storage::Parameter *params;
+        nre::Storage::Command cmd;
+        size_t drive;
+        sector_type sector;
+        dma_type dma;
+        uint64_t vstart;
+        uint64_t vfinish;
+        timevalue_t deadline;
+        // the requests that have been merged into this one
+        Request *merged;
+    };
+
+    /**
+     * A dispatched request that has to be passed to the cache or controller. This is done after
+     * releasing _sm, because they might block (e.g. until a command slot is free).
+     */
+    struct Issue : public nre::SListItem {
+        explicit Issue(Request *req) : nre::SListItem(), req(req) {
+        }
+
+        Request *req;
+    };
+
+    struct Drive {
+        explicit Drive() : queues(), inflight(), depth(), head(), vtime() {
+        }
+
+        // the pending requests per priority class in arrival order
+        nre::DList<Request> queues[PRIO_COUNT];
+        // the dispatched requests that are not finished yet
+        nre::DList<Request> inflight;
+        // the maximum number of requests in flight
+        size_t depth;
+        // the sector behind the last dispatched request
+        sector_type head;
+        uint64_t vtime;
+    };
+
+public:
+    /**
+     * Creates the scheduler
+     *
+     * @param mng the controller manager
+     * @param cache the block cache to pass the requests to (nullptr = directly to the controller)
+     */
+    explicit IOScheduler(ControllerMng *mng, BlockCache *cache);
+
+    /**
+     * Queues the given request and dispatches requests to the drive, if possible. The completion
+     * is reported via <prod>.
+     *
+     * @param client the scheduling state of the session
+     * @param sess the session (is kept alive as long as the request exists)
+     * @param prod the producer to notify when the command is finished
+     * @param tag the tag to use for the notify
+     * @param ds the dataspace of the client (nullptr for FLUSH)
+     * @param params the parameters of the drive
+     * @param cmd the command (READ, WRITE or FLUSH)
+     * @param drive the drive number
+     * @param sector the start-sector
+     * @param dma the DMA descriptor list
+     */
+    void submit(Client &client, const nre::Reference<nre::ServiceSession> &sess,
+                producer_type *prod, tag_type tag, const nre::DataSpace *ds,
+                const nre::Storage::Parameter &params, nre::Storage::Command cmd, size_t drive,
+                sector_type sector, const dma_type &dma);
+
+private:
+    static bool ordered(Request *prev, Request *req);
+    static bool eligible(Drive &drv, nre::DList<Request> &queue, Request *req);
+    void schedule(Drive &drv);
+    Request *pick(Drive &drv);
+    Request *pick_elevator(Drive &drv, nre::DList<Request> &queue, Request *first);
+    void merge(Drive &drv, nre::DList<Request> &queue, Request *req);
+    void dispatch(Drive &drv, Request *req);
+    void issue();
+    void complete(Request *req, uint status);
+    static void completion_thread(void*);
+
+    ControllerMng *_mng;
+    BlockCache *_cache;
+    nre::Clock _clock;
+    Drive *_drives;
+    nre::SList<Issue> _issue;
+    nre::UserSm _sm;
+    nre::DataSpace _compds;
+    nre::Sm _compsm;
+    producer_type _prod;
+    nre::MPConsumer<nre::Storage::Packet> _cons;
+    nre::Reference<nre::GlobalThread> _gt;
+    static const timevalue_t _deadlines[PRIO_COUNT];
+};
@@ -15,15 +15,22 @@
  */
 
 #include <kobj/Sm.h>
-#include <ipc/Producer.h>
+#include <kobj/UserSm.h>
+#include <kobj/GlobalThread.h>
+#include <ipc/MPProducer.h>
+#include <ipc/Consumer.h>
 #include <services/PCIConfig.h>
 #include <services/ACPI.h>
 #include <stream/IStringStream.h>
 #include <util/PCI.h>
+#include <util/ScopedLock.h>
 #include <Logging.h>
+#include <Trace.h>
 #include <cstring>
 
 #include "ControllerMng.h"
+#include "BlockCache.h"
+#include "IOScheduler.h"
 
 using namespace nre;
 
@@ -33,19 +40,48 @@ class StorageService;
 // when we put the object here instead of a pointer??
 static ControllerMng *mng;
 static StorageService *srv;
+static BlockCache *cache;
+static IOScheduler *sched;
 
 class StorageServiceSession : public ServiceSession {
 public:
-    explicit StorageServiceSession(Service *s, size_t id, portal_func func, size_t drive)
-        : ServiceSession(s, id, func), _ctrlds(), _sm(), _prod(), _datads(), _drive(drive) {
+    explicit StorageServiceSession(Service *s, size_t id, portal_func func, size_t drive,
+                                   Storage::Priority prio, uint weight)
+        : ServiceSession(s, id, func), _ctrlds(), _sm(), _prod(), _datads(), _subds(), _subsm(),
+          _cons(), _gt(), _lock(), _stopped(false), _drive(drive), _params(),
+          _client(prio, weight) {
     }
     virtual ~StorageServiceSession() {
+        delete _cons;
+        delete _subsm;
+        delete _subds;
         delete _ctrlds;
         delete _sm;
         delete _prod;
         delete _datads;
     }
 
+    static void *operator new(size_t size) {
+        return _slab.alloc(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        _slab.free(ptr, size);
+    }
+
+    virtual void invalidate() {
+        {
+            ScopedLock<UserSm> guard(&_lock);
+            _stopped = true;
+        }
+        // the destructor deletes the consumer and the dataspaces it works with. thus, we have to
+        // wait here until the thread is gone. this way, it does also not hold references to us
+        // anymore, so that it never runs the destructor itself.
+        if(_gt.valid()) {
+            _cons->stop();
+            _gt->join();
+        }
+    }
+
     bool initialized() const {
         return _ctrlds != 0;
     }
@@ -61,57 +97,195 @@ public:
     const Storage::Parameter &params() const {
         return _params;
     }
-    Producer<Storage::Packet> *prod() {
+    MPProducer<Storage::Packet> *prod() {
         return _prod;
     }
+    IOScheduler::Client &client() {
+        return _client;
+    }
 
-    void init(DataSpace *ctrlds, DataSpace *data, Sm *sm) {
+    void init(DataSpace *ctrlds, DataSpace *data, Sm *sm, DataSpace *subds, Sm *subsm) {
+        // don't start the consumer if invalidate() is already running
+        ScopedLock<UserSm> guard(&_lock);
+        if(_stopped)
+            throw Exception(E_ABORT, "Session is being destroyed");
         if(_ctrlds)
             throw Exception(E_EXISTS, "Already initialized");
         _ctrlds = ctrlds;
         _sm = sm;
-        _prod = new Producer<Storage::Packet>(*_ctrlds, *_sm, false);
+        _prod = new MPProducer<Storage::Packet>(*_ctrlds, *_sm, false);
         _datads = data;
+        _subds = subds;
+        _subsm = subsm;
+        _cons = new Consumer<Storage::Request>(*_subds, *_subsm, false);
         mng->get(_drive / Storage::MAX_DRIVES)->get_params(_drive, &_params);
+        // submit the requests on the CPU that handles their completions
+        cpu_t cpu = mng->get(ctrl())->completion_cpu(_drive);
+        _gt = GlobalThread::create(consumer_thread, cpu, "storage-consumer");
+        _gt->set_tls(Thread::TLS_PARAM, this);
+        _gt->start();
     }
 
 private:
+    static void consumer_thread(void*);
+
     DataSpace *_ctrlds;
     Sm *_sm;
-    Producer<Storage::Packet> *_prod;
+    MPProducer<Storage::Packet> *_prod;
     DataSpace *_datads;
+    DataSpace *_subds;
+    Sm *_subsm;
+    Consumer<Storage::Request> *_cons;
+    Reference<GlobalThread> _gt;
+    UserSm _lock;
+    volatile bool _stopped;
     size_t _drive;
     Storage::Parameter _params;
+    IOScheduler::Client _client;
+    static Slab<StorageServiceSession> _slab;
 };
 
+Slab<StorageServiceSession> StorageServiceSession::_slab;
+
 class StorageService : public Service {
 public:
     explicit StorageService(const char *name)
         : Service(name, CPUSet(CPUSet::ALL), reinterpret_cast<portal_func>(portal)) {
-        // we want to accept two dataspaces
+        // we want to accept three dataspaces and two sms
         for(auto it = CPU::begin(); it != CPU::end(); ++it) {
             Reference<LocalThread> ec = get_thread(it->log_id());
             UtcbFrameRef uf(ec->utcb());
-            uf.accept_delegates(2);
+            uf.accept_delegates(3);
         }
     }
 
+    static void flush(StorageServiceSession *sess, Storage::tag_type tag);
+    static void readwrite(StorageServiceSession *sess, Storage::Command cmd, Storage::tag_type tag,
+                          Storage::sector_type sector, const Storage::dma_type &dma);
+
 private:
     virtual ServiceSession *create_session(size_t id, const String &args, portal_func func) {
         IStringStream is(args);
         size_t drive;
-        is >> drive;
+        uint prio, weight;
+        is >> drive >> prio >> weight;
+        if(prio > Storage::PRIO_IDLE || weight == 0)
+            VTHROW(Exception, E_ARGS_INVALID, "Invalid priority (" << prio << "," << weight << ")");
         size_t ctrl = drive / Storage::MAX_DRIVES;
         if(!mng->exists(ctrl) || !mng->get(ctrl)->exists(drive)) {
             VTHROW(Exception, E_NOT_FOUND,
                    "Controller/drive (" << ctrl << "," << drive << ") does not exist");
         }
-        return new StorageServiceSession(this, id, func, drive);
+        return new StorageServiceSession(this, id, func, drive,
+                                         static_cast<Storage::Priority>(prio), weight);
     }
 
     PORTAL static void portal(StorageServiceSession *sess);
 };
 
+void StorageServiceSession::consumer_thread(void*) {
+    StorageServiceSession *sess = Thread::current()->get_tls<StorageServiceSession*>(Thread::TLS_PARAM);
+    // don't let the client keep us busy after the session has been closed
+    while(!sess->_stopped) {
+        Storage::Request *req = sess->_cons->get();
+        if(!req)
+            break;
+
+        try {
+            if(req->cmd == Storage::FLUSH)
+                StorageService::flush(sess, req->tag);
+            else if(req->cmd == Storage::READ || req->cmd == Storage::WRITE) {
+                Storage::dma_type dma;
+                dma.push(DMADesc(req->offset, req->count * sess->params().sector_size));
+                StorageService::readwrite(sess, req->cmd, req->tag, req->sector, dma);
+            }
+            else
+                VTHROW(Exception, E_ARGS_INVALID, "Invalid command (" << req->cmd << ")");
+        }
+        catch(const Exception &e) {
+            LOG(STORAGE, "[" << sess->id() << "," << fmt(req->tag, "#x") << "] Request failed: "
+                             << e.msg() << "\n");
+            sess->prod()->produce(Storage::Packet(req->tag, e.code()));
+        }
+        sess->_cons->next();
+    }
+}
+
+void StorageService::flush(StorageServiceSession *sess, Storage::tag_type tag) {
+    LOG(STORAGE_DETAIL, "[" << sess->id() << "," << fmt(tag, "#x") << "] FLUSH\n");
+    if(sched) {
+        sched->submit(sess->client(), Reference<ServiceSession>(sess), sess->prod(), tag, nullptr,
+                      sess->params(), Storage::FLUSH, sess->drive(), 0, Storage::dma_type());
+    }
+    else if(cache) {
+        cache->flush(Reference<ServiceSession>(sess), sess->prod(), tag, sess->params(),
+                     sess->drive());
+    }
+    else {
+        Controller *ctrl = mng->get(sess->ctrl());
+        ctrl->flush(sess->drive(), Reference<ServiceSession>(sess), sess->prod(), tag);
+    }
+}
+
+void StorageService::readwrite(StorageServiceSession *sess, Storage::Command cmd,
+                               Storage::tag_type tag, Storage::sector_type sector,
+                               const Storage::dma_type &dma) {
+    LOG(STORAGE_DETAIL, "[" << sess->id() << "," << fmt(tag, "#x") << "] "
+                            << (cmd == Storage::READ ? "READ" : "WRITE") << " @ " << sector
+                            << " with " << dma << "\n");
+
+    // check offset and size
+    size_t size = dma.bytecount();
+    size_t count = size / sess->params().sector_size;
+    if(size == 0 || (size & (sess->params().sector_size - 1)))
+        VTHROW(Exception, E_ARGS_INVALID, "Invalid size (" << size << ")");
+    if(sector >= sess->params().sectors) {
+        VTHROW(Exception, E_ARGS_INVALID,
+               "Sector " << sector << " is invalid"
+                         << " (available: 0.." << sess->params().sectors - 1 << ")");
+    }
+    if(sector + count > sess->params().sectors) {
+        VTHROW(Exception, E_ARGS_INVALID,
+               "Sector " << (sector + count - 1) << " is invalid"
+                         << " (available: 0.." << sess->params().sectors - 1 << ")");
+    }
+
+    if(cmd == Storage::READ) {
+        if(!(sess->data().flags() & DataSpaceDesc::R))
+            throw Exception(E_ARGS_INVALID, "Need to read, but no read permission");
+        if(sched) {
+            sched->submit(sess->client(), Reference<ServiceSession>(sess), sess->prod(), tag,
+                          &sess->data(), sess->params(), cmd, sess->drive(), sector, dma);
+        }
+        else if(cache) {
+            cache->read(Reference<ServiceSession>(sess), sess->prod(), tag, sess->data(),
+                        sess->params(), sess->drive(), sector, dma, sess->client().stream);
+        }
+        else {
+            Controller *ctrl = mng->get(sess->ctrl());
+            ctrl->read(sess->drive(), Reference<ServiceSession>(sess), sess->prod(), tag,
+                       sess->data(), sector, dma);
+        }
+    }
+    else {
+        if(!(sess->data().flags() & DataSpaceDesc::W))
+            throw Exception(E_ARGS_INVALID, "Need to write, but no write permission");
+        if(sched) {
+            sched->submit(sess->client(), Reference<ServiceSession>(sess), sess->prod(), tag,
+                          &sess->data(), sess->params(), cmd, sess->drive(), sector, dma);
+        }
+        else if(cache) {
+            cache->write(Reference<ServiceSession>(sess), sess->prod(), tag, sess->data(),
+                         sess->params(), sess->drive(), sector, dma);
+        }
+        else {
+            Controller *ctrl = mng->get(sess->ctrl());
+            ctrl->write(sess->drive(), Reference<ServiceSession>(sess), sess->prod(), tag,
+                        sess->data(), sector, dma);
+        }
+    }
+}
+
 void StorageService::portal(StorageServiceSession *sess) {
     UtcbFrameRef uf;
     try {
@@ -122,8 +296,11 @@ void StorageService::portal(StorageServiceSession *sess) {
                 capsel_t ctrlsel = uf.get_delegated(0).offset();
                 capsel_t datasel = uf.get_delegated(0).offset();
                 capsel_t smsel = uf.get_delegated(0).offset();
+                capsel_t subsel = uf.get_delegated(0).offset();
+                capsel_t subsmsel = uf.get_delegated(0).offset();
                 uf.finish_input();
-                sess->init(new DataSpace(ctrlsel), new DataSpace(datasel), new Sm(smsel, false));
+                sess->init(new DataSpace(ctrlsel), new DataSpace(datasel), new Sm(smsel, false),
+                           new DataSpace(subsel), new Sm(subsmsel, false));
                 uf.accept_delegates();
                 uf << E_SUCCESS << sess->params();
             }
@@ -133,8 +310,11 @@ void StorageService::portal(StorageServiceSession *sess) {
                 Storage::tag_type tag;
                 uf >> tag;
                 uf.finish_input();
-                LOG(STORAGE_DETAIL, "[" << sess->id() << "," << fmt(tag, "#x") << "] FLUSH\n");
-                mng->get(sess->ctrl())->flush(sess->drive(), sess->prod(), tag);
+
+                if(!sess->initialized())
+                    throw Exception(E_ARGS_INVALID, "Not initialized");
+
+                flush(sess, tag);
                 uf << E_SUCCESS;
             }
             break;
@@ -143,45 +323,14 @@ void StorageService::portal(StorageServiceSession *sess) {
             case Storage::WRITE: {
                 Storage::tag_type tag;
                 Storage::sector_type sector;
-                DMADescList<Storage::MAX_DMA_DESCS> dma;
+                Storage::dma_type dma;
                 uf >> tag >> sector >> dma;
                 uf.finish_input();
 
                 if(!sess->initialized())
                     throw Exception(E_ARGS_INVALID, "Not initialized");
 
-                LOG(STORAGE_DETAIL, "[" << sess->id() << "," << fmt(tag, "#x") << "] "
-                                        << (cmd == Storage::READ ? "READ" : "WRITE") << " @ " << sector
-                                        << " with " << dma << "\n");
-
-                // check offset and size
-                size_t size = dma.bytecount();
-                size_t count = size / sess->params().sector_size;
-                if(size == 0 || (size & (sess->params().sector_size - 1)))
-                    VTHROW(Exception, E_ARGS_INVALID, "Invalid size (" << size << ")");
-                if(sector >= sess->params().sectors) {
-                    VTHROW(Exception, E_ARGS_INVALID,
-                           "Sector " << sector << " is invalid"
-                                     << " (available: 0.." << sess->params().sectors - 1 << ")");
-                }
-                if(sector + count > sess->params().sectors) {
-                    VTHROW(Exception, E_ARGS_INVALID,
-                           "Sector " << (sector + count - 1) << " is invalid"
-                                     << " (available: 0.." << sess->params().sectors - 1 << ")");
-                }
-
-                if(cmd == Storage::READ) {
-                    if(!(sess->data().flags() & DataSpaceDesc::R))
-                        throw Exception(E_ARGS_INVALID, "Need to read, but no read permission");
-                    mng->get(sess->ctrl())->read(sess->drive(), sess->prod(), tag,
-                                                 sess->data(), sector, dma);
-                }
-                else {
-                    if(!(sess->data().flags() & DataSpaceDesc::W))
-                        throw Exception(E_ARGS_INVALID, "Need to write, but no write permission");
-                    mng->get(sess->ctrl())->write(sess->drive(), sess->prod(), tag, sess->data(), sector,
-                                                  dma);
-                }
+                readwrite(sess, cmd, tag, sector, dma);
                 uf << E_SUCCESS;
             }
             break;
@@ -196,14 +345,35 @@ void StorageService::portal(StorageServiceSession *sess) {
 
 int main(int argc, char *argv[]) {
     bool idedma = true;
+    bool usesched = true;
+    bool writeback = true;
+    size_t cachesize = 0;
     for(int i = 1; i < argc; ++i) {
         if(strcmp(argv[i], "noidedma") == 0) {
             LOG(STORAGE, "Disabling DMA for IDE devices\n");
             idedma = false;
         }
+        else if(strcmp(argv[i], "nosched") == 0)
+            usesched = false;
+        else if(strcmp(argv[i], "writethrough") == 0)
+            writeback = false;
+        else if(strncmp(argv[i], "cache=", 6) == 0)
+            cachesize = IStringStream::read_from<size_t>(String(argv[i] + 6));
+        else if(strncmp(argv[i], "trace=", 6) == 0)
+            Trace::enable(strtoul(argv[i] + 6, nullptr, 0));
     }
 
     mng = new ControllerMng(idedma);
+    // the cache is only used if its size (in KiB) is given, because it copies the data of small
+    // requests instead of letting the controller transfer them directly
+    if(cachesize > 0)
+        cache = new BlockCache(mng, cachesize * 1024, writeback);
+    else
+        LOG(STORAGE, "Disabling the block cache\n");
+    if(usesched)
+        sched = new IOScheduler(mng, cache);
+    else
+        LOG(STORAGE, "Disabling the I/O scheduler\n");
     srv = new StorageService("storage");
     srv->start();
     return 0;
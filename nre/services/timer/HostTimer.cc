@@ -20,6 +20,7 @@
 #include <util/Date.h>
 #include <util/Topology.h>
 #include <Logging.h>
+#include <Trace.h>
 
 #include "HostTimer.h"
 #include "HostHPET.h"
@@ -27,6 +28,8 @@
 
 using namespace nre;
 
+Slab<HostTimer::ClientData> HostTimer::ClientData::_slab;
+
 HostTimer::ClientData::ClientData(size_t sid, cpu_t cpu, HostTimer::PerCpu *per_cpu, nre::Sm *sm)
     : abstimeout(0), count(0), nr(per_cpu->abstimeouts.alloc(this)), cpu(cpu),
       sm(sm), sid(sid), per_cpu(per_cpu) {
@@ -42,7 +45,9 @@ HostTimer::ClientData::~ClientData() {
 }
 
 HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc)
-    : _clocks_per_tick(0), _timer(), _rtc(), _clock(Timer::WALLCLOCK_FREQ), _per_cpu(), _xcpu_up(0) {
+    : _clocks_per_tick(0), _timer(), _rtc(), _clock(Timer::WALLCLOCK_FREQ),
+      _clock_info(), _clock_tsc(),
+      _clock_period(), _per_cpu(), _xcpu_up(0) {
     if(!force_pit) {
         try {
             _timer = new HostHPET(force_hpet_legacy);
@@ -120,6 +125,10 @@ HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc)
     }
 
     _timer->update_ticks(true);
+    _clock_period = Math::muldiv128(CLOCK_PERIOD, Hip::get().freq_tsc, 1000);
+    _clock_tsc = Util::tsc();
+    update_clock();
+
     uint xcpu_threads_started = 0;
     for(auto it = CPU::begin(); it != CPU::end(); ++it) {
         cpu_t cpu = it->log_id();
@@ -148,6 +157,41 @@ HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc)
     LOG(TIMER_DETAIL, "TIMER: Initialized!\n");
 }
 
+void HostTimer::get_clock(Timer::ClockInfo &ci) const {
+    uint32_t seq;
+    do {
+        seq = _clock_info.seq;
+        Sync::memory_barrier();
+        ci.shift = _clock_info.shift;
+        ci.mult = _clock_info.mult;
+        ci.tsc_base = _clock_info.tsc_base;
+        ci.uptime_base = _clock_info.uptime_base;
+        ci.unix_base = _clock_info.unix_base;
+        ci.max_age = _clock_info.max_age;
+        Sync::memory_barrier();
+    }
+    while((seq & 1) || _clock_info.seq != seq);
+}
+
+void HostTimer::update_clock() {
+    Timer::ClockInfo *ci = &_clock_info;
+    // take the TSC and the timer counter as close together as possible
+    timevalue_t tsc = Util::tsc();
+    timevalue_t ticks = _timer->current_ticks();
+
+    ci->seq++;
+    Sync::memory_barrier();
+    ci->shift = 32;
+    ci->mult = Math::muldiv128(Timer::WALLCLOCK_FREQ, 1ULL << 32,
+                               static_cast<timevalue_t>(Hip::get().freq_tsc) * 1000);
+    ci->tsc_base = tsc;
+    ci->uptime_base = _clock.dest_time_of(tsc);
+    ci->unix_base = Math::muldiv128(ticks, Timer::WALLCLOCK_FREQ, _timer->freq());
+    ci->max_age = _clock_period;
+    Sync::memory_barrier();
+    ci->seq++;
+}
+
 bool HostTimer::per_cpu_handle_xcpu(PerCpu *per_cpu) {
     bool reprogram = false;
 
@@ -213,6 +257,10 @@ void HostTimer::portal_per_cpu(void*) {
     cpu_t cpu = CPU::current().log_id();
     PerCpu *per_cpu = ht->_per_cpu[cpu];
 
+    // the timer IRQs arrive regularly, so that this keeps the clock up to date while the system
+    // is busy. otherwise, GET_TIME does it
+    ht->refresh_clock();
+
     UtcbFrameRef uf;
     WorkerMessage m;
     uf >> m;
@@ -250,6 +298,7 @@ again:
     per_cpu->last_to = next_to;
 
     if(per_cpu->has_timer) {
+        TRACE(TIMER, TIMER_PROGRAM, next_to, estimated_now);
         per_cpu->timer->program_timeout(next_to);
         // Check whether we might have missed that interrupt.
         if(ht->_timer->is_in_past(next_to)) {
@@ -298,6 +347,7 @@ NORETURN void HostTimer::gsi_thread(void *) {
     LOG(TIMER, "Listening to GSI " << our->timer->gsi().gsi() << "\n");
     while(1) {
         our->timer->gsi().down();
+        TRACE(TIMER, TIMER_IRQ, our->timer->gsi().gsi(), ht->_timer->last_ticks());
 
         ht->_timer->ack_irq(our->timer);
         UtcbFrame uf;
@@ -21,7 +21,9 @@
 #include <kobj/LocalThread.h>
 #include <kobj/Pt.h>
 #include <kobj/Sm.h>
+#include <mem/Slab.h>
 #include <services/Timer.h>
+#include <util/Atomic.h>
 #include <util/TimeoutList.h>
 
 #include "HostTimerDevice.h"
@@ -31,10 +33,13 @@ class HostTimer {
     struct PerCpu;
 
 public:
-    static const size_t MAX_CLIENTS = 64;
+    // the timeout objects are allocated in chunks of this size
+    static const size_t CLIENT_CHUNK    = 64;
     // Resolution of our TSC clocks per HPET clock measurement. Lower
     // resolution mean larger error in HPET counter estimation.
     static const uint CPT_RES           = /* 1 divided by */ (1U << 13); /* clocks per hpet tick */
+    // the clock is re-anchored to the timer counter at most this often (in microseconds)
+    static const uint CLOCK_PERIOD      = 1000000;
 
     struct ClientData {
         // This field has different semantics: When this ClientData
@@ -55,6 +60,16 @@ public:
         }
         explicit ClientData(size_t sid, cpu_t cpu, HostTimer::PerCpu *per_cpu, nre::Sm *sm);
         ~ClientData();
+
+        static void *operator new(size_t size) {
+            return _slab.alloc(size);
+        }
+        static void operator delete(void *ptr, size_t size) {
+            _slab.free(ptr, size);
+        }
+
+    private:
+        static nre::Slab<ClientData> _slab;
     };
 
 private:
@@ -74,7 +89,7 @@ private:
     struct PerCpu {
         bool has_timer;
         HostTimerDevice::Timer *timer;
-        nre::TimeoutList<MAX_CLIENTS, ClientData> abstimeouts;
+        nre::TimeoutList<CLIENT_CHUNK, ClientData> abstimeouts;
 
         nre::Reference<nre::LocalThread> ec;
         nre::Pt worker_pt;
@@ -120,6 +135,27 @@ public:
         unixts = nre::Math::muldiv128(ticks, nre::Timer::WALLCLOCK_FREQ, _timer->freq());
     }
 
+    /**
+     * Copies the current anchor of the clock into <ci>, except for the sequence number. May be
+     * called on all CPUs concurrently.
+     *
+     * @param ci the clock info to write to
+     */
+    void get_clock(nre::Timer::ClockInfo &ci) const;
+
+    /**
+     * Re-anchors the clock, if the last update is at least CLOCK_PERIOD ago. May be called
+     * on all CPUs concurrently; only one of them will do the update.
+     */
+    void refresh_clock() {
+        timevalue_t now = nre::Util::tsc();
+        timevalue_t last = _clock_tsc;
+        if(now - last < _clock_period)
+            return;
+        if(nre::Atomic::cmpnswap(&_clock_tsc, last, now))
+            update_clock();
+    }
+
 private:
     /**
      * Convert an absolute TSC value into an absolute time counter value. Call only from
@@ -133,6 +169,7 @@ private:
         return diff + _timer->current_ticks();
     }
 
+    void update_clock();
     bool per_cpu_handle_xcpu(PerCpu *per_cpu);
     bool per_cpu_client_request(PerCpu *per_cpu, ClientData *data);
     timevalue_t handle_expired_timers(PerCpu *per_cpu, timevalue_t now);
@@ -145,6 +182,9 @@ private:
     HostTimerDevice *_timer;
     HostRTC _rtc;
     nre::Clock _clock;
+    nre::Timer::ClockInfo _clock_info;
+    volatile timevalue_t _clock_tsc;
+    timevalue_t _clock_period;
     PerCpu **_per_cpu;
     nre::Sm _xcpu_up;
 };
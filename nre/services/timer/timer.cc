@@ -17,6 +17,8 @@
 #include <kobj/Sm.h>
 #include <services/Timer.h>
 #include <Logging.h>
+#include <Trace.h>
+#include <cstring>
 
 #include "HostTimer.h"
 
@@ -32,7 +34,8 @@ public:
     // take care that we do the allocation of ClientData only from the corresponding CPU
     explicit TimerSessionData(Service *s, size_t id, portal_func func)
         : ServiceSession(s, id, func), _sms(new Sm*[CPU::count()]),
-          _data(new HostTimer::ClientData*[CPU::count()]()) {
+          _data(new HostTimer::ClientData*[CPU::count()]()),
+          _clock(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW) {
         for(auto it = CPU::begin(); it != CPU::end(); ++it)
             _sms[it->log_id()] = new Sm(0);
     }
@@ -46,6 +49,14 @@ public:
         delete[] _data;
     }
 
+    // sessions are opened and closed frequently, e.g. when VMs are started
+    static void *operator new(size_t size) {
+        return _slab.alloc(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        _slab.free(ptr, size);
+    }
+
     Sm &sm(cpu_t cpu) {
         return *_sms[cpu];
     }
@@ -56,11 +67,32 @@ public:
         return _data[cpu];
     }
 
+    const DataSpace &clock() const {
+        return _clock;
+    }
+    // only we write to the clock page. if the client does so, it only hurts itself, because
+    // TimerSession::get_time will use GET_TIME then, if it can't read the page
+    void update_clock() {
+        nre::Timer::ClockInfo *ci = reinterpret_cast<nre::Timer::ClockInfo*>(_clock.virt());
+        uint32_t seq = ci->seq;
+        // somebody else updates it at the moment
+        if((seq & 1) || !Atomic::cmpnswap(&ci->seq, seq, seq + 1))
+            return;
+        Sync::memory_barrier();
+        timer->get_clock(*ci);
+        Sync::memory_barrier();
+        ci->seq = seq + 2;
+    }
+
 private:
     Sm **_sms;
     HostTimer::ClientData **_data;
+    DataSpace _clock;
+    static Slab<TimerSessionData> _slab;
 };
 
+Slab<TimerSessionData> TimerSessionData::_slab;
+
 class TimerService : public Service {
 public:
     explicit TimerService(const char *name)
@@ -106,6 +138,10 @@ void TimerService::portal(TimerSessionData *sess) {
             case nre::Timer::GET_TIME: {
                 uf.finish_input();
 
+                // the client asks us because its clock page is outdated
+                timer->refresh_clock();
+                sess->update_clock();
+
                 timevalue_t uptime, unixts;
                 timer->get_time(uptime, unixts);
                 LOG(TIMER_DETAIL, "TIMER: (" << sess->id() << ") Getting time"
@@ -114,6 +150,16 @@ void TimerService::portal(TimerSessionData *sess) {
                 uf << E_SUCCESS << uptime << unixts;
             }
             break;
+
+            case nre::Timer::GET_CLOCK:
+                uf.finish_input();
+
+                // the client should only read it; but note that NOVA can't restrict the
+                // permissions of the dataspace capability yet (see DataSpace::crd)
+                sess->update_clock();
+                uf.delegate(sess->clock().crd(DataSpaceDesc::R));
+                uf << E_SUCCESS;
+                break;
         }
     }
     catch(const Exception &e) {
@@ -133,6 +179,8 @@ int main(int argc, char *argv[]) {
             forcehpetlegacy = true;
         if(strcmp(argv[i], "slowrtc") == 0)
             slowrtc = true;
+        if(strncmp(argv[i], "trace=", 6) == 0)
+            Trace::enable(strtoul(argv[i] + 6, nullptr, 0));
     }
 
     timer = new HostTimer(forcepit, forcehpetlegacy, slowrtc);
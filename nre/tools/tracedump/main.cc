@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2013, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+/**
+ * Decodes the trace buffers written by nre::Trace. The input is either a log of the serial line,
+ * which contains the buffers as written by Trace::dump(), or a raw memory dump of the machine
+ * (e.g. taken with pmemsave in qemu), in which the buffers are searched by their magic number.
+ * The events of all buffers are merged and printed as text or in the Chrome trace format, which
+ * can be viewed with chrome://tracing.
+ */
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../include/TraceFormat.h"
+
+using namespace std;
+using namespace nre;
+
+struct EventInfo {
+    char phase;
+    const char *name;
+    const char *args[2];
+};
+
+struct Event {
+    size_t buffer;
+    TraceFormat::Record rec;
+
+    bool operator<(const Event &e) const {
+        return rec.tsc < e.rec.tsc;
+    }
+};
+
+struct Buffer {
+    string name;
+    uint64_t tsc_freq;
+};
+
+#define TRACE_EVENT_INFO(id, phase, name, arg0, arg1) {phase, name, {arg0, arg1}},
+static const EventInfo infos[] = {
+    TRACE_EVENTS(TRACE_EVENT_INFO)
+};
+#undef TRACE_EVENT_INFO
+
+static vector<Buffer> buffers;
+static vector<Event> events;
+
+static int hexval(char c) {
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Decodes the buffer at <data>. If <compact> is true, it has been written by Trace::dump(), i.e.
+ * only the used records of each CPU are present. Otherwise, it has the layout of the memory.
+ *
+ * @return the number of bytes that belong to the buffer (0 if it is invalid)
+ */
+static size_t decode(const uint8_t *data, size_t size, bool compact) {
+    TraceFormat::Header hd;
+    if(size < sizeof(hd))
+        return 0;
+    memcpy(&hd, data, sizeof(hd));
+    if(hd.magic != TraceFormat::MAGIC || hd.version != TraceFormat::VERSION ||
+       hd.record_size != sizeof(TraceFormat::Record) || hd.records == 0 ||
+       (hd.records & (hd.records - 1)) != 0) {
+        return 0;
+    }
+
+    Buffer buf;
+    hd.name[TraceFormat::NAME_LEN - 1] = '\0';
+    buf.name = hd.name;
+    buf.tsc_freq = hd.tsc_freq;
+    size_t bufno = buffers.size();
+    buffers.push_back(buf);
+
+    size_t pos = sizeof(hd);
+    for(uint32_t cpu = 0; cpu < hd.cpus; ++cpu) {
+        TraceFormat::CPUHeader ch;
+        if(pos + sizeof(ch) > size) {
+            cerr << "Warning: buffer of '" << buf.name << "' is truncated" << endl;
+            return size;
+        }
+        memcpy(&ch, data + pos, sizeof(ch));
+        pos += sizeof(ch);
+
+        uint32_t count = min(ch.wpos, hd.records);
+        uint32_t slots = compact ? count : hd.records;
+        if(pos + slots * sizeof(TraceFormat::Record) > size) {
+            cerr << "Warning: buffer of '" << buf.name << "' is truncated" << endl;
+            return size;
+        }
+
+        // the oldest record that has not been overwritten yet comes first
+        for(uint32_t i = ch.wpos - count; i != ch.wpos; ++i) {
+            Event ev;
+            ev.buffer = bufno;
+            memcpy(&ev.rec, data + pos + (i & (hd.records - 1)) * sizeof(TraceFormat::Record),
+                   sizeof(ev.rec));
+            // skip records that have been overwritten while writing them or are not finished
+            if(ev.rec.seq != i + 1 || ev.rec.event >= TraceFormat::EVENT_COUNT)
+                continue;
+            events.push_back(ev);
+        }
+        pos += slots * sizeof(TraceFormat::Record);
+    }
+    return pos;
+}
+
+static void parse_log(istream &in) {
+    vector<uint8_t> data;
+    bool inside = false;
+    // whether lines are missing. everything behind the first gap is useless, because the
+    // decoder can't know where the following bytes belong to
+    bool gap = false;
+    string line;
+    while(getline(in, line)) {
+        // the lines might be prefixed by the log-service
+        size_t start = line.find("#TRACE");
+        if(start == string::npos)
+            continue;
+
+        string rest = line.substr(start);
+        if(rest.compare(0, 12, "#TRACE-BEGIN") == 0) {
+            data.clear();
+            inside = true;
+            gap = false;
+        }
+        else if(rest.compare(0, 10, "#TRACE-END") == 0) {
+            if(inside && decode(&data[0], data.size(), true) == 0)
+                cerr << "Warning: ignoring invalid trace buffer" << endl;
+            inside = false;
+        }
+        else if(inside && !gap && rest.compare(0, 7, "#TRACE ") == 0) {
+            // every line starts with the offset of its bytes
+            char *end;
+            unsigned long off = strtoul(rest.c_str() + 7, &end, 16);
+            if(*end != ' ' || off != data.size()) {
+                cerr << "Warning: lines of trace buffer are missing at offset " << data.size()
+                     << "; decoding only the part before" << endl;
+                gap = true;
+                continue;
+            }
+            for(size_t i = end - rest.c_str() + 1; i + 1 < rest.size(); i += 2) {
+                int hi = hexval(rest[i]), lo = hexval(rest[i + 1]);
+                if(hi < 0 || lo < 0)
+                    break;
+                data.push_back((hi << 4) | lo);
+            }
+        }
+    }
+}
+
+static void parse_raw(const vector<uint8_t> &data) {
+    for(size_t off = 0; off + sizeof(TraceFormat::Header) <= data.size(); off += 4) {
+        uint32_t magic;
+        memcpy(&magic, &data[off], sizeof(magic));
+        if(magic == TraceFormat::MAGIC) {
+            size_t len = decode(&data[off], data.size() - off, false);
+            if(len > 0)
+                off += (len & ~static_cast<size_t>(3)) - 4;
+        }
+    }
+}
+
+static double to_us(uint64_t tsc, uint64_t base, uint64_t freq) {
+    return freq ? static_cast<double>(tsc - base) * 1000000.0 / freq : static_cast<double>(tsc - base);
+}
+
+static void print_text(uint64_t base) {
+    for(size_t i = 0; i < events.size(); ++i) {
+        const Event &ev = events[i];
+        const EventInfo &info = infos[ev.rec.event];
+        const Buffer &buf = buffers[ev.buffer];
+        printf("%14.3f us  %-12s cpu %-3u %-18s %c", to_us(ev.rec.tsc, base, buf.tsc_freq),
+               buf.name.c_str(), ev.rec.cpu, info.name, info.phase);
+        for(size_t a = 0; a < 2; ++a) {
+            printf("  %s=%#llx", info.args[a],
+                   static_cast<unsigned long long>(ev.rec.args[a]));
+        }
+        printf("\n");
+    }
+}
+
+static void print_chrome(uint64_t base) {
+    printf("{\"traceEvents\":[\n");
+    for(size_t i = 0; i < buffers.size(); ++i) {
+        printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":0,"
+               "\"args\":{\"name\":\"%s\"}},\n", i, buffers[i].name.c_str());
+    }
+    for(size_t i = 0; i < events.size(); ++i) {
+        const Event &ev = events[i];
+        const EventInfo &info = infos[ev.rec.event];
+        const Buffer &buf = buffers[ev.buffer];
+        printf("{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%zu,\"tid\":%u,",
+               info.name, info.phase, to_us(ev.rec.tsc, base, buf.tsc_freq), ev.buffer,
+               ev.rec.cpu);
+        if(info.phase == 'i')
+            printf("\"s\":\"t\",");
+        printf("\"args\":{\"%s\":\"%#llx\",\"%s\":\"%#llx\"}}%s\n",
+               info.args[0], static_cast<unsigned long long>(ev.rec.args[0]),
+               info.args[1], static_cast<unsigned long long>(ev.rec.args[1]),
+               i + 1 < events.size() ? "," : "");
+    }
+    printf("],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+static void usage(const char *name) {
+    cerr << "Usage: " << name << " [--chrome] <file>" << endl;
+    cerr << "  <file> is either a log of the serial line or a raw memory dump" << endl;
+    cerr << "  --chrome: print the events in the Chrome trace format instead of text" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    bool chrome = false;
+    const char *file = NULL;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--chrome") == 0)
+            chrome = true;
+        else if(!file)
+            file = argv[i];
+        else
+            usage(argv[0]);
+    }
+    if(!file)
+        usage(argv[0]);
+
+    ifstream in(file, ios::in | ios::binary);
+    if(!in) {
+        cerr << "Unable to open " << file << " for reading" << endl;
+        return EXIT_FAILURE;
+    }
+    vector<uint8_t> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    in.close();
+
+    string text(data.begin(), data.end());
+    if(text.find("#TRACE-BEGIN") != string::npos) {
+        istringstream is(text);
+        parse_log(is);
+    }
+    else
+        parse_raw(data);
+
+    if(events.empty()) {
+        cerr << "No trace events found" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // the TSC is synchronized between the CPUs, so that we can simply merge all events
+    stable_sort(events.begin(), events.end());
+    uint64_t base = events[0].rec.tsc;
+    if(chrome)
+        print_chrome(base);
+    else
+        print_text(base);
+    return EXIT_SUCCESS;
+}